@@ -31,8 +31,11 @@
 #include <xcb/xcb_ewmh.h>
 
 extern xcb_atom_t UNAGI__NET_WM_WINDOW_OPACITY;
+extern xcb_atom_t UNAGI__NET_WM_BYPASS_COMPOSITOR;
+extern xcb_atom_t UNAGI__NET_WM_OPAQUE_REGION;
 extern xcb_atom_t UNAGI__XROOTPMAP_ID;
 extern xcb_atom_t UNAGI__XSETROOT_ID;
+extern xcb_atom_t UNAGI_WM_STATE;
 
 extern const xcb_atom_t *unagi_background_properties_atoms[];
 
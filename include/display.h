@@ -30,8 +30,15 @@
 #include <xcb/xfixes.h>
 #include <xcb/randr.h>
 
+#include "window.h"
+#include "region.h"
+
 void unagi_display_init_event_handlers(void);
 
+void unagi_display_round_trips_enable(const bool);
+unsigned int unagi_display_round_trips_get(void);
+void unagi_display_round_trip(const unsigned int);
+
 void unagi_display_init_extensions(void);
 void unagi_display_init_extensions_finalise(void);
 
@@ -46,13 +53,31 @@ void unagi_display_init_redirect(void);
 void unagi_display_init_redirect_finalise(void);
 
 void unagi_display_add_damaged_region(xcb_xfixes_region_t *, bool);
+void unagi_display_add_damaged_rectangle(const xcb_rectangle_t *);
+void unagi_display_add_damaged_window(unagi_window_t *, bool);
+bool unagi_display_is_damaged(void);
+void unagi_display_upload_damaged(void);
+bool unagi_display_get_damaged_extents(unagi_region_box_t *);
+void unagi_display_restrict_damaged(const xcb_rectangle_t *, const uint32_t);
+const xcb_rectangle_t *unagi_display_get_restricted_area(uint32_t *);
 void unagi_display_reset_damaged(void);
+void unagi_display_cleanup(void);
 
 void unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t,
                                              xcb_randr_get_screen_resources_cookie_t);
+void unagi_display_update_screen_information_finalise(void);
+
+bool unagi_display_is_unredirected(void);
+bool unagi_display_unredirection_is_pending(void);
+bool unagi_display_update_unredirection(void);
 
 bool display_vsync_drm_init(void);
 int display_vsync_drm_wait(void);
 void display_vsync_drm_cleanup(void);
 
+#ifdef HAVE_XCB_PRESENT
+void display_vsync_present_init(void);
+void display_vsync_present_notify_msc(void);
+#endif
+
 #endif
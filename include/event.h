@@ -26,10 +26,29 @@
 
 #include <xcb/xcb.h>
 
+#include <ev.h>
+
 #include "display.h"
 
+/** Events statistics over the last reporting period, per second */
+typedef struct
+{
+  /** DamageNotify events discarded as the window was already fully
+      damaged */
+  double damage_notify_discarded;
+  /** ConfigureNotify events merged with a previous one */
+  double configure_notify_coalesced;
+  /** Windows unmapped before being painted */
+  double windows_unmapped_before_paint;
+} unagi_event_stats_t;
+
 void unagi_event_handle_startup(xcb_generic_event_t *);
 void unagi_event_handle(xcb_generic_event_t *);
 void unagi_event_handle_poll_loop(void (*handler)(xcb_generic_event_t *));
+void unagi_event_handle_budgeted(const ev_tstamp, const double);
+void unagi_event_flush_configure_notify(void);
+ev_tstamp unagi_event_flush_map_notify(void);
+const unagi_event_stats_t *unagi_event_get_stats(void);
+void unagi_event_cleanup(void);
 
 #endif
@@ -0,0 +1,41 @@
+/* -*-mode:c;coding:utf-8; c-basic-offset:2;fill-column:70;c-file-style:"gnu"-*-
+ *
+ * Copyright (C) 2009 Arnaud "arnau" Fontaine <arnau@mini-dweeb.org>
+ *
+ * This  program is  free  software: you  can  redistribute it  and/or
+ * modify  it under the  terms of  the GNU  General Public  License as
+ * published by the Free Software  Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have  received a copy of the  GNU General Public License
+ *  along      with      this      program.      If      not,      see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ *  \brief Painting scheduler
+ */
+
+#ifndef UNAGI_PAINT_H
+#define UNAGI_PAINT_H
+
+#include <stdint.h>
+
+#include "region.h"
+
+void unagi_paint_init(void);
+void unagi_paint_update_clocks(void);
+void unagi_paint_schedule_box(const unagi_region_box_t *);
+void unagi_paint_schedule(void);
+void unagi_paint_stop(void);
+void unagi_paint_vblank(uint64_t, uint64_t);
+void unagi_paint_vblank_failed(void);
+void unagi_paint_check_frame_completion(void);
+double unagi_paint_get_map_latency(void);
+
+#endif
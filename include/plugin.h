@@ -144,6 +144,7 @@ typedef struct _unagi_plugin_t
 void unagi_plugin_load_all(void);
 void unagi_plugin_check_requirements(void);
 unagi_plugin_t *unagi_plugin_search_by_name(const char *);
+bool unagi_plugin_is_painting_activated(void);
 void unagi_plugin_unload_all(void);
 
 #endif
@@ -0,0 +1,88 @@
+/* -*-mode:c;coding:utf-8; c-basic-offset:2;fill-column:70;c-file-style:"gnu"-*-
+ *
+ * Copyright (C) 2009 Arnaud "arnau" Fontaine <arnau@mini-dweeb.org>
+ *
+ * This  program is  free  software: you  can  redistribute it  and/or
+ * modify  it under the  terms of  the GNU  General Public  License as
+ * published by the Free Software  Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have  received a copy of the  GNU General Public License
+ *  along      with      this      program.      If      not,      see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ *  \brief Client-side regions
+ *
+ *  Unlike XFixes  regions, these  regions are  kept in  the client
+ *  memory, thus  no  request  is  needed  to  compute  an  union,  an
+ *  intersection or a subtraction.  A region  is  stored  as  a  list of
+ *  non-overlapping boxes sorted by bands, i.e.  the boxes of a band all
+ *  share the same top  and bottom coordinates  and are sorted from  the
+ *  left to the right (as done by the X server itself)
+ */
+
+#ifndef UNAGI_REGION_H
+#define UNAGI_REGION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** A box, the bottom-right corner is excluded */
+typedef struct
+{
+  int32_t x1, y1, x2, y2;
+} unagi_region_box_t;
+
+/** Client-side region */
+typedef struct
+{
+  /** Smallest box containing all the boxes of the region */
+  unagi_region_box_t extents;
+  /** Boxes sorted by bands */
+  unagi_region_box_t *boxes;
+  /** Number of boxes */
+  uint32_t boxes_len;
+  /** Number of boxes which can be stored without reallocation */
+  uint32_t boxes_size;
+} unagi_region_t;
+
+/** Check whether the given box is empty */
+#define unagi_region_box_is_empty(box)                          \
+  ((box)->x1 >= (box)->x2 || (box)->y1 >= (box)->y2)
+
+/** Area of the given non-empty box */
+#define unagi_region_box_area(box)                                      \
+  ((uint64_t) ((box)->x2 - (box)->x1) * (uint64_t) ((box)->y2 - (box)->y1))
+
+void unagi_region_init(unagi_region_t *);
+void unagi_region_init_box(unagi_region_t *, const unagi_region_box_t *);
+void unagi_region_free(unagi_region_t *);
+void unagi_region_reset(unagi_region_t *);
+void unagi_region_reset_box(unagi_region_t *, const unagi_region_box_t *);
+bool unagi_region_copy(unagi_region_t *, const unagi_region_t *);
+bool unagi_region_union(unagi_region_t *, const unagi_region_t *,
+                        const unagi_region_t *);
+bool unagi_region_union_box(unagi_region_t *, const unagi_region_box_t *);
+bool unagi_region_intersect(unagi_region_t *, const unagi_region_t *,
+                            const unagi_region_t *);
+bool unagi_region_subtract(unagi_region_t *, const unagi_region_t *,
+                           const unagi_region_t *);
+bool unagi_region_contains_box(const unagi_region_t *,
+                               const unagi_region_box_t *);
+uint64_t unagi_region_area(const unagi_region_t *);
+
+/** Check whether the given region is empty */
+static inline bool
+unagi_region_is_empty(const unagi_region_t *region)
+{
+  return region->boxes_len == 0;
+}
+
+#endif /* UNAGI_REGION_H */
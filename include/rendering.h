@@ -39,6 +39,7 @@
 #include <stdint.h>
 
 #include "window.h"
+#include "region.h"
 
 /** Functions exported by the rendering backend */
 typedef struct
@@ -51,8 +52,14 @@ typedef struct
   void (*reset_background) (void);
   /** Paint the root background to the root window */
   void (*paint_background) (void);
-  /** Paint a given window */
-  void (*paint_window) (unagi_window_t *);
+  /** Paint a given window, only within the given region (screen
+      relative) if not NULL */
+  void (*paint_window) (unagi_window_t *, const unagi_region_t *);
+  /** Paint a given opaque window directly on the screen, within the
+      damaged region which it covers entirely */
+  void (*paint_window_direct) (unagi_window_t *);
+  /** Check whether the given window has an alpha channel */
+  bool (*is_window_argb) (unagi_window_t *);
   /** Paint all the windows on the root window */
   void (*paint_all) (void);
   /** Check whether the given request is backend-specific */
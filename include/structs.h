@@ -49,8 +49,16 @@ typedef struct _unagi_display_extensions_t
   const xcb_query_extension_reply_t *xfixes;
   /** The Damage extension information */
   const xcb_query_extension_reply_t *damage;
+  /** Whether DamageAdd is supported (Damage 1.1) */
+  bool damage_add;
   /** The RandR extension information */
   const xcb_query_extension_reply_t *randr;
+  /** The Present extension information (only set when VSync with
+      Present is enabled) */
+  const xcb_query_extension_reply_t *present;
+  /** The Shape extension information (optional, to be notified when
+      the shape of windows changes) */
+  const xcb_query_extension_reply_t *shape;
 } unagi_display_extensions_t;
 
 /** Repaint interval to 20ms (50Hz) if  it could not have been obtained
@@ -74,8 +82,11 @@ typedef struct _unagi_conf_t
   /** libev I/O watcher on XCB FD, invoked in paint callback to ensure
       that no events have been queued while calling the callback */
   ev_io event_io_watcher;
-  /** libev paint timer watcher to be reset according to the painting
-      average time */
+  /** libev prepare watcher handling what has been read from the XCB
+      FD by blocking calls, before the event loop blocks */
+  ev_prepare event_prepare_watcher;
+  /** libev paint timer watcher, started by the painting scheduler
+      only when there is something to paint */
   ev_timer event_paint_timer_watcher;
 
   /** The XCB connection structure */
@@ -86,27 +97,29 @@ typedef struct _unagi_conf_t
   xcb_screen_t *screen;
   xcb_randr_get_crtc_info_reply_t **crtc;
   unsigned int crtc_len;
+  /** Refresh interval in seconds of each CRTC mode */
+  float *crtc_refresh_interval;
   /** If the background has been reset */
   bool background_reset;
   /** Maximum painting interval in seconds (from screen refresh rate) */
   float refresh_rate_interval;
-  /** Repaint interval computed from the painting time average */
+  /** Interval between two repaints, the refresh rate interval unless
+      painting is too slow to keep up with the refresh rate */
   float repaint_interval;
-  /** Sum of all painting times (for calculating the global average) */
-  float paint_time_sum;
-  /** Numbre of paintings (for calculating the global average) */
-  unsigned int paint_counter;
   /** EWMH-related information */
   xcb_ewmh_connection_t ewmh;
   /** The X extensions information */
   unagi_display_extensions_t extensions;
   /** The Window specific to the compositing manager */
   xcb_window_t cm_window;
+  /** The Composite overlay Window where everything is painted, None if
+      not supported, in which case painting is done on the root Window */
+  xcb_window_t overlay_window;
   /** The list of all windows as objects */
   unagi_window_t *windows;
   unagi_window_t *windows_tail;
-  /** Binary Trees used for lookups (The list is still useful for stack order) */
-  unagi_util_itree_t *windows_itree;
+  /** Hash table used for lookups (The list is still useful for stack order) */
+  unagi_util_itable_t *windows_itable;
   /** Damaged region which must be repainted */
   xcb_xfixes_region_t damaged;
   bool force_repaint;
@@ -31,6 +31,7 @@
 
 #define mod(x, N) ((((x) < 0) ? (((x) % (N)) + (N)) : (x)) % (N))
 #define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
 
 #define unagi_ssizeof(foo)            (ssize_t)sizeof(foo)
 #define unagi_countof(foo)            (unagi_ssizeof(foo) / unagi_ssizeof(foo[0]))
@@ -92,6 +93,32 @@ unagi_util_itree_t *util_itree_remove(unagi_util_itree_t *, uint32_t);
 uint32_t util_itree_size(unagi_util_itree_t *);
 void unagi_util_itree_free(unagi_util_itree_t *);
 
+/** Slot of an integer hash table, a 0 key (None) means an empty slot */
+typedef struct
+{
+  uint32_t key;
+  void *value;
+} unagi_util_itable_slot_t;
+
+/** Integer hash table with open addressing (linear probing) */
+typedef struct
+{
+  unagi_util_itable_slot_t *slots;
+  /** Number of slots, a power of two */
+  uint32_t size;
+  /** Number of keys stored */
+  uint32_t len;
+  /** Shift giving an index from a hashed key (32 - log2(size)) */
+  uint8_t shift;
+} unagi_util_itable_t;
+
+unagi_util_itable_t *util_itable_new(void);
+bool util_itable_insert(unagi_util_itable_t *, uint32_t, void *);
+void *util_itable_get(const unagi_util_itable_t *, uint32_t);
+void util_itable_remove(unagi_util_itable_t *, uint32_t);
+uint32_t util_itable_size(const unagi_util_itable_t *);
+void unagi_util_itable_free(unagi_util_itable_t *);
+
 #ifdef __DEBUG__
 #include <stdio.h>
 
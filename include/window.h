@@ -33,9 +33,13 @@
 #include <xcb/xfixes.h>
 
 #include "util.h"
+#include "region.h"
 
 #define UNAGI_WINDOW_FULLY_DAMAGED_RATIO 0.9
 
+/** Maximum number of rectangles of _NET_WM_OPAQUE_REGION kept */
+#define UNAGI_WINDOW_OPAQUE_RECTANGLES_MAX 8
+
 #define UNAGI_WINDOW_TRANSFORM_STATUS_NONE 0
 #define UNAGI_WINDOW_TRANSFORM_STATUS_REQUIRED 1
 #define UNAGI_WINDOW_TRANSFORM_STATUS_DONE 2
@@ -43,34 +47,191 @@
 typedef struct _unagi_window_t
 {
   xcb_window_t id;
+  /** Whether the  window object is a record of the windows store, and
+      not a copy made by a plugin which is never given back to the store */
+  bool is_record;
+  /** Setup of a window added upon CreateNotify, which is completed once
+      the GetWindowAttributes reply has been got */
+  struct
+  {
+    /** GetWindowAttributes request cookie, its reply is polled for */
+    xcb_get_window_attributes_cookie_t cookie;
+    /** Whether the attributes are not known yet */
+    bool is_pending;
+  } setup;
   xcb_get_window_attributes_reply_t *attributes;
   xcb_get_geometry_reply_t *geometry;
   xcb_xfixes_region_t region;
-  xcb_xfixes_fetch_region_cookie_t shape_cookie;
+  /** Bounding shape, only fetched again upon ShapeNotify */
+  struct
+  {
+    /** FetchRegion request cookie, its reply is polled for */
+    xcb_xfixes_fetch_region_cookie_t cookie;
+    /** Whether is_rectangular is known */
+    bool is_known;
+  } shape;
   bool is_rectangular;
   xcb_damage_damage_t damage;
+  /** Damage report level, adapted to the damages of the window */
+  struct
+  {
+    /** Current report level of the Damage object */
+    xcb_damage_report_level_t level;
+    /** Number of consecutive repaints with the same damage pattern */
+    int streak;
+    /** When the report level was set */
+    double time;
+  } damage_level;
+  /** Whether DamageNotify have been received since the damage of the
+      Damage object was last subtracted */
+  bool is_damage_reported;
   bool damaged;
+  /** Part of the window covered by the damages since the last repaint */
   float damaged_ratio;
+  /** Index of the damaged coverage of the window plus one, 0 if none */
+  uint32_t damaged_coverage_index;
   short damage_notify_counter;
+  /** Pixels repainted although not damaged, because the whole window
+      was repainted */
+  uint64_t wasted_pixels;
   xcb_pixmap_t pixmap;
+  /** Whether the Region and Pixmap have to be acquired before painting
+      the window (mapped since the last repaint) */
+  bool is_acquire_pending;
   int transform_status;
   double transform_matrix[4][4];
+  /** _NET_WM_STATE and _NET_WM_BYPASS_COMPOSITOR requests of the client
+      window whose replies are polled for when deciding whether to
+      unredirect the window */
+  xcb_get_property_cookie_t wm_state_cookie;
+  xcb_get_property_cookie_t bypass_compositor_cookie;
+  bool is_fullscreen;
+  uint32_t bypass_compositor;
+  /** Whether these properties have to be requested, which is only done
+      when the window is evaluated for unredirection */
+  bool is_unredirect_hints_stale;
+  /** Client window, holding WM_STATE (ICCCM), which is a descendant of
+      the window when it has been reparented by the window manager.  It
+      is looked for one level of the hierarchy at a time without
+      blocking */
+  struct
+  {
+    /** Client window, None until found */
+    xcb_window_t id;
+    /** Depth of the level being looked at */
+    uint8_t depth;
+    /** Windows of the level being looked at */
+    xcb_window_t *windows;
+    uint32_t windows_len;
+    /** GetProperty(WM_STATE) and QueryTree sequences of each window */
+    unsigned int *sequences;
+    /** Number of replies got so far */
+    uint32_t replies_len;
+    /** Children of the windows of this level, looked at next */
+    xcb_window_t *children;
+    uint32_t children_len;
+  } client;
+  /** _NET_WM_OPAQUE_REGION, the part of an ARGB window which is opaque */
+  struct
+  {
+    /** GetProperty request cookie, its reply is polled for */
+    xcb_get_property_cookie_t cookie;
+    /** Opaque rectangles relative to the window,  only the first ones
+        are kept (less pixels are then considered opaque, which is
+        always correct) */
+    xcb_rectangle_t rectangles[UNAGI_WINDOW_OPAQUE_RECTANGLES_MAX];
+    /** Number of opaque rectangles */
+    uint32_t rectangles_len;
+  } opaque_region;
+  /** ConfigureNotify received since the last repaint */
+  struct
+  {
+    /** Whether the Window Region has to be re-created before painting */
+    bool is_pending;
+    /** Whether the window was not visible before being configured */
+    bool was_not_visible;
+    /** Whether the window has been resized */
+    bool update_pixmap;
+  } configure;
+  /** While the window is being resized, the Pixmap of the previous
+      size is kept until the client has drawn at the new size */
+  struct
+  {
+    /** Whether a new Pixmap has to be acquired */
+    bool is_pending;
+    /** Size (including border) of the Pixmap currently held */
+    uint16_t width, height;
+    /** Time after which the new Pixmap is acquired anyway */
+    double deadline;
+  } resize;
+  /** Damage rate tracking, to throttle windows damaged too often */
+  struct
+  {
+    /** WM_CLASS request whose reply is only got once the rate is known */
+    xcb_get_property_cookie_t wm_class_cookie;
+    /** Whether the maximum rate has been computed */
+    bool is_max_known;
+    /** Maximum number of updates per second, 0 if unlimited */
+    float max;
+    /** Start of the current measurement period */
+    double start_time;
+    /** Time of the last update accounted */
+    double last_time;
+    /** Number of updates during the current measurement period */
+    unsigned int counter;
+    /** Number of updates per second measured on the last period */
+    float rate;
+    /** Whether the damages are only painted max times per second */
+    bool is_throttled;
+    /** When the damages can be painted again if throttled */
+    double next_time;
+    /** Whether a damage is waiting for next_time */
+    bool is_pending;
+    /** Pending damage, covering all the damages received meanwhile */
+    xcb_damage_notify_event_t pending;
+  } damage_rate;
   void *rendering;
+  /** Whether the window is in the stacking array and its index there */
+  bool is_stacked;
+  uint32_t stack_index;
   struct _unagi_window_t *next;
   struct _unagi_window_t *prev;
 } unagi_window_t;
 
+/** Viewable window in the stacking array,  which only holds the windows
+    which may be painted so that a frame does not walk the whole list.
+    The fields  checked for every window when painting are copied there
+    (see unagi_window_stack_update()), so that the window object is only
+    read for the windows actually painted */
+typedef struct
+{
+  unagi_window_t *window;
+  xcb_window_t id;
+  /** Window box (including border), relative to the screen */
+  unagi_region_box_t box;
+  /** Copy of the damaged field of the window */
+  bool is_damaged;
+  /** Copy of the Pixmap of the window */
+  xcb_pixmap_t pixmap;
+  /** Whether the window visual has an alpha channel */
+  bool is_argb;
+} unagi_window_stack_entry_t;
+
+void unagi_window_set_geometry(unagi_window_t *, const xcb_get_geometry_reply_t *);
+void unagi_window_copy(unagi_window_t *, const unagi_window_t *);
 void unagi_window_free_pixmap(unagi_window_t *);
+void unagi_window_get_pixmap_size(const unagi_window_t *, uint16_t *,
+                                  uint16_t *);
 void unagi_window_list_cleanup(void);
 
 /** Get the  window object  associated with the  given Window  XID. As
- *  this is a very common operation, use a binary tree rather than the
+ *  this is a very common operation, use a hash table rather than the
  *  linked list. The linked list is still useful to get windows sorted
  *  by stacking order
  *
  * \param WINDOW_ID The Window XID to look for
  */
-#define unagi_window_list_get(WINDOW_ID) util_itree_get(globalconf.windows_itree, \
+#define unagi_window_list_get(WINDOW_ID) util_itable_get(globalconf.windows_itable, \
                                                         WINDOW_ID)
 
 void unagi_window_list_remove_window(unagi_window_t *, bool);
@@ -79,25 +240,43 @@ void unagi_window_get_root_background_pixmap(void);
 xcb_pixmap_t unagi_window_get_root_background_pixmap_finalise(void);
 xcb_pixmap_t unagi_window_new_root_background_pixmap(void);
 xcb_pixmap_t unagi_window_get_pixmap(const unagi_window_t *);
+void unagi_window_acquire(unagi_window_t *);
+void unagi_window_update_unredirect_hints(unagi_window_t *, const xcb_atom_t);
+unagi_window_t *unagi_window_get_by_client(const xcb_window_t);
+void unagi_window_update_opaque_region(unagi_window_t *);
+bool unagi_window_get_opaque_region(unagi_window_t *, unagi_region_t *);
+unagi_window_t *unagi_window_get_unredirect_candidate(void);
+void unagi_window_update_damage_rate_max(unagi_window_t *);
+float unagi_window_get_damage_rate_max(unagi_window_t *);
 bool unagi_window_is_rectangular(unagi_window_t *);
+void unagi_window_discard_shape(unagi_window_t *);
 xcb_xfixes_region_t unagi_window_get_region(unagi_window_t *, bool, bool);
 bool unagi_window_is_visible(const unagi_window_t *);
 void unagi_window_get_invisible_window_pixmap(unagi_window_t *);
 void unagi_window_get_invisible_window_pixmap_finalise(unagi_window_t *);
 void unagi_window_manage_existing(const int nwindows, const xcb_window_t *);
+int unagi_window_manage_existing_finalise(void);
 unagi_window_t *window_add(const xcb_window_t, bool);
+unagi_window_t *unagi_window_add_created(const xcb_window_t,
+                                         const xcb_get_geometry_reply_t *,
+                                         const bool);
+bool unagi_window_setup_finalise(unagi_window_t *);
+void unagi_window_flush_setup(void);
 void unagi_window_map_raised(const unagi_window_t *);
 void unagi_window_restack(unagi_window_t *, xcb_window_t);
-void unagi_window_paint_all(unagi_window_t *);
-
-static inline float
-window_get_damaged_ratio(unagi_window_t *window, xcb_damage_notify_event_t *event)
-{
-  window->damaged_ratio += (float) (event->area.width * event->area.height) /
-    (float) (window->geometry->width * window->geometry->height);
-
-  return window->damaged_ratio;
-}
+void unagi_window_stack_insert(unagi_window_t *);
+void unagi_window_stack_remove(unagi_window_t *);
+void unagi_window_stack_update(unagi_window_t *);
+void unagi_window_stack_rebuild(void);
+const unagi_window_stack_entry_t *unagi_window_stack_get(uint32_t *);
+void unagi_window_discard_damage(unagi_window_t *);
+void unagi_window_paint_all(void);
+float unagi_window_add_damaged_area(unagi_window_t *, const xcb_rectangle_t *);
+void unagi_window_account_wasted_pixels(unagi_window_t *);
+uint64_t unagi_window_get_wasted_pixels(void);
+void unagi_window_account_damage_notify(unagi_window_t *);
+uint64_t unagi_window_get_damage_level_stats(const xcb_damage_report_level_t,
+                                             uint32_t *);
 
 #define UNAGI_DO_GEOMETRY_WITH_BORDER(kind)                             \
   static inline uint16_t						\
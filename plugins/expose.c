@@ -54,7 +54,7 @@
  *
  *   4/ For  each window, create  a new 'unagi_window_t'  object, thus
  *      creating  a new  list of  windows which  will override  global
- *      Windows list  and itree  while the Expose  is running.  If the
+ *      Windows list and hash table while the Expose is running.  If the
  *      window needs  to be rescaled  (e.g.  when the window  does not
  *      fit the slot), then it is done through Render.
  */
@@ -78,6 +78,7 @@
 #include "key.h"
 #include "event.h"
 #include "dbus.h"
+#include "paint.h"
 
 #define _PLUGIN_NAME "expose"
 #define _PLUGIN_CONFIG_FILENAME "plugin_" _PLUGIN_NAME ".conf"
@@ -157,7 +158,7 @@ static struct
   /** Global windows list context before Expose overrides it while running */
   unagi_window_t *windows_head_before_enter;
   unagi_window_t *windows_tail_before_enter;
-  unagi_util_itree_t *windows_itree_before_enter;
+  unagi_util_itable_t *windows_itable_before_enter;
   /** Mouse pointer position */
   struct {
     int16_t x;
@@ -680,7 +681,7 @@ _expose_prepare_windows(_expose_crtc_window_slots_t *crtc_slots,
 	  unagi_debug("No need to scale %jx", (uintmax_t) slot->window->id);
 
           scale_window = malloc(sizeof(unagi_window_t));
-          memcpy(scale_window, slot->window, sizeof(unagi_window_t));
+          unagi_window_copy(scale_window, slot->window);
 
           scale_window->geometry = malloc(sizeof(xcb_get_geometry_reply_t));
           memcpy(scale_window->geometry, slot->window->geometry,
@@ -749,9 +750,10 @@ _expose_prepare_windows(_expose_crtc_window_slots_t *crtc_slots,
       if(*scale_window_prev)
 	(*scale_window_prev)->next = scale_window;
 
-      globalconf.windows_itree = util_itree_insert(globalconf.windows_itree,
-                                                   scale_window->id,
-                                                   scale_window);
+      if(!util_itable_insert(globalconf.windows_itable, scale_window->id,
+                             scale_window))
+        unagi_fatal("Cannot allocate memory for scaled window %jx",
+                    (uintmax_t) scale_window->id);
 
       *scale_window_prev = scale_window;
       slot->scale_window.window = scale_window;
@@ -777,12 +779,15 @@ _expose_prepare_windows(_expose_crtc_window_slots_t *crtc_slots,
 static void
 _expose_free_memory(void)
 {
-  unagi_util_itree_free(globalconf.windows_itree);
-  globalconf.windows_itree = _expose_global.windows_itree_before_enter;
+  unagi_util_itable_free(globalconf.windows_itable);
+  globalconf.windows_itable = _expose_global.windows_itable_before_enter;
 
   globalconf.windows = _expose_global.windows_head_before_enter;
   globalconf.windows_tail = _expose_global.windows_tail_before_enter;
 
+  /* Before freeing the scaled windows which are in the stacking array */
+  unagi_window_stack_rebuild();
+
   _expose_global.windows_head_before_enter = NULL;
   _expose_global.windows_tail_before_enter = NULL;
 
@@ -836,6 +841,7 @@ _expose_quit(void)
 
   /* Force repaint of the screen as the plugin is now disabled */
   globalconf.force_repaint = true;
+  unagi_paint_schedule();
 
   unagi_debug("=> Quit");
 }
@@ -1017,11 +1023,22 @@ _expose_enter(void)
   xcb_aux_sync(globalconf.connection);
   unagi_event_handle_poll_loop(unagi_event_handle);
 
+  /* The windows mapped above are only acquired when painted, but their
+     Pixmap is needed right now to create the thumbnails */
+  for(unsigned int crtc_n = 0; crtc_n < globalconf.crtc_len; crtc_n++)
+    {
+      _expose_crtc_window_slots_t *crtc_slots = _expose_global.crtc_slots + crtc_n;
+      for(uint32_t window_n = 0; window_n < crtc_slots->nwindows; window_n++)
+        unagi_window_acquire(crtc_slots->slots[window_n].window);
+    }
+
   xcb_ungrab_server(globalconf.connection);
   xcb_flush(globalconf.connection);
 
-  _expose_global.windows_itree_before_enter = globalconf.windows_itree;
-  globalconf.windows_itree = util_itree_new();
+  _expose_global.windows_itable_before_enter = globalconf.windows_itable;
+  globalconf.windows_itable = util_itable_new();
+  if(!globalconf.windows_itable)
+    unagi_fatal("Cannot allocate memory for windows hash table");
 
   unagi_window_t *prev_window = NULL;
   for(unsigned int i = 0; i < globalconf.crtc_len; i++)
@@ -1035,8 +1052,10 @@ _expose_enter(void)
 
   _expose_global.windows_tail_before_enter = globalconf.windows_tail;
   globalconf.windows_tail = prev_window;
+  unagi_window_stack_rebuild();
 
   globalconf.force_repaint = true;
+  unagi_paint_schedule();
   plugin_vtable.activated = true;
   unagi_debug("=> Entered");
   return true;
@@ -1160,7 +1179,10 @@ expose_event_handle_damage_notify(xcb_damage_notify_event_t *event,
      handler will consider it as never painted and it will be
      repainted it completely */
   if(window->damaged_ratio != 1.0)
-    window->damaged = false;
+    {
+      window->damaged = false;
+      unagi_window_stack_update(window);
+    }
 }
 
 /** Handle KeyRelease event
@@ -1364,6 +1386,7 @@ expose_pre_paint(void)
              {
               window->damaged = true;
               window->damaged_ratio = 1.0;
+              unagi_window_stack_update(window);
               unagi_display_add_damaged_region(&window->region, false);
             }
 
@@ -1391,6 +1414,7 @@ expose_post_paint(void)
     {
       window->damaged = false;
       window->damaged_ratio = 0.0;
+      unagi_window_stack_update(window);
     }
 
   unagi_debug("Painting finished");
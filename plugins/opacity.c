@@ -89,6 +89,8 @@ _opacity_get_property(xcb_window_t window_id)
 static uint32_t
 _opacity_get_property_reply(xcb_get_property_cookie_t cookie)
 {
+  unagi_display_round_trip(cookie.sequence);
+
   xcb_get_property_reply_t *reply =
     xcb_get_property_reply(globalconf.connection, cookie, NULL);
 
@@ -283,7 +285,7 @@ opacity_event_handle_property_notify(xcb_property_notify_event_t *event,
     }
       
   /* Force redraw of the window as the opacity has changed */
-  unagi_display_add_damaged_region(&window->region, false);
+  unagi_display_add_damaged_window(window, false);
 }
 
 /** Handle  for  UnmapNotify,  only  responsible to  free  the  memory
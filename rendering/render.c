@@ -31,6 +31,7 @@
 #include "window.h"
 #include "structs.h"
 #include "plugin.h"
+#include "display.h"
 #include "util.h"
 
 #define _DOUBLE_TO_FIXED(f) ((xcb_render_fixed_t) ((f) * 65536))
@@ -58,7 +59,8 @@ typedef struct
 {
   /** Extension information */
   const xcb_query_extension_reply_t *ext;
-  /** Picture associated with the root window */
+  /** Picture associated with the overlay window (or the root window if
+      there is no overlay window) */
   xcb_render_picture_t picture;
   /** Buffer Picture used to paint the windows before the root Picture */
   xcb_render_picture_t buffer_picture;
@@ -81,6 +83,20 @@ typedef struct
 
 static _render_unagi_conf_t _render_conf;
 
+/** Scratch regions used to split the painting of ARGB windows between
+    their opaque part and the rest, kept across repaints */
+static struct
+{
+  /** Opaque part of the window (_NET_WM_OPAQUE_REGION) */
+  unagi_region_t opaque;
+  /** Whole area of the window to be painted */
+  unagi_region_t painted;
+  /** Part painted with PictOpSrc */
+  unagi_region_t src;
+  /** Part painted with PictOpOver */
+  unagi_region_t over;
+} _render_opaque_split;
+
 /** Information related to Render specific to windows */
 typedef struct
 {
@@ -88,6 +104,8 @@ typedef struct
   xcb_render_picture_t picture;
   /** ARGB Window */
   bool is_argb;
+  /** Whether the Picture has been clipped to the window shape */
+  bool is_shape_clipped;
   /** Pointer to global alpha picture */
   _render_alpha_picture_t *alpha_picture;
 } _render_unagi_window_t;
@@ -152,6 +170,10 @@ static const char *_render_error_label[] = {
 static xcb_render_query_version_cookie_t _render_version_cookie = { 0 };
 static xcb_render_query_pict_formats_cookie_t _render_pict_formats_cookie = { 0 };
 
+/** CreatePicture  request of  the background  Picture whose  error is
+    only checked before painting the background */
+static xcb_void_cookie_t _render_background_picture_cookie = { 0 };
+
 /** Called on dlopen() and only prefetch the Render extension data */
 static void __attribute__((constructor))
 render_preinit(void)
@@ -251,43 +273,14 @@ _render_init_root_background(void)
 {
   /* Get the background image pixmap, if any, otherwise do nothing */
   xcb_pixmap_t root_background_pixmap = unagi_window_get_root_background_pixmap_finalise();
-  bool root_background_fill = false;
-
-  if(!root_background_pixmap)
-    {
-      unagi_debug("No background pixmap set, set default background color");
-      root_background_pixmap = unagi_window_new_root_background_pixmap();
-      root_background_fill = true;
-    }
 
   _render_conf.background_picture = xcb_generate_id(globalconf.connection);
   const uint32_t root_buffer_val = true;
 
-  /* Create  a new  picture holding  the background  pixmap through  a
-     'checked' request as  it may fail (for example  when 'display' is
-     used  to set  the background)  and  during startup,  it would  be
-     unagi_fatal */
-  xcb_void_cookie_t picture_cookie =
-    xcb_render_create_picture_checked(globalconf.connection,
-                                      _render_conf.background_picture,
-                                      root_background_pixmap,
-                                      _render_conf.pictvisual->format,
-                                      XCB_RENDER_CP_REPEAT, &root_buffer_val);
-
-  /* Check synchronously if the Picture  could be created, if not just
-     set a default background color */
-  xcb_generic_error_t *picture_error = xcb_request_check(globalconf.connection,
-                                                         picture_cookie);
-
-  if(picture_error)
+  if(!root_background_pixmap)
     {
-      unagi_warn("Could not create background Picture, setting a default background "
-                 "color (try using another program to set the background?)");
-
-      free(picture_error);
-
+      unagi_debug("No background pixmap set, set default background color");
       root_background_pixmap = unagi_window_new_root_background_pixmap();
-      root_background_fill = true;
 
       /* Do not perform any check as it should always succeed */
       xcb_render_create_picture(globalconf.connection,
@@ -295,13 +288,61 @@ _render_init_root_background(void)
                                 root_background_pixmap,
                                 _render_conf.pictvisual->format,
                                 XCB_RENDER_CP_REPEAT, &root_buffer_val);
-    }
 
-  if(root_background_fill)
-    {
       xcb_free_pixmap(globalconf.connection, root_background_pixmap);
       _render_root_background_fill();
     }
+  /* Create  a new  picture holding  the background  pixmap through  a
+     'checked' request as  it may fail (for example  when 'display' is
+     used  to set  the background)  and  during startup,  it would  be
+     unagi_fatal.  The error is only checked before painting, by then
+     replies of later requests have been read, so no round-trip */
+  else
+    _render_background_picture_cookie =
+      xcb_render_create_picture_checked(globalconf.connection,
+                                        _render_conf.background_picture,
+                                        root_background_pixmap,
+                                        _render_conf.pictvisual->format,
+                                        XCB_RENDER_CP_REPEAT, &root_buffer_val);
+}
+
+/** Check  whether the  background Picture  could be  created,  if not
+ *  just set a default background color
+ *
+ * \see _render_init_root_background
+ */
+static void
+_render_init_root_background_finalise(void)
+{
+  if(!_render_background_picture_cookie.sequence)
+    return;
+
+  unagi_display_round_trip(_render_background_picture_cookie.sequence);
+
+  xcb_generic_error_t *picture_error =
+    xcb_request_check(globalconf.connection, _render_background_picture_cookie);
+
+  _render_background_picture_cookie.sequence = 0;
+  if(!picture_error)
+    return;
+
+  unagi_warn("Could not create background Picture, setting a default background "
+             "color (try using another program to set the background?)");
+
+  free(picture_error);
+
+  xcb_pixmap_t root_background_pixmap = unagi_window_new_root_background_pixmap();
+  const uint32_t root_buffer_val = true;
+
+  /* Do not perform any check as it should always succeed */
+  xcb_render_create_picture(globalconf.connection,
+                            _render_conf.background_picture,
+                            root_background_pixmap,
+                            _render_conf.pictvisual->format,
+                            XCB_RENDER_CP_REPEAT, &root_buffer_val);
+
+  xcb_free_pixmap(globalconf.connection, root_background_pixmap);
+  _render_root_background_fill();
 }
 
 /** Create the  Picture associated  with the root  Window and  get its
@@ -314,6 +355,7 @@ _render_init_root_picture(void)
      before get the screen visuals... */
 
   assert(_render_pict_formats_cookie.sequence);
+  unagi_display_round_trip(_render_pict_formats_cookie.sequence);
 
   /* The  "PictFormat" object  holds information  needed  to translate
      pixel values into red, green, blue and alpha channels */
@@ -345,14 +387,16 @@ _render_init_root_picture(void)
     xcb_render_util_find_standard_format(_render_conf.pict_formats,
                                          XCB_PICT_STANDARD_ARGB_32)->id;
 
-  /* Create Picture associated with the root window */
+  /* Create Picture associated with the overlay window, or the root
+     window if the overlay window is not available */
   {
     _render_conf.picture = xcb_generate_id(globalconf.connection);
     const uint32_t root_picture_val = XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS;
 
     xcb_render_create_picture(globalconf.connection,
 			      _render_conf.picture,
-			      globalconf.screen->root,
+			      globalconf.overlay_window != XCB_NONE ?
+                              globalconf.overlay_window : globalconf.screen->root,
 			      _render_conf.pictvisual->format,
 			      XCB_RENDER_CP_SUBWINDOW_MODE,
 			      &root_picture_val);
@@ -389,6 +433,7 @@ static bool
 render_init_finalise(void)
 {
   assert(_render_version_cookie.sequence);
+  unagi_display_round_trip(_render_version_cookie.sequence);
 
   xcb_render_query_version_reply_t *render_version_reply =
     xcb_render_query_version_reply(globalconf.connection,
@@ -415,6 +460,9 @@ render_init_finalise(void)
 static void
 render_reset_background(void)
 {
+  /* Make sure the Picture exists before freeing it */
+  _render_init_root_background_finalise();
+
   xcb_render_free_picture(globalconf.connection,
 			  _render_conf.background_picture);
 
@@ -568,6 +616,8 @@ _render_get_window_alpha_picture(_render_unagi_window_t *render_window,
 static void
 render_paint_background(void)
 {
+  _render_init_root_background_finalise();
+
   xcb_xfixes_set_picture_clip_region(globalconf.connection,
                                      _render_conf.buffer_picture,
                                      globalconf.damaged, 0, 0);
@@ -575,12 +625,77 @@ render_paint_background(void)
   _render_paint_root_background_to_buffer();
 }
 
-/** Paint the window to the buffer Picture
+/** Composite the window Picture to the given Picture
  *
  * \param window The window to be painted
+ * \param op The Render operator
+ * \param window_picture The window Picture
+ * \param alpha_picture The alpha Picture (mask), if any
+ * \param destination_picture The Picture to paint the window to
+ * \param region If not NULL, only paint the window within this region
  */
 static void
-render_paint_window(unagi_window_t *window)
+_render_composite_window(unagi_window_t *window, const uint8_t op,
+                         const xcb_render_picture_t window_picture,
+                         const xcb_render_picture_t alpha_picture,
+                         const xcb_render_picture_t destination_picture,
+                         const unagi_region_t *region)
+{
+  /* While the window is being resized, the Pixmap of its previous size
+     is painted clipped to the new size */
+  uint16_t width, height;
+  unagi_window_get_pixmap_size(window, &width, &height);
+
+  if(!region)
+    {
+      xcb_render_composite(globalconf.connection,
+                           op,
+                           window_picture,
+                           alpha_picture,
+                           destination_picture,
+                           0, 0, 0, 0,
+                           window->geometry->x,
+                           window->geometry->y,
+                           width, height);
+
+      return;
+    }
+
+  const int32_t x2 = window->geometry->x + width;
+  const int32_t y2 = window->geometry->y + height;
+
+  /* Only paint the  visible part of the window, one  Composite request
+     per box */
+  for(uint32_t i = 0; i < region->boxes_len; i++)
+    {
+      const unagi_region_box_t *box = region->boxes + i;
+      if(box->x1 >= x2 || box->y1 >= y2)
+        continue;
+
+      const int16_t src_x = (int16_t) (box->x1 - window->geometry->x);
+      const int16_t src_y = (int16_t) (box->y1 - window->geometry->y);
+
+      xcb_render_composite(globalconf.connection,
+                           op,
+                           window_picture,
+                           alpha_picture,
+                           destination_picture,
+                           src_x, src_y, src_x, src_y,
+                           (int16_t) box->x1, (int16_t) box->y1,
+                           (uint16_t) (min(box->x2, x2) - box->x1),
+                           (uint16_t) (min(box->y2, y2) - box->y1));
+    }
+}
+
+/** Paint the window to the given Picture
+ *
+ * \param window The window to be painted
+ * \param region If not NULL, only paint the window within this region
+ * \param destination_picture The Picture to paint the window to
+ */
+static void
+_render_paint_window(unagi_window_t *window, const unagi_region_t *region,
+                     const xcb_render_picture_t destination_picture)
 {
   /* If  there is  no window  Pixmap, do  nothing.  This  might happen
      because  the window  is  not visible  yet  (CreateNotify, then  a
@@ -628,11 +743,10 @@ render_paint_window(unagi_window_t *window)
       /* For  non-rectangular  Windows, clip  the  Window  Picture to  its
          shaped Region to paint  them properly (otherwise for applications
          such  as  xeyes,  garbage  pixels are  shown  as  RenderComposite
-         expects a rectangular area)
-
-         \todo: Should ShapeNotify be handled as well?
-      */
-      if(!unagi_window_is_rectangular(window))
+         expects a rectangular area).  The clip is kept by the Picture,
+         which is freed upon ShapeNotify or when the Pixmap changes */
+      if(!render_window->is_shape_clipped &&
+         !unagi_window_is_rectangular(window))
         {
           xcb_xfixes_region_t shape_region = unagi_window_get_region(window, false, false);
 
@@ -643,6 +757,7 @@ render_paint_window(unagi_window_t *window)
                                              (int16_t) window->geometry->border_width);
 
           xcb_xfixes_destroy_region(globalconf.connection, shape_region);
+          render_window->is_shape_clipped = true;
         }
 
       break;
@@ -695,16 +810,97 @@ render_paint_window(unagi_window_t *window)
         break;
       }
 
-  xcb_render_composite(globalconf.connection,
-		       render_composite_op,
-		       render_window->picture,
-                       alpha_picture,
-                       _render_conf.buffer_picture,
-		       0, 0, 0, 0,
-		       window->geometry->x,
-		       window->geometry->y,
-		       window_width_with_border(window->geometry),
-		       window_height_with_border(window->geometry));
+  /* Most ARGB windows are opaque except a few pixels on their edges
+     (_NET_WM_OPAQUE_REGION): only blend the latter and copy the
+     opaque part with PictOpSrc, which is cheaper */
+  if(render_window->is_argb && alpha_picture == XCB_NONE &&
+     window->transform_status == UNAGI_WINDOW_TRANSFORM_STATUS_NONE &&
+     unagi_window_get_opaque_region(window, &_render_opaque_split.opaque))
+    {
+      if(!region)
+        {
+          const unagi_region_box_t window_box = {
+            window->geometry->x, window->geometry->y,
+            window->geometry->x + window_width_with_border(window->geometry),
+            window->geometry->y + window_height_with_border(window->geometry)
+          };
+
+          unagi_region_reset_box(&_render_opaque_split.painted, &window_box);
+          region = &_render_opaque_split.painted;
+        }
+
+      if(unagi_region_intersect(&_render_opaque_split.src, region,
+                                &_render_opaque_split.opaque) &&
+         unagi_region_subtract(&_render_opaque_split.over, region,
+                               &_render_opaque_split.opaque))
+        {
+          _render_composite_window(window, XCB_RENDER_PICT_OP_SRC,
+                                   render_window->picture, XCB_NONE,
+                                   destination_picture,
+                                   &_render_opaque_split.src);
+
+          _render_composite_window(window, XCB_RENDER_PICT_OP_OVER,
+                                   render_window->picture, XCB_NONE,
+                                   destination_picture,
+                                   &_render_opaque_split.over);
+
+          return;
+        }
+    }
+
+  _render_composite_window(window, render_composite_op, render_window->picture,
+                           alpha_picture, destination_picture, region);
+}
+
+/** Paint the window to the buffer Picture
+ *
+ * \param window The window to be painted
+ * \param region If not NULL, only paint the window within this region
+ */
+static void
+render_paint_window(unagi_window_t *window, const unagi_region_t *region)
+{
+  _render_paint_window(window, region, _render_conf.buffer_picture);
+}
+
+/** Paint the  window directly to the root  Picture within the damaged
+ *  Region, without going through the buffer Picture. This is only
+ *  done when the damaged Region is entirely covered by this window
+ *  which is opaque, thus there is no flickering
+ *
+ * \param window The window to be painted
+ */
+static void
+render_paint_window_direct(unagi_window_t *window)
+{
+  xcb_xfixes_set_picture_clip_region(globalconf.connection,
+                                     _render_conf.picture,
+                                     globalconf.damaged, 0, 0);
+
+  _render_paint_window(window, NULL, _render_conf.picture);
+}
+
+/** Check whether the given window has an alpha channel, without
+ *  having to create its Picture
+ *
+ * \param window The window object
+ * \return true if the window visual is ARGB
+ */
+static bool
+render_is_window_argb(unagi_window_t *window)
+{
+  const _render_unagi_window_t *render_window =
+    (const _render_unagi_window_t *) window->rendering;
+
+  if(render_window && render_window->picture != XCB_NONE)
+    return render_window->is_argb;
+
+  xcb_render_pictvisual_t *window_pictvisual =
+    xcb_render_util_find_visual_format(_render_conf.pict_formats,
+                                       window->attributes->visual);
+
+  return (window_pictvisual &&
+          window_pictvisual->format == _render_conf.argb_pictformat_id);
 }
 
 /** Routine to  paint everything on  the root Picture, it  just paints
@@ -779,6 +975,7 @@ render_free_window_pixmap(unagi_window_t *window)
     {
       xcb_render_free_picture(globalconf.connection, render_window->picture);
       render_window->picture = XCB_NONE;
+      render_window->is_shape_clipped = false;
     }
 }
 
@@ -807,6 +1004,11 @@ render_free(void)
   xcb_render_free_picture(globalconf.connection, _render_conf.background_picture);
   xcb_render_free_picture(globalconf.connection, _render_conf.picture);
   xcb_render_free_picture(globalconf.connection, _render_conf.buffer_picture);
+
+  unagi_region_free(&_render_opaque_split.opaque);
+  unagi_region_free(&_render_opaque_split.painted);
+  unagi_region_free(&_render_opaque_split.src);
+  unagi_region_free(&_render_opaque_split.over);
 }
 
 /** Structure holding all the functions addresses */
@@ -816,6 +1018,8 @@ unagi_rendering_t rendering_functions = {
   render_reset_background,
   render_paint_background,
   render_paint_window,
+  render_paint_window_direct,
+  render_is_window_argb,
   render_paint_all,
   render_is_request,
   render_error_get_request_label,
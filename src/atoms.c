@@ -34,13 +34,17 @@
 #include <xcb/xcb_ewmh.h>
 
 #include "atoms.h"
+#include "display.h"
 #include "util.h"
 #include "structs.h"
 
 /** Atoms used but not defined in either ICCCM and EWMH */
 xcb_atom_t UNAGI__NET_WM_WINDOW_OPACITY;
+xcb_atom_t UNAGI__NET_WM_BYPASS_COMPOSITOR;
+xcb_atom_t UNAGI__NET_WM_OPAQUE_REGION;
 xcb_atom_t UNAGI__XROOTPMAP_ID;
 xcb_atom_t UNAGI__XSETROOT_ID;
+xcb_atom_t UNAGI_WM_STATE;
 
 /** Structure defined on purpose to be able to send all the InternAtom
     requests */
@@ -59,8 +63,11 @@ typedef struct {
     xcb-util/ewmh library) */
 static atom_t atoms_list[] = {
   { &UNAGI__NET_WM_WINDOW_OPACITY, { 0 }, sizeof("_NET_WM_WINDOW_OPACITY") - 1, "_NET_WM_WINDOW_OPACITY" },
+  { &UNAGI__NET_WM_BYPASS_COMPOSITOR, { 0 }, sizeof("_NET_WM_BYPASS_COMPOSITOR") - 1, "_NET_WM_BYPASS_COMPOSITOR" },
+  { &UNAGI__NET_WM_OPAQUE_REGION, { 0 }, sizeof("_NET_WM_OPAQUE_REGION") - 1, "_NET_WM_OPAQUE_REGION" },
   { &UNAGI__XROOTPMAP_ID, { 0 }, sizeof("_XROOTPMAP_ID") - 1, "_XROOTPMAP_ID" },
-  { &UNAGI__XSETROOT_ID, { 0 }, sizeof("_XSETROOT_ID") - 1, "_XSETROOT_ID" }
+  { &UNAGI__XSETROOT_ID, { 0 }, sizeof("_XSETROOT_ID") - 1, "_XSETROOT_ID" },
+  { &UNAGI_WM_STATE, { 0 }, sizeof("WM_STATE") - 1, "WM_STATE" }
 };
 
 static const ssize_t atoms_list_len = unagi_countof(atoms_list);
@@ -101,6 +108,8 @@ unagi_atoms_init(void)
 bool
 unagi_atoms_init_finalise(xcb_intern_atom_cookie_t *ewmh_cookies)
 {
+  unagi_display_round_trip(ewmh_cookies[0].sequence);
+
   if(!xcb_ewmh_init_atoms_replies(&globalconf.ewmh, ewmh_cookies, NULL))
     goto init_atoms_error;
 
@@ -189,6 +198,8 @@ unagi_atoms_is_supported(const xcb_atom_t atom)
           xcb_ewmh_get_atoms_reply_wipe(&globalconf.atoms_supported.value);
         }
 
+      unagi_display_round_trip(globalconf.atoms_supported.cookie.sequence);
+
       if(!xcb_ewmh_get_supported_reply(&globalconf.ewmh,
 				       globalconf.atoms_supported.cookie,
 				       &globalconf.atoms_supported.value,
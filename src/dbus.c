@@ -30,6 +30,8 @@
 
 #include "structs.h"
 #include "dbus.h"
+#include "event.h"
+#include "paint.h"
 
 #define _INTERFACE_ADD_MATCH_FMT "type='method_call',interface='%s'"
 
@@ -85,12 +87,233 @@ unagi_dbus_request_name(const char *name)
   return true;
 }
 
+/** Send a reply built for the given Message and release it
+ *
+ * \param msg Message being replied to
+ * \param reply Reply to be sent
+ */
+static void
+_dbus_send_built_reply(DBusMessage *msg, DBusMessage *reply)
+{
+  if(!dbus_connection_send(globalconf.dbus_connection, reply, NULL))
+    unagi_warn("Failed to send message reply (interface=%s, member=%s)",
+               dbus_message_get_interface(msg),
+               dbus_message_get_member(msg));
+
+  dbus_message_unref(reply);
+}
+
+/** Reply to  'throttled_windows' Message  with the  list of windows
+ *  whose damages are throttled, as an array of (window, measured rate,
+ *  maximum rate) structures
+ *
+ * \param msg Message to be replied to
+ * \return false if the reply could not be built
+ */
+static bool
+_dbus_send_throttled_windows_reply(DBusMessage *msg)
+{
+  if(dbus_message_get_no_reply(msg))
+    return true;
+
+  DBusMessage *reply = dbus_message_new_method_return(msg);
+  if(!reply)
+    return false;
+
+  DBusMessageIter iter, array_iter;
+  dbus_message_iter_init_append(reply, &iter);
+  if(!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+                                       DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+                                       DBUS_TYPE_UINT32_AS_STRING
+                                       DBUS_TYPE_DOUBLE_AS_STRING
+                                       DBUS_TYPE_DOUBLE_AS_STRING
+                                       DBUS_STRUCT_END_CHAR_AS_STRING,
+                                       &array_iter))
+    goto reply_failed;
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    {
+      if(!window->damage_rate.is_throttled)
+        continue;
+
+      DBusMessageIter struct_iter;
+      const uint32_t id = window->id;
+      const double rate = window->damage_rate.rate;
+      const double max = window->damage_rate.max;
+
+      if(!dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+                                           NULL, &struct_iter) ||
+         !dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &id) ||
+         !dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_DOUBLE, &rate) ||
+         !dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_DOUBLE, &max) ||
+         !dbus_message_iter_close_container(&array_iter, &struct_iter))
+        goto reply_failed;
+    }
+
+  if(!dbus_message_iter_close_container(&iter, &array_iter))
+    goto reply_failed;
+
+  _dbus_send_built_reply(msg, reply);
+  return true;
+
+ reply_failed:
+  dbus_message_unref(reply);
+  return false;
+}
+
+/** Reply to 'damage_report_levels' Message with, for each Damage report
+ *  level, the number of windows using it and the number of DamageNotify
+ *  events received with it, as an array of (level, windows, events)
+ *  structures
+ *
+ * \param msg Message to be replied to
+ * \return false if the reply could not be built
+ */
+static bool
+_dbus_send_damage_report_levels_reply(DBusMessage *msg)
+{
+  static const char *levels_label[] = {
+    "RawRectangles",
+    "DeltaRectangles",
+    "BoundingBox",
+    "NonEmpty"
+  };
+
+  if(dbus_message_get_no_reply(msg))
+    return true;
+
+  DBusMessage *reply = dbus_message_new_method_return(msg);
+  if(!reply)
+    return false;
+
+  DBusMessageIter iter, array_iter;
+  dbus_message_iter_init_append(reply, &iter);
+  if(!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+                                       DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+                                       DBUS_TYPE_STRING_AS_STRING
+                                       DBUS_TYPE_UINT32_AS_STRING
+                                       DBUS_TYPE_UINT64_AS_STRING
+                                       DBUS_STRUCT_END_CHAR_AS_STRING,
+                                       &array_iter))
+    goto reply_failed;
+
+  for(int level = 0; level < unagi_countof(levels_label); level++)
+    {
+      DBusMessageIter struct_iter;
+      uint32_t windows_len;
+      const uint64_t events =
+        unagi_window_get_damage_level_stats((xcb_damage_report_level_t) level,
+                                            &windows_len);
+
+      if(!dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT,
+                                           NULL, &struct_iter) ||
+         !dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING,
+                                         &levels_label[level]) ||
+         !dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32,
+                                         &windows_len) ||
+         !dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+                                         &events) ||
+         !dbus_message_iter_close_container(&array_iter, &struct_iter))
+        goto reply_failed;
+    }
+
+  if(!dbus_message_iter_close_container(&iter, &array_iter))
+    goto reply_failed;
+
+  _dbus_send_built_reply(msg, reply);
+  return true;
+
+ reply_failed:
+  dbus_message_unref(reply);
+  return false;
+}
+
+/** Reply to 'statistics' Message with the figures otherwise only shown
+ *  in debug mode, as a dictionary of statistic names and values:
+ *
+ *  - damage_notify_discarded: DamageNotify events discarded per second
+ *    as the window was already fully damaged;
+ *  - configure_notify_coalesced: ConfigureNotify events merged with a
+ *    previous one per second;
+ *  - windows_unmapped_before_paint: windows unmapped per second before
+ *    being painted;
+ *  - wasted_pixels: pixels needlessly repainted so far because whole
+ *    windows were repainted;
+ *  - map_latency: seconds taken to show the last mapped windows, e.g.
+ *    when switching workspaces.
+ *
+ *  Rates are computed over the last period (one second at least).
+ *
+ * \param msg Message to be replied to
+ * \return false if the reply could not be built
+ */
+static bool
+_dbus_send_statistics_reply(DBusMessage *msg)
+{
+  if(dbus_message_get_no_reply(msg))
+    return true;
+
+  DBusMessage *reply = dbus_message_new_method_return(msg);
+  if(!reply)
+    return false;
+
+  const unagi_event_stats_t *event_stats = unagi_event_get_stats();
+
+  struct
+  {
+    const char *name;
+    double value;
+  } stats[] = {
+    { "damage_notify_discarded", event_stats->damage_notify_discarded },
+    { "configure_notify_coalesced", event_stats->configure_notify_coalesced },
+    { "windows_unmapped_before_paint",
+      event_stats->windows_unmapped_before_paint },
+    { "wasted_pixels", (double) unagi_window_get_wasted_pixels() },
+    { "map_latency", unagi_paint_get_map_latency() }
+  };
+
+  DBusMessageIter iter, array_iter;
+  dbus_message_iter_init_append(reply, &iter);
+  if(!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+                                       DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+                                       DBUS_TYPE_STRING_AS_STRING
+                                       DBUS_TYPE_DOUBLE_AS_STRING
+                                       DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+                                       &array_iter))
+    goto reply_failed;
+
+  for(int i = 0; i < unagi_countof(stats); i++)
+    {
+      DBusMessageIter entry_iter;
+
+      if(!dbus_message_iter_open_container(&array_iter, DBUS_TYPE_DICT_ENTRY,
+                                           NULL, &entry_iter) ||
+         !dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING,
+                                         &stats[i].name) ||
+         !dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_DOUBLE,
+                                         &stats[i].value) ||
+         !dbus_message_iter_close_container(&array_iter, &entry_iter))
+        goto reply_failed;
+    }
+
+  if(!dbus_message_iter_close_container(&iter, &array_iter))
+    goto reply_failed;
+
+  _dbus_send_built_reply(msg, reply);
+  return true;
+
+ reply_failed:
+  dbus_message_unref(reply);
+  return false;
+}
+
 /** libev callback to process queued D-Bus Messages, processed here
  *  for core Interface Messages (org.minidweeb.unagi) or dispatched
  *  to plugins Interface (org.minidweeb.unagi.plugin.NAME).
  *
- *  Currently, only 'exit' Message is implemented for the core, but it
- *  may be extended in the future.
+ *  Currently, only 'exit', 'throttled_windows', 'damage_report_levels'
+ *  and 'statistics' Messages are implemented for the core, but it may
+ *  be extended in the future.
  *
  * \todo Handle Introspectable and Disconnected Messages
  * \todo Implement restart of Unagi through D-Bus?
@@ -107,6 +330,7 @@ _dbus_process_messages(EV_P_ ev_io *w __attribute__((unused)),
   while((msg = dbus_connection_pop_message(globalconf.dbus_connection)))
     {
       bool msg_processed = false;
+      bool reply_sent = false;
       const int msg_type = dbus_message_get_type(msg);
       const char *msg_interface = dbus_message_get_interface(msg);
       const char *msg_member = dbus_message_get_member(msg);
@@ -123,6 +347,30 @@ _dbus_process_messages(EV_P_ ev_io *w __attribute__((unused)),
               do_exit = true;
               msg_processed = true;
             }
+          else if(msg_type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+                  strcmp(msg_member, "throttled_windows") == 0)
+            {
+              if(!(reply_sent = _dbus_send_throttled_windows_reply(msg)))
+                error_name = DBUS_ERROR_NO_MEMORY;
+
+              msg_processed = true;
+            }
+          else if(msg_type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+                  strcmp(msg_member, "damage_report_levels") == 0)
+            {
+              if(!(reply_sent = _dbus_send_damage_report_levels_reply(msg)))
+                error_name = DBUS_ERROR_NO_MEMORY;
+
+              msg_processed = true;
+            }
+          else if(msg_type == DBUS_MESSAGE_TYPE_METHOD_CALL &&
+                  strcmp(msg_member, "statistics") == 0)
+            {
+              if(!(reply_sent = _dbus_send_statistics_reply(msg)))
+                error_name = DBUS_ERROR_NO_MEMORY;
+
+              msg_processed = true;
+            }
         }
       else if(msg_interface != NULL &&
               strcmp(msg_interface, UNAGI_DBUS_NAME_PLUGIN_PREFIX) > 0)
@@ -161,9 +409,10 @@ _dbus_process_messages(EV_P_ ev_io *w __attribute__((unused)),
           error_name = DBUS_ERROR_UNKNOWN_METHOD;
         }
 
-      unagi_dbus_send_reply_from_processed_message(msg,
-                                                   error_name == NULL,
-                                                   error_name);
+      if(!reply_sent)
+        unagi_dbus_send_reply_from_processed_message(msg,
+                                                     error_name == NULL,
+                                                     error_name);
       dbus_message_unref(msg);
       msg_sent_counter++;
     }
@@ -280,12 +529,7 @@ unagi_dbus_send_reply_from_processed_message(DBusMessage *msg,
       reply = dbus_message_new_error(msg, error_name, error_message);
     }
 
-  if(!dbus_connection_send(globalconf.dbus_connection, reply, NULL))
-    unagi_warn("Failed to send message reply (interface=%s, member=%s)",
-               dbus_message_get_interface(msg),
-               dbus_message_get_member(msg));
-
-  dbus_message_unref(reply);
+  _dbus_send_built_reply(msg, reply);
 }
 
 /** Release previously requested D-Bus Bus and Interface names
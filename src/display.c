@@ -41,6 +41,10 @@
 #include <xcb/xfixes.h>
 #include <xcb/damage.h>
 #include <xcb/randr.h>
+#ifdef HAVE_XCB_PRESENT
+# include <xcb/present.h>
+#endif
+#include <xcb/shape.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_aux.h>
 
@@ -49,6 +53,8 @@
 #include "atoms.h"
 #include "window.h"
 #include "util.h"
+#include "paint.h"
+#include "region.h"
 
 /** Structure   holding   cookies   for   QueryVersion   requests   of
     extensions */
@@ -59,8 +65,16 @@ typedef struct {
   xcb_damage_query_version_cookie_t damage;
   /** Composite QueryVersion request cookie */
   xcb_composite_query_version_cookie_t composite;
+  /** Composite GetOverlayWindow request cookie */
+  xcb_composite_get_overlay_window_cookie_t composite_overlay;
   /** RandR QueryVersion request cookie */
   xcb_randr_query_version_cookie_t randr;
+#ifdef HAVE_XCB_PRESENT
+  /** Present QueryVersion request cookie */
+  xcb_present_query_version_cookie_t present;
+#endif
+  /** Shape QueryVersion request cookie */
+  xcb_shape_query_version_cookie_t shape;
 }  init_extensions_cookies_t;
 
 /** NOTICE:  All above  variables are  not thread-safe,  but  well, we
@@ -69,7 +83,7 @@ typedef struct {
 /** Initialise the  QueryVersion extensions cookies with  a 0 sequence
     number, this  is not thread-safe but  we don't care here  as it is
     only used during initialisation */
-static init_extensions_cookies_t _init_extensions_cookies = {{0}, {0}, {0}, {0}};
+static init_extensions_cookies_t _init_extensions_cookies = { .xfixes = { 0 } };
 
 /** Cookie request used when acquiring ownership on _NET_WM_CM_Sn */
 static xcb_get_selection_owner_cookie_t _get_wm_cm_owner_cookie = { 0 };
@@ -78,6 +92,111 @@ static xcb_get_selection_owner_cookie_t _get_wm_cm_owner_cookie = { 0 };
     window */
 static xcb_query_tree_cookie_t _query_tree_cookie = { 0 };
 
+/** Extents of the damaged Region, the  damaged Region itself only being
+    known by the X server */
+static struct
+{
+  /** Bounding box of all the damages added so far */
+  unagi_region_box_t box;
+  /** Whether a damage with unknown extents has been added */
+  bool is_known;
+} _display_damaged_extents = { { 0, 0, 0, 0 }, true };
+
+/** Maximum number of boxes  of the client-side damaged region, which
+    is simplified to its extents beyond */
+#define DISPLAY_DAMAGED_BOXES_MAX 64
+
+/** Damaged  rectangles  and  rectangular  windows accumulated  in the
+    client memory, only  uploaded to  the damaged Region  right before
+    painting rather than sending requests for each damage */
+static unagi_region_t _display_damaged_region;
+
+/** Share of the damaged Region left aside by
+    unagi_display_restrict_damaged() until the next reset */
+static struct
+{
+  /** The deferred Region (None if nothing is deferred) */
+  xcb_xfixes_region_t region;
+  /** Extents of the damaged Region before being restricted */
+  unagi_region_box_t box;
+  /** Whether these extents are known */
+  bool is_known;
+  /** Rectangles the damaged Region has been restricted to */
+  xcb_rectangle_t *rectangles;
+  /** Number of rectangles */
+  uint32_t rectangles_len;
+} _display_deferred_damaged = { XCB_NONE, { 0, 0, 0, 0 }, true, NULL, 0 };
+
+/** Time (in seconds)  a window must remain the  unredirect candidate
+    before being actually unredirected */
+#define DISPLAY_UNREDIRECT_DELAY 1.0
+
+/** Time (in seconds) without unredirect candidate before redirecting
+    the windows again */
+#define DISPLAY_REDIRECT_DELAY 0.2
+
+/** Unredirection of fullscreen windows */
+static struct
+{
+  /** Whether unredirection is enabled at all (requires the overlay
+      window) */
+  bool enabled;
+  /** Whether the windows are currently unredirected */
+  bool is_unredirected;
+  /** Last unredirect candidate */
+  xcb_window_t window;
+  /** When the state will be switched, 0 if no switch is pending */
+  ev_tstamp switch_time;
+} _display_unredirect;
+
+/** Round-trips accounted for the startup report */
+static struct
+{
+  /** Whether round-trips are accounted */
+  bool is_enabled;
+  /** Number of round-trips so far */
+  unsigned int count;
+  /** Sequence of the last request sent before the last round-trip */
+  unsigned int sentinel;
+} _display_round_trips;
+
+/** Enable or disable the accounting of round-trips
+ *
+ * \param is_enabled Whether round-trips are accounted from now
+ */
+void
+unagi_display_round_trips_enable(const bool is_enabled)
+{
+  _display_round_trips.is_enabled = is_enabled;
+}
+
+/** \return The number of round-trips accounted so far */
+unsigned int
+unagi_display_round_trips_get(void)
+{
+  return _display_round_trips.count;
+}
+
+/** Account a blocking wait for the reply (or the error) of a request,
+ *  to be called just before.  It is a round-trip unless the request was
+ *  sent before the last round-trip, in which case its reply came along
+ *  the previous ones.  The requests sent so far are marked by sending a
+ *  NoOperation request, whose sequence is compared to the later ones
+ *
+ * \param sequence The sequence number of the request waited for
+ */
+void
+unagi_display_round_trip(const unsigned int sequence)
+{
+  if(!_display_round_trips.is_enabled ||
+     (int) (sequence - _display_round_trips.sentinel) <= 0)
+    return;
+
+  _display_round_trips.count++;
+  _display_round_trips.sentinel =
+    xcb_no_operation(globalconf.connection).sequence;
+}
+
 /** Check  whether  the  needed   X  extensions  are  present  on  the
  *  server-side (all the data  have been previously pre-fetched in the
  *  extension  cache). Then send  requests to  check their  version by
@@ -100,6 +219,9 @@ unagi_display_init_extensions(void)
   globalconf.extensions.randr = xcb_get_extension_data(globalconf.connection,
                                                        &xcb_randr_id);
 
+  globalconf.extensions.shape = xcb_get_extension_data(globalconf.connection,
+                                                       &xcb_shape_id);
+
   if(!globalconf.extensions.composite ||
      !globalconf.extensions.composite->present)
     unagi_fatal("No Composite extension");
@@ -126,6 +248,12 @@ unagi_display_init_extensions(void)
 					  XCB_COMPOSITE_MAJOR_VERSION,
 					  XCB_COMPOSITE_MINOR_VERSION);
 
+  /* Sent now to  avoid a round-trip, its reply is  only used if the
+     version supports it */
+  _init_extensions_cookies.composite_overlay =
+    xcb_composite_get_overlay_window_unchecked(globalconf.connection,
+                                               globalconf.screen->root);
+
   _init_extensions_cookies.damage =
     xcb_damage_query_version_unchecked(globalconf.connection,
 				       XCB_DAMAGE_MAJOR_VERSION,
@@ -143,6 +271,37 @@ unagi_display_init_extensions(void)
                                         XCB_RANDR_MINOR_VERSION);
   else
     globalconf.extensions.randr = NULL;
+
+  if(globalconf.extensions.shape && globalconf.extensions.shape->present)
+    _init_extensions_cookies.shape =
+      xcb_shape_query_version_unchecked(globalconf.connection);
+  else
+    {
+      unagi_warn("No Shape extension, windows shape fetched on each map");
+      globalconf.extensions.shape = NULL;
+    }
+
+  if(cfg_getbool(globalconf.cfg, "vsync-present"))
+    {
+#ifdef HAVE_XCB_PRESENT
+      globalconf.extensions.present =
+        xcb_get_extension_data(globalconf.connection, &xcb_present_id);
+
+      if(globalconf.extensions.present &&
+         globalconf.extensions.present->present)
+        _init_extensions_cookies.present =
+          xcb_present_query_version_unchecked(globalconf.connection,
+                                              XCB_PRESENT_MAJOR_VERSION,
+                                              XCB_PRESENT_MINOR_VERSION);
+      else
+        {
+          unagi_warn("No Present extension, disabling VSync with Present");
+          globalconf.extensions.present = NULL;
+        }
+#else
+      unagi_warn("Built without Present support, disabling VSync with Present");
+#endif
+    }
 }
 
 /** Get the  replies of the QueryVersion requests  previously sent and
@@ -155,6 +314,7 @@ unagi_display_init_extensions_finalise(void)
 {
   assert(_init_extensions_cookies.composite.sequence);
 
+  unagi_display_round_trip(_init_extensions_cookies.composite.sequence);
   xcb_composite_query_version_reply_t *composite_version_reply =
     xcb_composite_query_version_reply(globalconf.connection,
 				      _init_extensions_cookies.composite,
@@ -167,6 +327,31 @@ unagi_display_init_extensions_finalise(void)
       unagi_fatal("Need Composite extension 0.2 at least");
     }
 
+  assert(_init_extensions_cookies.composite_overlay.sequence);
+
+  /* Need GetOverlayWindow introduced in version >= 0.3 */
+  if(composite_version_reply->major_version > 0 ||
+     composite_version_reply->minor_version >= 3)
+    {
+      xcb_composite_get_overlay_window_reply_t *overlay_window_reply =
+        xcb_composite_get_overlay_window_reply(globalconf.connection,
+                                               _init_extensions_cookies.composite_overlay,
+                                               NULL);
+
+      if(overlay_window_reply)
+        {
+          globalconf.overlay_window = overlay_window_reply->overlay_win;
+          free(overlay_window_reply);
+        }
+    }
+  else
+    xcb_discard_reply(globalconf.connection,
+                      _init_extensions_cookies.composite_overlay.sequence);
+
+  if(globalconf.overlay_window == XCB_NONE)
+    unagi_warn("Could not get Composite overlay window, painting on the root "
+               "window and fullscreen windows unredirection disabled");
+
   free(composite_version_reply);
 
   assert(_init_extensions_cookies.damage.sequence);
@@ -179,6 +364,10 @@ unagi_display_init_extensions_finalise(void)
   if(!damage_version_reply)
     unagi_fatal("Can't initialise Damage extension");
 
+  globalconf.extensions.damage_add = damage_version_reply->major_version > 1 ||
+    (damage_version_reply->major_version == 1 &&
+     damage_version_reply->minor_version >= 1);
+
   free(damage_version_reply);
 
   assert(_init_extensions_cookies.xfixes.sequence);
@@ -197,6 +386,24 @@ unagi_display_init_extensions_finalise(void)
 
   free(xfixes_version_reply);
 
+  if(globalconf.overlay_window != XCB_NONE)
+    {
+      /* Set an empty input shape on the overlay window, otherwise it
+         would get all the input events */
+      xcb_xfixes_region_t input_region = xcb_generate_id(globalconf.connection);
+      xcb_xfixes_create_region(globalconf.connection, input_region, 0, NULL);
+
+      xcb_xfixes_set_window_shape_region(globalconf.connection,
+                                         globalconf.overlay_window,
+                                         XCB_SHAPE_SK_INPUT, 0, 0,
+                                         input_region);
+
+      xcb_xfixes_destroy_region(globalconf.connection, input_region);
+
+      _display_unredirect.enabled = cfg_getbool(globalconf.cfg,
+                                                "unredirect-fullscreen");
+    }
+
   /* Need refresh rates support introduced in version >= 1.1 */
   if(globalconf.extensions.randr)
     {
@@ -213,6 +420,45 @@ unagi_display_init_extensions_finalise(void)
 
       free(randr_version_reply);
     }
+
+  /* Need ShapeNotify which is in any version */
+  if(globalconf.extensions.shape)
+    {
+      assert(_init_extensions_cookies.shape.sequence);
+
+      xcb_shape_query_version_reply_t *shape_version_reply =
+        xcb_shape_query_version_reply(globalconf.connection,
+                                      _init_extensions_cookies.shape,
+                                      NULL);
+
+      if(!shape_version_reply)
+        globalconf.extensions.shape = NULL;
+
+      free(shape_version_reply);
+    }
+
+#ifdef HAVE_XCB_PRESENT
+  /* Need NotifyMSC introduced in version >= 1.0 */
+  if(globalconf.extensions.present)
+    {
+      assert(_init_extensions_cookies.present.sequence);
+
+      xcb_present_query_version_reply_t *present_version_reply =
+        xcb_present_query_version_reply(globalconf.connection,
+                                        _init_extensions_cookies.present,
+                                        NULL);
+
+      if(!present_version_reply || present_version_reply->major_version < 1)
+        {
+          unagi_warn("Need Present extension 1.0 at least, disabling VSync "
+                     "with Present");
+
+          globalconf.extensions.present = NULL;
+        }
+
+      free(present_version_reply);
+    }
+#endif
 }
 
 /** Handler for  PropertyNotify event meaningful to  set the timestamp
@@ -293,6 +539,8 @@ unagi_display_register_cm_finalise(void)
 
   xcb_window_t wm_cm_owner_win;
 
+  unagi_display_round_trip(_get_wm_cm_owner_cookie.sequence);
+
   /* Check whether the ownership of WM_CM_Sn succeeded */
   return (xcb_ewmh_get_wm_cm_owner_reply(&globalconf.ewmh, _get_wm_cm_owner_cookie,
 					 &wm_cm_owner_win, NULL) &&
@@ -306,10 +554,6 @@ unagi_display_register_cm_finalise(void)
 void
 unagi_display_init_redirect(void)
 {
-  /* Manage all children windows from the root window */
-  _query_tree_cookie = xcb_query_tree_unchecked(globalconf.connection,
-						globalconf.screen->root);
-
   xcb_composite_redirect_subwindows(globalconf.connection,
 				    globalconf.screen->root,
 				    XCB_COMPOSITE_REDIRECT_MANUAL);
@@ -322,27 +566,35 @@ unagi_display_init_redirect(void)
 
   xcb_change_window_attributes(globalconf.connection, globalconf.screen->root,
 			       XCB_CW_EVENT_MASK, &select_input_val);
+
+  /* Manage all children windows from the root window, sent last so that
+     any redirection error has been received along with its reply */
+  _query_tree_cookie = xcb_query_tree_unchecked(globalconf.connection,
+						globalconf.screen->root);
 }
 
 /** Finish  redirection by  adding  all the  existing  windows in  the
- *  hierarchy
+ *  hierarchy, only sending their requests
+ *
+ * \see unagi_window_manage_existing_finalise
  */
 void
 unagi_display_init_redirect_finalise(void)
 {
   assert(_query_tree_cookie.sequence);
 
+  unagi_display_round_trip(_query_tree_cookie.sequence);
+
   /* Get all the windows below the root window */
   xcb_query_tree_reply_t *query_tree_reply =
     xcb_query_tree_reply(globalconf.connection,
 			 _query_tree_cookie,
 			 NULL);
 
-  /* Add all these windows excluding the root window of course */
-  const int nwindows = xcb_query_tree_children_length(query_tree_reply);
-  if(nwindows)
-    unagi_window_manage_existing(nwindows,
-                                 xcb_query_tree_children(query_tree_reply));
+  /* Add all these windows excluding the root window of course, their
+     replies are only got by unagi_window_manage_existing_finalise() */
+  unagi_window_manage_existing(xcb_query_tree_children_length(query_tree_reply),
+                               xcb_query_tree_children(query_tree_reply));
 
   free(query_tree_reply);
 }
@@ -355,13 +607,14 @@ unagi_display_init_redirect_finalise(void)
  *         seem to be an issue
  *
  * \param region Damaged Region to be added to the global one
+ * \param do_destroy_region Whether the given Region can be destroyed
+ * \param box Extents of the given Region, NULL if unknown
  */
-void
-unagi_display_add_damaged_region(xcb_xfixes_region_t *region,
-                                 bool do_destroy_region)
+static void
+display_add_damaged_region(xcb_xfixes_region_t *region,
+                           bool do_destroy_region,
+                           const unagi_region_box_t *box)
 {
-  if(!*region)
-    return;
 
   if(globalconf.damaged)
     {
@@ -399,38 +652,459 @@ unagi_display_add_damaged_region(xcb_xfixes_region_t *region,
 
   if(do_destroy_region)
     *region = XCB_NONE;
+
+  unagi_paint_schedule_box(box);
+}
+
+/** Add the given Region, whose extents are not known, to the damaged
+ *  Region
+ *
+ * \see display_add_damaged_region
+ * \param region Damaged Region to be added to the global one
+ * \param do_destroy_region Whether the given Region can be destroyed
+ */
+void
+unagi_display_add_damaged_region(xcb_xfixes_region_t *region,
+                                 bool do_destroy_region)
+{
+  if(!*region)
+    return;
+
+  _display_damaged_extents.is_known = false;
+  display_add_damaged_region(region, do_destroy_region, NULL);
+}
+
+/** Add the given box to the extents of the damaged Region */
+static inline void
+display_add_damaged_extents(const unagi_region_box_t *box)
+{
+  unagi_region_box_t *extents = &_display_damaged_extents.box;
+
+  if(unagi_region_box_is_empty(extents))
+    *extents = *box;
+  else
+    {
+      extents->x1 = min(extents->x1, box->x1);
+      extents->y1 = min(extents->y1, box->y1);
+      extents->x2 = max(extents->x2, box->x2);
+      extents->y2 = max(extents->y2, box->y2);
+    }
+}
+
+/** Add the given box to the client-side damaged region, which is
+ *  simplified to its extents when it gets too many boxes
+ *
+ * \param box The damaged box
+ */
+static void
+display_add_damaged_box(const unagi_region_box_t *box)
+{
+  display_add_damaged_extents(box);
+
+  if(!unagi_region_union_box(&_display_damaged_region, box) ||
+     _display_damaged_region.boxes_len > DISPLAY_DAMAGED_BOXES_MAX)
+    {
+      unagi_region_box_t extents = _display_damaged_region.extents;
+      if(unagi_region_box_is_empty(&extents))
+        extents = *box;
+      else
+        {
+          extents.x1 = min(extents.x1, box->x1);
+          extents.y1 = min(extents.y1, box->y1);
+          extents.x2 = max(extents.x2, box->x2);
+          extents.y2 = max(extents.y2, box->y2);
+        }
+
+      unagi_debug("Too many damaged boxes, simplified to %jdx%jd +%jd +%jd",
+                  (intmax_t) (extents.x2 - extents.x1),
+                  (intmax_t) (extents.y2 - extents.y1),
+                  (intmax_t) extents.x1, (intmax_t) extents.y1);
+
+      unagi_region_reset_box(&_display_damaged_region, &extents);
+    }
+
+  unagi_paint_schedule_box(box);
+}
+
+/** Add the given screen-relative rectangle to the damaged Region
+ *
+ * \param rectangle The damaged rectangle
+ */
+void
+unagi_display_add_damaged_rectangle(const xcb_rectangle_t *rectangle)
+{
+  const unagi_region_box_t box = {
+    rectangle->x, rectangle->y,
+    rectangle->x + rectangle->width, rectangle->y + rectangle->height
+  };
+
+  display_add_damaged_box(&box);
+}
+
+/** Add the Region of the given window to the damaged Region
+ *
+ * \param window The damaged window
+ * \param do_destroy_region Whether the window Region can be destroyed
+ */
+void
+unagi_display_add_damaged_window(unagi_window_t *window,
+                                 bool do_destroy_region)
+{
+  const unagi_region_box_t box = {
+    window->geometry->x, window->geometry->y,
+    window->geometry->x + window_width_with_border(window->geometry),
+    window->geometry->y + window_height_with_border(window->geometry)
+  };
+
+  /* The Region of a window mapped since the last repaint is only
+     created right before painting, so damage its box meanwhile */
+  if(!window->region)
+    {
+      if(window->is_acquire_pending)
+        display_add_damaged_box(&box);
+
+      return;
+    }
+
+  /* The Region of a rectangular window is its box, so there is no need
+     to send any request */
+  if(unagi_window_is_rectangular(window))
+    {
+      display_add_damaged_box(&box);
+
+      if(do_destroy_region)
+        {
+          xcb_xfixes_destroy_region(globalconf.connection, window->region);
+          window->region = XCB_NONE;
+        }
+
+      return;
+    }
+
+  display_add_damaged_extents(&box);
+  display_add_damaged_region(&window->region, do_destroy_region, &box);
+}
+
+/** Check whether something has been damaged since the last repaint
+ *
+ * \return true if the damaged Region or the client-side one is not empty
+ */
+bool
+unagi_display_is_damaged(void)
+{
+  return globalconf.damaged ||
+    !unagi_region_is_empty(&_display_damaged_region);
+}
+
+/** Upload the damages accumulated  in the client memory to the damaged
+ *  Region, called right before painting.  This only sends one request
+ *  if nothing has been added to the damaged Region meanwhile
+ */
+void
+unagi_display_upload_damaged(void)
+{
+  if(unagi_region_is_empty(&_display_damaged_region))
+    return;
+
+  const uint32_t rectangles_len = _display_damaged_region.boxes_len;
+  xcb_rectangle_t rectangles[rectangles_len];
+
+  for(uint32_t i = 0; i < rectangles_len; i++)
+    {
+      const unagi_region_box_t *box = &_display_damaged_region.boxes[i];
+
+      rectangles[i] = (xcb_rectangle_t) {
+        (int16_t) box->x1, (int16_t) box->y1,
+        (uint16_t) (box->x2 - box->x1), (uint16_t) (box->y2 - box->y1)
+      };
+    }
+
+  xcb_xfixes_region_t region = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection, region, rectangles_len,
+                           rectangles);
+
+  if(globalconf.damaged)
+    {
+      xcb_xfixes_union_region(globalconf.connection, globalconf.damaged,
+                              region, globalconf.damaged);
+
+      xcb_xfixes_destroy_region(globalconf.connection, region);
+    }
+  else
+    globalconf.damaged = region;
+
+  unagi_debug("Uploaded %u damaged boxes to damaged region %x",
+              rectangles_len, globalconf.damaged);
+
+  unagi_region_reset(&_display_damaged_region);
+}
+
+/** Get the extents of the damaged Region if known, that is to say if
+ *  the damaged Region has only been built from rectangles and windows
+ *
+ * \param extents Where to store the extents
+ * \return true if the extents are known
+ */
+bool
+unagi_display_get_damaged_extents(unagi_region_box_t *extents)
+{
+  if(!_display_damaged_extents.is_known || !unagi_display_is_damaged())
+    return false;
+
+  *extents = _display_damaged_extents.box;
+  return true;
+}
+
+/** Restrict the damaged  Region to the given rectangles  (e.g. the
+ *  CRTCs whose refresh deadline is reached), the  rest of  the damaged
+ *  Region being  deferred until  the next  call  to
+ *  unagi_display_reset_damaged()
+ *
+ * \param rectangles The rectangles to be painted
+ * \param rectangles_len The number of rectangles
+ */
+void
+unagi_display_restrict_damaged(const xcb_rectangle_t *rectangles,
+                               const uint32_t rectangles_len)
+{
+  if(!globalconf.damaged || _display_deferred_damaged.region ||
+     !rectangles_len)
+    return;
+
+  xcb_rectangle_t *rectangles_copy = malloc(sizeof(xcb_rectangle_t) *
+                                            rectangles_len);
+  if(!rectangles_copy)
+    return;
+
+  memcpy(rectangles_copy, rectangles, sizeof(xcb_rectangle_t) * rectangles_len);
+  _display_deferred_damaged.rectangles = rectangles_copy;
+  _display_deferred_damaged.rectangles_len = rectangles_len;
+
+  xcb_xfixes_region_t area = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection, area, rectangles_len,
+                           rectangles);
+
+  _display_deferred_damaged.region = xcb_generate_id(globalconf.connection);
+  xcb_xfixes_create_region(globalconf.connection,
+                           _display_deferred_damaged.region, 0, NULL);
+
+  xcb_xfixes_subtract_region(globalconf.connection, globalconf.damaged, area,
+                             _display_deferred_damaged.region);
+
+  xcb_xfixes_intersect_region(globalconf.connection, globalconf.damaged, area,
+                              globalconf.damaged);
+
+  xcb_xfixes_destroy_region(globalconf.connection, area);
+
+  /* The extents of the deferred Region are not computed, so keep the
+     previous ones which contain it anyway */
+  _display_deferred_damaged.box = _display_damaged_extents.box;
+  _display_deferred_damaged.is_known = _display_damaged_extents.is_known;
+
+  /* Likewise, the  damaged Region is  now contained in the previous
+     extents clipped to the bounding box of the rectangles */
+  unagi_region_box_t area_box = {
+    rectangles[0].x, rectangles[0].y,
+    rectangles[0].x + rectangles[0].width,
+    rectangles[0].y + rectangles[0].height
+  };
+
+  for(uint32_t i = 1; i < rectangles_len; i++)
+    {
+      area_box.x1 = min(area_box.x1, rectangles[i].x);
+      area_box.y1 = min(area_box.y1, rectangles[i].y);
+      area_box.x2 = max(area_box.x2, rectangles[i].x + rectangles[i].width);
+      area_box.y2 = max(area_box.y2, rectangles[i].y + rectangles[i].height);
+    }
+
+  unagi_region_box_t *extents = &_display_damaged_extents.box;
+  extents->x1 = max(extents->x1, area_box.x1);
+  extents->y1 = max(extents->y1, area_box.y1);
+  extents->x2 = min(extents->x2, area_box.x2);
+  extents->y2 = min(extents->y2, area_box.y2);
+}
+
+/** Get the rectangles  the damaged Region  has been restricted to for
+ *  the current repaint, if any
+ *
+ * \see unagi_display_restrict_damaged
+ * \param rectangles_len Where to store the number of rectangles (0 if
+ *                       the damaged Region has not been restricted)
+ * \return The rectangles
+ */
+const xcb_rectangle_t *
+unagi_display_get_restricted_area(uint32_t *rectangles_len)
+{
+  *rectangles_len = _display_deferred_damaged.rectangles_len;
+  return _display_deferred_damaged.rectangles;
 }
 
 /** Destroy the global  damaged Region and set it  to None, meaningful
  *  at  each  re-painting iteration  to  check  whether  a repaint  is
- *  necessary. This region is filled in event handlers
+ *  necessary. This region is filled in event handlers.  If a share of
+ *  the damaged Region has been deferred, it becomes the damaged Region
  */
 void
 unagi_display_reset_damaged(void)
 {
+  unagi_region_reset(&_display_damaged_region);
+
   if(globalconf.damaged)
     {
       xcb_xfixes_destroy_region(globalconf.connection, globalconf.damaged);
       globalconf.damaged = XCB_NONE;
     }
+
+  if(_display_deferred_damaged.region)
+    {
+      globalconf.damaged = _display_deferred_damaged.region;
+      _display_damaged_extents.box = _display_deferred_damaged.box;
+      _display_damaged_extents.is_known = _display_deferred_damaged.is_known;
+
+      _display_deferred_damaged.region = XCB_NONE;
+
+      unagi_util_free(&_display_deferred_damaged.rectangles);
+      _display_deferred_damaged.rectangles_len = 0;
+    }
+  else
+    {
+      _display_damaged_extents.is_known = true;
+      _display_damaged_extents.box = (unagi_region_box_t) { 0, 0, 0, 0 };
+    }
+}
+
+/** Compute the refresh interval of the given RandR mode
+ *
+ * \param modes The modes of the screen resources
+ * \param modes_len The number of modes
+ * \param mode_id The mode of the CRTC
+ * \return The refresh interval in seconds, or 0 if unknown
+ */
+static float
+display_get_mode_refresh_interval(const xcb_randr_mode_info_t *modes,
+                                  const int modes_len,
+                                  const xcb_randr_mode_t mode_id)
+{
+  for(int i = 0; i < modes_len; i++)
+    {
+      if(modes[i].id != mode_id)
+        continue;
+
+      if(!modes[i].dot_clock || !modes[i].htotal || !modes[i].vtotal)
+        return 0;
+
+      double vtotal = modes[i].vtotal;
+      if(modes[i].mode_flags & XCB_RANDR_MODE_FLAG_DOUBLE_SCAN)
+        vtotal *= 2;
+      if(modes[i].mode_flags & XCB_RANDR_MODE_FLAG_INTERLACE)
+        vtotal /= 2;
+
+      return (float) (modes[i].htotal * vtotal / modes[i].dot_clock);
+    }
+
+  return 0;
+}
+
+/** Free the client-side damaged region */
+void
+unagi_display_cleanup(void)
+{
+  unagi_region_free(&_display_damaged_region);
 }
 
+/** RandR requests sent by unagi_display_update_screen_information()
+ *  whose replies are got by its _finalise()
+ */
+static struct
+{
+  xcb_randr_get_screen_info_cookie_t screen_info;
+  xcb_randr_get_screen_resources_reply_t *screen_resources;
+  xcb_randr_get_crtc_info_cookie_t *crtcs_info;
+  int crtcs_len;
+} _display_screen_information;
+
 /** Update screen information provided by RandR, currently only screen
  *  refresh rate (necessary to calculate the interval between
  *  painting) and screen sizes (useful for expose for example to not
- *  display scaled windows out of screen
+ *  display scaled windows out of screen).  This only gets the screen
+ *  resources to send the GetCrtcInfo requests of all the CRTCs at once
+ *
+ * \see unagi_display_update_screen_information_finalise
+ * \param screen_info_cookie The GetScreenInfo cookie
+ * \param screen_resources_cookie The GetScreenResources cookie
  */
 void
 unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t screen_info_cookie,
                                         xcb_randr_get_screen_resources_cookie_t screen_resources_cookie)
 {
-  globalconf.crtc_len = 0;
-  int crtcs_len = 0;
+  _display_screen_information.screen_info = screen_info_cookie;
+  _display_screen_information.crtcs_len = 0;
+
   if(!screen_info_cookie.sequence || !screen_resources_cookie.sequence)
+    {
+      _display_screen_information.screen_resources = NULL;
+      return;
+    }
+
+  unagi_display_round_trip(screen_resources_cookie.sequence);
+
+  xcb_randr_get_screen_resources_reply_t *screen_resources_reply =
+    xcb_randr_get_screen_resources_reply(globalconf.connection,
+                                         screen_resources_cookie,
+                                         NULL);
+
+  _display_screen_information.screen_resources = screen_resources_reply;
+  if(!screen_resources_reply)
+    return;
+
+  const int crtcs_len =
+    xcb_randr_get_screen_resources_crtcs_length(screen_resources_reply);
+
+  if(!crtcs_len)
+    return;
+
+  _display_screen_information.crtcs_info =
+    malloc(sizeof(xcb_randr_get_crtc_info_cookie_t) * (size_t) crtcs_len);
+
+  if(!_display_screen_information.crtcs_info)
+    return;
+
+  xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_crtcs(screen_resources_reply);
+  for(int i = 0; i < crtcs_len; i++)
+    _display_screen_information.crtcs_info[i] =
+      xcb_randr_get_crtc_info_unchecked(globalconf.connection, crtcs[i],
+                                        screen_resources_reply->config_timestamp);
+
+  _display_screen_information.crtcs_len = crtcs_len;
+}
+
+/** Get the replies of the RandR requests sent by
+ *  unagi_display_update_screen_information() and update the screen
+ *  refresh rate and CRTCs accordingly
+ */
+void
+unagi_display_update_screen_information_finalise(void)
+{
+  for(unsigned int i = 0; i < globalconf.crtc_len; i++)
+    free(globalconf.crtc[i]);
+
+  unagi_util_free(&globalconf.crtc);
+  unagi_util_free(&globalconf.crtc_refresh_interval);
+
+  globalconf.crtc_len = 0;
+  const int crtcs_len = _display_screen_information.crtcs_len;
+  xcb_randr_get_screen_resources_reply_t *screen_resources_reply =
+    _display_screen_information.screen_resources;
+
+  if(!_display_screen_information.screen_info.sequence)
     goto randr_not_available;
 
+  unagi_display_round_trip(_display_screen_information.screen_info.sequence);
+
   xcb_randr_get_screen_info_reply_t *screen_info_reply =
-    xcb_randr_get_screen_info_reply(globalconf.connection, screen_info_cookie, NULL);
+    xcb_randr_get_screen_info_reply(globalconf.connection,
+                                    _display_screen_information.screen_info,
+                                    NULL);
 
   if(screen_info_reply)
     {
@@ -451,38 +1125,45 @@ unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t scree
       free(screen_info_reply);
     }
 
-  xcb_randr_get_screen_resources_reply_t *screen_resources_reply;
-  if((screen_resources_reply = xcb_randr_get_screen_resources_reply(globalconf.connection,
-                                                                    screen_resources_cookie,
-                                                                    NULL)) &&
-     (crtcs_len = xcb_randr_get_screen_resources_crtcs_length(screen_resources_reply)))
+  if(crtcs_len)
     {
       globalconf.crtc = calloc((size_t) crtcs_len,
                                sizeof(xcb_randr_get_crtc_info_reply_t *));
 
-      /* TODO: Asynchronous? */
-      xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_crtcs(screen_resources_reply);
+      globalconf.crtc_refresh_interval = calloc((size_t) crtcs_len,
+                                                sizeof(float));
+
+      const xcb_randr_mode_info_t *modes =
+        xcb_randr_get_screen_resources_modes(screen_resources_reply);
+      const int modes_len =
+        xcb_randr_get_screen_resources_modes_length(screen_resources_reply);
+
       for(int i = 0; i < crtcs_len; i++)
         {
-          xcb_randr_get_crtc_info_cookie_t crtc_info_cookie;
-          crtc_info_cookie = xcb_randr_get_crtc_info_unchecked(globalconf.connection,
-                                                               crtcs[i],
-                                                               screen_resources_reply->config_timestamp);
+          unagi_display_round_trip(_display_screen_information.crtcs_info[i].sequence);
 
           xcb_randr_get_crtc_info_reply_t *crtc_info_reply;
           crtc_info_reply = xcb_randr_get_crtc_info_reply(globalconf.connection,
-                                                          crtc_info_cookie,
+                                                          _display_screen_information.crtcs_info[i],
                                                           NULL);
 
           if(crtc_info_reply && crtc_info_reply->mode != XCB_NONE)
             {
-              globalconf.crtc[i] = crtc_info_reply;
-              globalconf.crtc_len++;
-              unagi_debug("%jux%ju +%jd +%jd",
+              float interval =
+                display_get_mode_refresh_interval(modes, modes_len,
+                                                  crtc_info_reply->mode);
+
+              if(interval && interval < UNAGI_MINIMUM_REPAINT_INTERVAL)
+                interval = (float) UNAGI_MINIMUM_REPAINT_INTERVAL;
+
+              globalconf.crtc_refresh_interval[globalconf.crtc_len] = interval;
+              globalconf.crtc[globalconf.crtc_len++] = crtc_info_reply;
+              unagi_debug("%jux%ju +%jd +%jd (refresh interval: %.6fs)",
                           (uintmax_t) crtc_info_reply->width,
                           (uintmax_t) crtc_info_reply->height,
                           (intmax_t) crtc_info_reply->x,
-                          (intmax_t) crtc_info_reply->y);
+                          (intmax_t) crtc_info_reply->y,
+                          interval);
             }
           else
             {
@@ -492,11 +1173,14 @@ unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t scree
                 unagi_warn("Could not get CRTC %d information with RandR", i);
             }
         }
-
-      free(screen_resources_reply);
     }
 
  randr_not_available:
+  unagi_util_free(&_display_screen_information.crtcs_info);
+  unagi_util_free(&_display_screen_information.screen_resources);
+  _display_screen_information.crtcs_len = 0;
+  _display_screen_information.screen_info.sequence = 0;
+
   if(!globalconf.refresh_rate_interval)
     {
       unagi_warn("Could not get screen refresh rate with RandR, set it to 50Hz");
@@ -515,7 +1199,17 @@ unagi_display_update_screen_information(xcb_randr_get_screen_info_cookie_t scree
       globalconf.crtc[0] = calloc(1, sizeof(xcb_randr_get_crtc_info_reply_t));
       globalconf.crtc[0]->width = globalconf.screen->width_in_pixels;
       globalconf.crtc[0]->height = globalconf.screen->height_in_pixels;
+
+      if(!globalconf.crtc_refresh_interval)
+        globalconf.crtc_refresh_interval = calloc(1, sizeof(float));
     }
+
+  /* Use the screen refresh rate when the mode one is not known */
+  for(unsigned int i = 0; i < globalconf.crtc_len; i++)
+    if(!globalconf.crtc_refresh_interval[i])
+      globalconf.crtc_refresh_interval[i] = globalconf.refresh_rate_interval;
+
+  unagi_paint_update_clocks();
 }
 
 bool
@@ -567,3 +1261,165 @@ display_vsync_drm_cleanup(void)
   if(globalconf.vsync_drm_fd >= 0)
     close(globalconf.vsync_drm_fd);
 }
+
+#ifdef HAVE_XCB_PRESENT
+/** Present event identifier of the CompleteNotify events selection */
+static xcb_present_event_t _vsync_present_event_id = XCB_NONE;
+
+/** Serial of the last NotifyMSC request */
+static uint32_t _vsync_present_serial = 0;
+
+/** Select  CompleteNotify  events  on  the  root  window,  they  are
+ *  received  through the  X  event  loop  as  any  other event,  thus
+ *  nothing blocks until the VBlank unlike DRM
+ */
+void
+display_vsync_present_init(void)
+{
+  _vsync_present_event_id = xcb_generate_id(globalconf.connection);
+
+  xcb_present_select_input(globalconf.connection,
+                           _vsync_present_event_id,
+                           globalconf.screen->root,
+                           XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+}
+
+/** Ask the X server to send a CompleteNotify event (with the MSC and
+ *  its UST timestamp) at the next VBlank
+ */
+void
+display_vsync_present_notify_msc(void)
+{
+  xcb_present_notify_msc(globalconf.connection,
+                         globalconf.screen->root,
+                         ++_vsync_present_serial,
+                         0, 1, 0);
+}
+#endif
+
+/** Check whether the windows are currently unredirected, in which
+ *  case nothing is painted and there is no window Pixmap
+ *
+ * \return true if the windows are unredirected
+ */
+bool
+unagi_display_is_unredirected(void)
+{
+  return _display_unredirect.is_unredirected;
+}
+
+/** Check whether a switch between redirection and unredirection is
+ *  pending, meaning that the painting scheduler must keep calling
+ *  unagi_display_update_unredirection()
+ *
+ * \return true if a switch is pending
+ */
+bool
+unagi_display_unredirection_is_pending(void)
+{
+  return _display_unredirect.switch_time != 0;
+}
+
+/** Stop compositing: unredirect  all the windows, thus painted
+ *  directly by the X server, and unmap the overlay window. The window
+ *  Pixmaps are not updated anymore, so free them
+ *
+ * \param window_id The fullscreen Window XID
+ */
+static void
+display_unredirect(const xcb_window_t window_id)
+{
+  unagi_debug("Unredirecting windows (fullscreen window %jx)",
+              (uintmax_t) window_id);
+
+  xcb_composite_unredirect_subwindows(globalconf.connection,
+                                      globalconf.screen->root,
+                                      XCB_COMPOSITE_REDIRECT_MANUAL);
+
+  xcb_unmap_window(globalconf.connection, globalconf.overlay_window);
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    unagi_window_free_pixmap(window);
+
+  _display_unredirect.is_unredirected = true;
+  xcb_flush(globalconf.connection);
+}
+
+/** Resume compositing: redirect the windows again, get their new
+ *  Pixmap and map the overlay window which is then entirely repainted
+ */
+static void
+display_redirect(void)
+{
+  unagi_debug("Redirecting windows");
+
+  xcb_composite_redirect_subwindows(globalconf.connection,
+                                    globalconf.screen->root,
+                                    XCB_COMPOSITE_REDIRECT_MANUAL);
+
+  _display_unredirect.is_unredirected = false;
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    if(unagi_window_is_visible(window) && !window->is_acquire_pending)
+      {
+        window->pixmap = unagi_window_get_pixmap(window);
+        unagi_window_stack_update(window);
+      }
+
+  /* Mapped after the redirection so that  the screen content is kept
+     until the overlay window is painted */
+  xcb_map_window(globalconf.connection, globalconf.overlay_window);
+
+  globalconf.force_repaint = true;
+}
+
+/** Unredirect the windows when the topmost window is fullscreen and
+ *  opaque, and redirect them again otherwise. To avoid thrashing, a
+ *  window is only unredirected after remaining the candidate for
+ *  DISPLAY_UNREDIRECT_DELAY and the windows are only redirected again
+ *  after DISPLAY_REDIRECT_DELAY without candidate, unless a plugin is
+ *  activated as it needs compositing right away. Called by the painting
+ *  scheduler before each repaint
+ *
+ * \return true if the windows are unredirected (nothing to paint)
+ */
+bool
+unagi_display_update_unredirection(void)
+{
+  if(!_display_unredirect.enabled)
+    return false;
+
+  /* Plugins such as expose paint the screen themselves */
+  const bool is_plugin_activated = unagi_plugin_is_painting_activated();
+
+  unagi_window_t *candidate = NULL;
+  if(!is_plugin_activated)
+    candidate = unagi_window_get_unredirect_candidate();
+
+  const xcb_window_t candidate_id = candidate ? candidate->id : XCB_NONE;
+
+  if((candidate != NULL) == _display_unredirect.is_unredirected)
+    _display_unredirect.switch_time = 0;
+  else if(is_plugin_activated)
+    {
+      _display_unredirect.switch_time = 0;
+      display_redirect();
+    }
+  /* Start the delay, or restart it if the candidate has changed */
+  else if(!_display_unredirect.switch_time ||
+          candidate_id != _display_unredirect.window)
+    _display_unredirect.switch_time = ev_now(globalconf.event_loop) +
+      (candidate ? DISPLAY_UNREDIRECT_DELAY : DISPLAY_REDIRECT_DELAY);
+  else if(ev_now(globalconf.event_loop) >= _display_unredirect.switch_time)
+    {
+      _display_unredirect.switch_time = 0;
+
+      if(candidate)
+        display_unredirect(candidate_id);
+      else
+        display_redirect();
+    }
+
+  _display_unredirect.window = candidate_id;
+  return _display_unredirect.is_unredirected;
+}
@@ -21,10 +21,19 @@
  *  \brief X events management
  */
 
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include <stdlib.h>
+#include <string.h>
 
 #include <xcb/xcb.h>
 #include <xcb/composite.h>
+#ifdef HAVE_XCB_PRESENT
+# include <xcb/present.h>
+#endif
+#include <xcb/shape.h>
 #include <xcb/xcb_event.h>
 
 #include "event.h"
@@ -33,6 +42,7 @@
 #include "window.h"
 #include "atoms.h"
 #include "key.h"
+#include "paint.h"
 
 /** Requests label of Composite extension for X error reporting, which
  *  are uniquely  identified according to their  minor opcode starting
@@ -99,6 +109,19 @@ static const char *damage_request_label[] = {
   "DamageAdd",
 };
 
+#ifdef HAVE_XCB_PRESENT
+/** Requests label of  Present extension for X  error reporting, which
+ *  are uniquely  identified according to their  minor opcode starting
+ *  from 0 */
+static const char *present_request_label[] = {
+  "PresentQueryVersion",
+  "PresentPixmap",
+  "PresentNotifyMSC",
+  "PresentSelectInput",
+  "PresentQueryCapabilities"
+};
+#endif
+
 /** Error label of XFixes specific error */
 static const char *xfixes_error_label = "BadRegion";
 
@@ -139,6 +162,13 @@ error_get_request_label(const uint8_t request_major_code,
     return ERROR_EXTENSION_GET_REQUEST_LABEL(damage_request_label,
 					     request_minor_code);
 
+#ifdef HAVE_XCB_PRESENT
+  else if(globalconf.extensions.present &&
+          request_major_code == globalconf.extensions.present->major_opcode)
+    return ERROR_EXTENSION_GET_REQUEST_LABEL(present_request_label,
+					     request_minor_code);
+#endif
+
   else
       return xcb_event_get_request_label(request_major_code);
 }
@@ -184,6 +214,14 @@ event_handle_error(xcb_generic_error_t *error)
              error_get_request_label(error->major_code, error->minor_code),
              (uintmax_t) error->major_code, (uintmax_t) error->minor_code,
              (uintmax_t) error->resource_id, error_label);
+
+#ifdef HAVE_XCB_PRESENT
+  /* No CompleteNotify will ever be sent for a failed NotifyMSC */
+  if(globalconf.extensions.present &&
+     error->major_code == globalconf.extensions.present->major_opcode &&
+     error->minor_code == XCB_PRESENT_NOTIFY_MSC)
+    unagi_paint_vblank_failed();
+#endif
 }
 
 /** Handler for X events  during initialisation (any error encountered
@@ -226,87 +264,572 @@ unagi_event_handle_startup(xcb_generic_event_t *event)
     }
 }
 
+/** Classes of events, handled by decreasing priority */
+typedef enum
+{
+  /** Keyboard and pointer events */
+  EVENT_CLASS_INPUT = 0,
+  /** Windows tree, geometry and properties changes and other events */
+  EVENT_CLASS_STRUCTURE,
+  /** DamageNotify events */
+  EVENT_CLASS_DAMAGE,
+  EVENT_CLASS_LEN
+} event_class_t;
+
+/** Label of each event class for reporting */
+static const char *event_class_label[] = {
+  "input",
+  "structure",
+  "damage"
+};
+
+/** Number of events handled between two checks of the time budget */
+#define EVENT_BUDGET_CHECK_INTERVAL 32
+
+/** DamageNotify events deferred until the other events are handled */
+static struct
+{
+  /** Deferred events, in the order they have been received */
+  xcb_damage_notify_event_t **events;
+  /** Number of deferred events */
+  uint32_t len;
+  /** Number of events which can be stored without reallocation */
+  uint32_t size;
+} _event_damage_queue;
+
+/** Events handling statistics, reported once per second at most */
+static struct
+{
+  /** Number of events handled per class */
+  unsigned int count[EVENT_CLASS_LEN];
+  /** Time spent handling the events per class */
+  double time[EVENT_CLASS_LEN];
+  /** Number of DamageNotify events merged because of the time budget */
+  unsigned int coalesced;
+  /** Number of DamageNotify events discarded as the window was already
+      fully damaged */
+  unsigned int discarded;
+  /** Number of ConfigureNotify events merged with a previous one */
+  unsigned int configure_coalesced;
+  /** Number of windows unmapped before their Pixmap was acquired */
+  unsigned int map_discarded;
+  /** Start of the current reporting period */
+  ev_tstamp start_time;
+} _event_stats;
+
+/** Events statistics of the last reporting period, kept to be queried
+    through D-Bus */
+static unagi_event_stats_t _event_stats_rates;
+
 /** Maximum number  of DamageNotify events received  before repainting
     the full window */
 #define DAMAGE_NOTIFY_MAX 24
 
-/** Handler for DamageNotify events
+/** Windows whose events are only processed right before painting */
+typedef struct
+{
+  /** Windows XIDs, as the windows may be destroyed in the meantime */
+  xcb_window_t *ids;
+  /** Number of windows */
+  uint32_t len;
+  /** Number of windows which can be stored without reallocation */
+  uint32_t size;
+} event_window_queue_t;
+
+/** Windows whose ConfigureNotify have not been flushed yet */
+static event_window_queue_t _event_configure_queue;
+
+/** Windows mapped since the last repaint */
+static event_window_queue_t _event_map_queue;
+
+/** Time of the first MapNotify since the last repaint */
+static ev_tstamp _event_map_start_time;
+
+/** Throttled windows with a pending damage */
+static event_window_queue_t _event_damage_throttle_queue;
+
+/** Add the given window to a queue of windows processed before painting
  *
- * \param event The X DamageNotify event
+ * \param queue The windows queue
+ * \param window_id The window XID
+ * \return false if the memory could not be allocated
+ */
+static bool
+event_window_queue_push(event_window_queue_t *queue,
+                        const xcb_window_t window_id)
+{
+  if(queue->len == queue->size)
+    {
+      const uint32_t size = queue->size ? queue->size * 2 : 16;
+
+      xcb_window_t *ids = realloc(queue->ids, size * sizeof(xcb_window_t));
+      if(!ids)
+        return false;
+
+      queue->ids = ids;
+      queue->size = size;
+    }
+
+  queue->ids[queue->len++] = window_id;
+  return true;
+}
+
+/** Free the memory allocated for a queue of windows
+ *
+ * \param queue The windows queue
  */
 static void
-event_handle_damage_notify(xcb_damage_notify_event_t *event)
+event_window_queue_free(event_window_queue_t *queue)
 {
-  unagi_debug("DamageNotify: area: %jux%ju %+jd %+jd "
-              "(drawable=%jx,geometry=%jux%ju +%jd +%jd)",
-              (uintmax_t) event->area.width, (uintmax_t) event->area.height,
-              (intmax_t) event->area.x, (intmax_t) event->area.y,
-              (uintmax_t) event->drawable,
-              (uintmax_t) event->geometry.width, (uintmax_t) event->geometry.height,
-              (uintmax_t) event->geometry.x, (uintmax_t) event->geometry.y);
+  unagi_util_free(&queue->ids);
+  queue->size = 0;
+  queue->len = 0;
+}
 
-#ifdef __DEBUG__
-  static unsigned int damage_notify_event_counter = 0;
-  unagi_debug("DamageNotify: COUNT: %u", ++damage_notify_event_counter);
-#endif
+/** Once the damage rate  of a throttled window gets below this ratio
+    of its maximum rate, it is not throttled anymore */
+#define DAMAGE_RATE_UNTHROTTLE_RATIO 0.75
 
-  unagi_window_t *window = unagi_window_list_get(event->drawable);
-  /* The window may have disappeared in the meantime or is not visible
-     so do nothing */
-  if(!window || !unagi_window_is_visible(window))
+/** Timer painting the damages of throttled windows when they are due */
+static ev_timer _event_damage_throttle_timer;
+
+/** Maximum time (in seconds) the Pixmap of the previous size of a
+    resized window is kept if the client does not draw at the new size */
+#define RESIZE_SETTLE_TIMEOUT 0.1
+
+/** Timer acquiring the Pixmap of resized windows once settled */
+static ev_timer _event_resize_settle_timer;
+
+/** Resized windows whose Pixmap of the new size has not been acquired */
+static event_window_queue_t _event_resize_settle_queue;
+
+/** Region used to damage whole windows with DamageAdd */
+static xcb_xfixes_region_t _event_damage_saturate_region = XCB_NONE;
+
+/** Add the whole window to the damage  of its Damage object as soon as
+ *  it is considered fully damaged, so that  the X server does not send
+ *  any more DamageNotify until its damage is subtracted after painting
+ *  (as the damage is only reported when it grows).  This is useless
+ *  with DamageReportNonEmpty level which only reports the first damage
+ *
+ * \param window The fully damaged window
+ */
+static void
+event_damage_saturate(const unagi_window_t *window)
+{
+  if(!globalconf.extensions.damage_add || !window->damage ||
+     window->damage_level.level == XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY)
     return;
 
-  UNAGI_PLUGINS_EVENT_HANDLE(event, damage, window);
+  /* DamageAdd Region is relative to the drawable */
+  const xcb_rectangle_t rectangle = {
+    0, 0, window->geometry->width, window->geometry->height
+  };
 
-  xcb_xfixes_region_t damaged_region;
-  bool is_temporary_region = false;
+  if(_event_damage_saturate_region)
+    xcb_xfixes_set_region(globalconf.connection, _event_damage_saturate_region,
+                          1, &rectangle);
+  else
+    {
+      _event_damage_saturate_region = xcb_generate_id(globalconf.connection);
+      xcb_xfixes_create_region(globalconf.connection,
+                               _event_damage_saturate_region, 1, &rectangle);
+    }
 
+  xcb_damage_add(globalconf.connection, window->id,
+                 _event_damage_saturate_region);
+}
+
+/** Add the damage given by the DamageNotify event to the damaged Region
+ *
+ * \param window The damaged window
+ * \param event The X DamageNotify event
+ */
+static void
+event_add_window_damage(unagi_window_t *window,
+                        xcb_damage_notify_event_t *event)
+{
   /* If the Window has never been  damaged, then it means it has never
      be painted on the screen yet, thus paint its entire content */
   if(!window->damaged)
     {
-      damaged_region = window->region;
       window->damaged = true;
       window->damaged_ratio = 1.0;
+      unagi_window_stack_update(window);
+      unagi_display_add_damaged_window(window, false);
+      event_damage_saturate(window);
     }
   /* Do nothing if the window is already fully damaged */
   else if(window->damaged_ratio >= UNAGI_WINDOW_FULLY_DAMAGED_RATIO)
     {
       unagi_debug("Window %jx fully damaged (cached)", (uintmax_t) window->id);
+      _event_stats.discarded++;
       return;
     }
   /* If  the   window  is  considered   fully  damaged  or   too  many
      DamageNotify  events   have  been   received,  then   repaint  it
      completely */
   else if(window->damage_notify_counter++ > DAMAGE_NOTIFY_MAX ||
-          window_get_damaged_ratio(window, event) >= UNAGI_WINDOW_FULLY_DAMAGED_RATIO)
+          unagi_window_add_damaged_area(window, &event->area) >=
+          UNAGI_WINDOW_FULLY_DAMAGED_RATIO)
     {
       unagi_debug("Window %jx damaged ratio: %.2f, counter: %d",
                   (uintmax_t) window->id,
                   window->damaged_ratio,
                   window->damage_notify_counter);
 
-      /* @todo:  Perhaps  xcb_damage_add()  could  be  used  to  avoid
-         further events to  be sent as the window  is considered fully
-         damaged? */
-      damaged_region = window->region;
+      unagi_window_account_wasted_pixels(window);
+
       window->damaged_ratio = 1.0;
+      unagi_display_add_damaged_window(window, false);
+      event_damage_saturate(window);
     }
   /* Otherwise, just paint the damaged Region (which may be the entire
      Window or part of it */
   else
     {
-      damaged_region = xcb_generate_id(globalconf.connection);
-
       event->area.x += event->geometry.x;
       event->area.y += event->geometry.y;
-      xcb_xfixes_create_region(globalconf.connection, damaged_region,
-                               1, &event->area);
+      unagi_display_add_damaged_rectangle(&event->area);
+    }
+}
+
+/** Paint the  pending damages of  the throttled windows which are due
+ *  and start the timer again for the next one
+ */
+static void
+event_damage_throttle_callback(EV_P_ ev_timer *w, int revents)
+{
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+  ev_tstamp next_time = 0;
+
+  /* Only keep the windows whose damage is not due yet */
+  uint32_t len = 0;
+  for(uint32_t i = 0; i < _event_damage_throttle_queue.len; i++)
+    {
+      unagi_window_t *window =
+        unagi_window_list_get(_event_damage_throttle_queue.ids[i]);
 
-      is_temporary_region = true;
+      if(!window || !window->damage_rate.is_pending)
+        continue;
+
+      if(window->damage_rate.next_time > now)
+        {
+          if(!next_time || window->damage_rate.next_time < next_time)
+            next_time = window->damage_rate.next_time;
+
+          _event_damage_throttle_queue.ids[len++] = window->id;
+          continue;
+        }
+
+      window->damage_rate.is_pending = false;
+      window->damage_rate.next_time = now + 1.0 / window->damage_rate.max;
+
+      if(unagi_window_is_visible(window))
+        event_add_window_damage(window, &window->damage_rate.pending);
+    }
+
+  _event_damage_throttle_queue.len = len;
+
+  if(next_time)
+    {
+      ev_timer_set(&_event_damage_throttle_timer, next_time - now, 0);
+      ev_timer_start(globalconf.event_loop, &_event_damage_throttle_timer);
+    }
+}
+
+/** Measure the number of times per second the window is updated (its
+ *  DamageNotify are only accounted once per repaint interval) and, if
+ *  it  is  over the  configured  maximum,  throttle the window:  its
+ *  damages are then merged and only painted max times per second
+ *
+ * \param window The damaged window
+ * \param event The X DamageNotify event
+ * \return true if the damage has been deferred
+ */
+static bool
+event_damage_throttle(unagi_window_t *window,
+                      const xcb_damage_notify_event_t *event)
+{
+  const float max = unagi_window_get_damage_rate_max(window);
+  if(!max)
+    return false;
+
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+
+  if(now - window->damage_rate.last_time >= globalconf.repaint_interval / 2)
+    {
+      window->damage_rate.last_time = now;
+      window->damage_rate.counter++;
     }
 
-  unagi_display_add_damaged_region(&damaged_region, is_temporary_region);
+  const ev_tstamp elapsed = now - window->damage_rate.start_time;
+  if(elapsed >= 1.0)
+    {
+      window->damage_rate.rate = (float) (window->damage_rate.counter / elapsed);
+      window->damage_rate.counter = 0;
+      window->damage_rate.start_time = now;
+
+      if(!window->damage_rate.is_throttled && window->damage_rate.rate > max)
+        {
+          unagi_debug("Window %jx updated %.2f times/s, throttled to %.2f",
+                      (uintmax_t) window->id, window->damage_rate.rate, max);
+
+          window->damage_rate.is_throttled = true;
+          window->damage_rate.next_time = now + 1.0 / max;
+        }
+      else if(window->damage_rate.is_throttled &&
+              window->damage_rate.rate < max * DAMAGE_RATE_UNTHROTTLE_RATIO)
+        {
+          unagi_debug("Window %jx updated %.2f times/s, not throttled anymore",
+                      (uintmax_t) window->id, window->damage_rate.rate);
+
+          window->damage_rate.is_throttled = false;
+        }
+    }
+
+  if(!window->damage_rate.is_throttled && !window->damage_rate.is_pending)
+    return false;
+
+  /* Merge the damage with the pending one */
+  if(window->damage_rate.is_pending)
+    {
+      xcb_rectangle_t *area = &window->damage_rate.pending.area;
+
+      const int32_t x1 = min(area->x, event->area.x);
+      const int32_t y1 = min(area->y, event->area.y);
+      const int32_t x2 = max(area->x + area->width,
+                             event->area.x + event->area.width);
+      const int32_t y2 = max(area->y + area->height,
+                             event->area.y + event->area.height);
+
+      *area = (xcb_rectangle_t) {
+        (int16_t) x1, (int16_t) y1, (uint16_t) (x2 - x1), (uint16_t) (y2 - y1)
+      };
+
+      window->damage_rate.pending.geometry = event->geometry;
+      return true;
+    }
+
+  /* Paint it right away if the window has not been painted recently */
+  if(window->damage_rate.next_time <= now)
+    {
+      window->damage_rate.next_time = now + 1.0 / max;
+      return false;
+    }
+
+  /* Painted right away if it cannot be queued */
+  if(!event_window_queue_push(&_event_damage_throttle_queue, window->id))
+    return false;
+
+  window->damage_rate.pending = *event;
+  window->damage_rate.is_pending = true;
+
+  if(!ev_is_active(&_event_damage_throttle_timer))
+    {
+      ev_init(&_event_damage_throttle_timer, event_damage_throttle_callback);
+      ev_timer_set(&_event_damage_throttle_timer,
+                   window->damage_rate.next_time - now, 0);
+      ev_timer_start(globalconf.event_loop, &_event_damage_throttle_timer);
+    }
+  else if(window->damage_rate.next_time <
+          now + ev_timer_remaining(globalconf.event_loop,
+                                   &_event_damage_throttle_timer))
+    {
+      ev_timer_stop(globalconf.event_loop, &_event_damage_throttle_timer);
+      ev_timer_set(&_event_damage_throttle_timer,
+                   window->damage_rate.next_time - now, 0);
+      ev_timer_start(globalconf.event_loop, &_event_damage_throttle_timer);
+    }
+
+  return true;
+}
+
+/** Acquire  the Pixmap of  the new size  of a resized  window, thus
+ *  freeing the Pixmap and Picture of the previous size
+ *
+ * \param window The resized window
+ */
+static void
+event_acquire_resized_pixmap(unagi_window_t *window)
+{
+  unagi_debug("Window %jx resize settled, acquiring new Pixmap",
+              (uintmax_t) window->id);
+
+  unagi_window_free_pixmap(window);
+  window->pixmap = unagi_window_get_pixmap(window);
+  unagi_window_stack_update(window);
+
+  unagi_display_add_damaged_window(window, false);
+  window->damaged_ratio = 1.0;
+}
+
+/** Acquire the Pixmap of the resized windows whose client has not drawn
+ *  at  the new size  before the timeout and  start the  timer  again for
+ *  the next one
+ */
+static void
+event_resize_settle_callback(EV_P_ ev_timer *w, int revents)
+{
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+  ev_tstamp next_time = 0;
+
+  /* Only keep the windows whose resize has not settled yet */
+  uint32_t len = 0;
+  for(uint32_t i = 0; i < _event_resize_settle_queue.len; i++)
+    {
+      const xcb_window_t window_id = _event_resize_settle_queue.ids[i];
+      unagi_window_t *window = unagi_window_list_get(window_id);
+
+      if(!window)
+        continue;
+
+      /* The windows  list has been  replaced by a plugin  (e.g. Expose),
+         so wait for the window record to be back */
+      if(!window->is_record)
+        {
+          if(!next_time || now + RESIZE_SETTLE_TIMEOUT < next_time)
+            next_time = now + RESIZE_SETTLE_TIMEOUT;
+
+          _event_resize_settle_queue.ids[len++] = window_id;
+          continue;
+        }
+
+      if(!window->resize.is_pending)
+        continue;
+
+      if(window->resize.deadline > now)
+        {
+          if(!next_time || window->resize.deadline < next_time)
+            next_time = window->resize.deadline;
+
+          _event_resize_settle_queue.ids[len++] = window_id;
+          continue;
+        }
+
+      event_acquire_resized_pixmap(window);
+    }
+
+  _event_resize_settle_queue.len = len;
+
+  if(next_time)
+    {
+      ev_timer_set(&_event_resize_settle_timer, next_time - now, 0);
+      ev_timer_start(globalconf.event_loop, &_event_resize_settle_timer);
+    }
+}
+
+/** Keep painting the  Pixmap of the previous size  of a resized window
+ *  (clipped to the new size) until the client has drawn at the new size
+ *  or  the  resize  has settled,  rather  than  acquiring  one  Pixmap
+ *  and Picture per intermediate size
+ *
+ * \param window The resized window
+ */
+static void
+event_defer_resized_pixmap(unagi_window_t *window)
+{
+  /* Acquired right away if it cannot be queued */
+  if(!window->resize.is_pending &&
+     !event_window_queue_push(&_event_resize_settle_queue, window->id))
+    {
+      event_acquire_resized_pixmap(window);
+      return;
+    }
+
+  window->resize.is_pending = true;
+  window->resize.deadline = ev_now(globalconf.event_loop) + RESIZE_SETTLE_TIMEOUT;
+
+  if(!ev_is_active(&_event_resize_settle_timer))
+    {
+      ev_init(&_event_resize_settle_timer, event_resize_settle_callback);
+      ev_timer_set(&_event_resize_settle_timer, RESIZE_SETTLE_TIMEOUT, 0);
+      ev_timer_start(globalconf.event_loop, &_event_resize_settle_timer);
+    }
+}
+
+/** Handler for DamageNotify events
+ *
+ * \param event The X DamageNotify event
+ */
+static void
+event_handle_damage_notify(xcb_damage_notify_event_t *event)
+{
+  unagi_debug("DamageNotify: area: %jux%ju %+jd %+jd "
+              "(drawable=%jx,geometry=%jux%ju +%jd +%jd)",
+              (uintmax_t) event->area.width, (uintmax_t) event->area.height,
+              (intmax_t) event->area.x, (intmax_t) event->area.y,
+              (uintmax_t) event->drawable,
+              (uintmax_t) event->geometry.width, (uintmax_t) event->geometry.height,
+              (uintmax_t) event->geometry.x, (uintmax_t) event->geometry.y);
+
+#ifdef __DEBUG__
+  static unsigned int damage_notify_event_counter = 0;
+  unagi_debug("DamageNotify: COUNT: %u", ++damage_notify_event_counter);
+#endif
+
+  unagi_window_t *window = unagi_window_list_get(event->drawable);
+  /* The window may have disappeared in the meantime or is not visible
+     so do nothing */
+  if(!window)
+    return;
+
+  unagi_window_account_damage_notify(window);
+
+  if(!unagi_window_is_visible(window))
+    return;
+
+  /* The client has drawn at the new size of the window being resized */
+  if(window->resize.is_pending &&
+     event->geometry.width == window->geometry->width &&
+     event->geometry.height == window->geometry->height)
+    event_acquire_resized_pixmap(window);
+
+  UNAGI_PLUGINS_EVENT_HANDLE(event, damage, window);
+
+  /* The first damage after mapping the window is never deferred */
+  if(window->damaged && event_damage_throttle(window, event))
+    return;
+
+  event_add_window_damage(window, event);
+}
+
+/** Handler for ShapeNotify events reported when the shape of a window
+ *  changes,  which  is  the  only  time  its shape is fetched again and
+ *  its Region re-created
+ *
+ * \param event The X ShapeNotify event
+ */
+static void
+event_handle_shape_notify(xcb_shape_notify_event_t *event)
+{
+  unagi_debug("ShapeNotify: window=%jx, kind=%ju, shaped=%ju",
+              (uintmax_t) event->affected_window,
+              (uintmax_t) event->shape_kind, (uintmax_t) event->shaped);
+
+  if(event->shape_kind != XCB_SHAPE_SK_BOUNDING)
+    return;
+
+  unagi_window_t *window = unagi_window_list_get(event->affected_window);
+  if(!window)
+    return;
+
+  unagi_window_discard_shape(window);
+
+  /* The Picture is clipped to the shape when created */
+  (*globalconf.rendering->free_window_pixmap)(window);
+
+  /* Otherwise the Region is created with the new shape when needed */
+  if(!unagi_window_is_visible(window) || window->is_acquire_pending ||
+     !window->region)
+    return;
+
+  /* Damage the area of the previous shape and then the new one */
+  unagi_display_add_damaged_window(window, true);
+
+  window->region = unagi_window_get_region(window, true, true);
+  unagi_display_add_damaged_window(window, false);
+  window->damaged_ratio = 1.0;
 }
 
 /** Handler for RRScreenChangeNotify events reported when the screen
@@ -324,6 +847,8 @@ event_handle_randr_screen_change_notify(xcb_randr_screen_change_notify_event_t *
                                           xcb_randr_get_screen_resources_unchecked(globalconf.connection,
                                                                                    globalconf.screen->root));
 
+  unagi_display_update_screen_information_finalise();
+
   UNAGI_PLUGINS_EVENT_HANDLE(event, randr_screen_change_notify, NULL);
 }
 
@@ -424,6 +949,101 @@ event_handle_circulate_notify(xcb_circulate_notify_event_t *event)
   UNAGI_PLUGINS_EVENT_HANDLE(event, circulate, window);
 }
 
+/** Re-create the Window Region (and the Pixmap if the window has been
+ *  resized  or was not visible) of the windows configured since the
+ *  last repaint,  and damage their new position.  This is called right
+ *  before painting, so that this is only done once per frame whatever
+ *  the number of ConfigureNotify received
+ */
+void
+unagi_event_flush_configure_notify(void)
+{
+  for(uint32_t i = 0; i < _event_configure_queue.len; i++)
+    {
+      unagi_window_t *window =
+        unagi_window_list_get(_event_configure_queue.ids[i]);
+
+      if(!window || !window->configure.is_pending)
+        continue;
+
+      window->configure.is_pending = false;
+
+      if(!unagi_window_is_visible(window))
+        continue;
+
+      /* Its Region and Pixmap will be acquired at the new geometry */
+      if(window->is_acquire_pending)
+        {
+          unagi_display_add_damaged_window(window, false);
+          continue;
+        }
+
+      if(window->region)
+        xcb_xfixes_destroy_region(globalconf.connection, window->region);
+
+      window->region = unagi_window_get_region(window, true, true);
+
+      /* This is needed to ensure that a window that was mapped
+         outside the screen, and moved inside after, will be shown. An
+         example is the gnome panel */
+      if(window->configure.was_not_visible || window->pixmap == XCB_NONE)
+        {
+          unagi_window_free_pixmap(window);
+          window->pixmap = unagi_window_get_pixmap(window);
+          unagi_window_stack_update(window);
+        }
+      else if(window->configure.update_pixmap)
+        event_defer_resized_pixmap(window);
+
+      /* Whatever happens (restack/resizing/moving Windows), this
+         should be added to damaged area... */
+      unagi_display_add_damaged_window(window, false);
+      window->damaged_ratio = 1.0;
+    }
+
+  _event_configure_queue.len = 0;
+}
+
+/** Acquire the Region and Pixmap of  the windows mapped since the last
+ *  repaint and still visible.  This is called right before painting,
+ *  so that the windows unmapped in the meantime, for example when
+ *  switching workspaces, cost nothing
+ *
+ * \return The time of the first MapNotify, or 0 if no window was mapped
+ */
+ev_tstamp
+unagi_event_flush_map_notify(void)
+{
+  ev_tstamp map_time = 0;
+  uint32_t acquired_len = 0;
+
+  for(uint32_t i = 0; i < _event_map_queue.len; i++)
+    {
+      unagi_window_t *window = unagi_window_list_get(_event_map_queue.ids[i]);
+      if(!window || !window->is_acquire_pending)
+        continue;
+
+      /* Moved outside the screen meanwhile,  it will be acquired when
+         configured within the screen again */
+      if(!unagi_window_is_visible(window))
+        {
+          window->is_acquire_pending = false;
+          continue;
+        }
+
+      unagi_window_acquire(window);
+      map_time = _event_map_start_time;
+      acquired_len++;
+    }
+
+  if(_event_map_queue.len)
+    unagi_debug("Acquired %u windows out of %u mapped", acquired_len,
+                _event_map_queue.len);
+
+  _event_map_queue.len = 0;
+  return map_time;
+}
+
 /** Handler for ConfigureNotify events reported when a windows changes
  *  its size, position and/or position in the stack
  *
@@ -449,6 +1069,7 @@ event_handle_configure_notify(xcb_configure_notify_event_t *event)
 
       globalconf.background_reset = true;
       (*globalconf.rendering->reset_background)();
+      unagi_paint_schedule();
 
       return;
     }
@@ -460,26 +1081,32 @@ event_handle_configure_notify(xcb_configure_notify_event_t *event)
       return;
     }
 
-  /* Add the Window  Region to the damaged region  to clear old window
-     position or size and re-create the Window Region as well
-
-     @todo: Perhaps further checks  could be done to avoid re-creating
-            the Window Region but would it really change anything from
-            a performance POV?
-  */
-  bool is_not_visible = false;
-  if(unagi_window_is_visible(window))
-    {
-      unagi_display_add_damaged_region(&window->region, true);
-      window->damaged_ratio = 1.0;
-    }
+  /* Only the  first ConfigureNotify since the last repaint damages the
+     old window position or size, as the intermediate ones have never
+     been painted.   The Window Region and Pixmap are only re-created
+     by unagi_event_flush_configure_notify() right before painting,
+     once all the ConfigureNotify of the frame have been handled */
+  if(window->configure.is_pending)
+    _event_stats.configure_coalesced++;
   else
-    is_not_visible = true;
+    {
+      if(!event_window_queue_push(&_event_configure_queue, window->id))
+        unagi_fatal("Cannot allocate memory for ConfigureNotify");
 
-  window->geometry->x = event->x;
-  window->geometry->y = event->y;
+      window->configure.is_pending = true;
+      window->configure.update_pixmap = false;
 
-  bool update_pixmap = false;
+      /* Add the Window Region to the damaged region to clear old window
+         position or size */
+      if(unagi_window_is_visible(window))
+        {
+          unagi_display_add_damaged_window(window, true);
+          window->damaged_ratio = 1.0;
+          window->configure.was_not_visible = false;
+        }
+      else
+        window->configure.was_not_visible = true;
+    }
 
   /* Invalidate  Pixmap and  Picture if  the window  has  been resized
      because  a  new  pixmap  is  allocated everytime  the  window  is
@@ -488,30 +1115,36 @@ event_handle_configure_notify(xcb_configure_notify_event_t *event)
      (window->geometry->width != event->width ||
       window->geometry->height != event->height ||
       window->geometry->border_width != event->border_width))
-    update_pixmap = true;
+    {
+      /* Remember the size of the Pixmap currently held, which is
+         painted until the new one is acquired */
+      if(!window->configure.update_pixmap && !window->resize.is_pending)
+        {
+          window->resize.width = (uint16_t) window_width_with_border(window->geometry);
+          window->resize.height = (uint16_t) window_height_with_border(window->geometry);
+        }
+
+      window->configure.update_pixmap = true;
+    }
 
+  window->geometry->x = event->x;
+  window->geometry->y = event->y;
   window->geometry->width = event->width;
   window->geometry->height = event->height;
   window->geometry->border_width = event->border_width;
   window->attributes->override_redirect = event->override_redirect;
+  unagi_window_stack_update(window);
 
+  /* Make sure the new position will be painted */
   if(unagi_window_is_visible(window))
     {
-      window->region = unagi_window_get_region(window, true, false);
-
-      /* This is needed to ensure that a window that was mapped
-         outside the screen, and moved inside after, will be shown. An
-         example is the gnome panel */
-      if(update_pixmap || is_not_visible)
-        {
-          unagi_window_free_pixmap(window);
-          window->pixmap = unagi_window_get_pixmap(window);
-        }
+      const unagi_region_box_t box = {
+        window->geometry->x, window->geometry->y,
+        window->geometry->x + window_width_with_border(window->geometry),
+        window->geometry->y + window_height_with_border(window->geometry)
+      };
 
-      /* Whatever happens (restack/resizing/moving Windows), this
-         should be added to damaged area... */
-      unagi_display_add_damaged_region(&window->region, false);
-      window->damaged_ratio = 1.0;
+      unagi_paint_schedule_box(&box);
     }
 
   unagi_window_restack(window, event->above_sibling);
@@ -535,24 +1168,29 @@ event_handle_create_notify(xcb_create_notify_event_t *event)
               (intmax_t) event->x, (intmax_t) event->y,
               (uintmax_t) event->border_width);
 
+  /* No need  to do  a GetGeometry request  as the window  geometry is
+     given in the CreateNotify event itself */
+  const xcb_get_geometry_reply_t geometry = {
+    .x = event->x,
+    .y = event->y,
+    .width = event->width,
+    .height = event->height,
+    .border_width = event->border_width
+  };
+
   /* Add  the  new window  whose  identifier  is  given in  the  event
-     itself and  */
-  unagi_window_t *new_window = window_add(event->window, false);
+     itself, without waiting for its attributes which are only needed
+     once it is mapped, as many windows may be created in a row (e.g.
+     menus and tooltips) */
+  unagi_window_t *new_window = unagi_window_add_created(event->window,
+                                                        &geometry,
+                                                        event->override_redirect);
   if(!new_window)
     {
       unagi_debug("Cannot create window %jx", (uintmax_t) event->window);
       return;
     }
 
-  /* No need  to do  a GetGeometry request  as the window  geometry is
-     given in the CreateNotify event itself */
-  new_window->geometry = calloc(1, sizeof(xcb_get_geometry_reply_t));
-  new_window->geometry->x = event->x;
-  new_window->geometry->y = event->y;
-  new_window->geometry->width = event->width;
-  new_window->geometry->height = event->height;
-  new_window->geometry->border_width = event->border_width;
-
   UNAGI_PLUGINS_EVENT_HANDLE(event, create, new_window);
 }
 
@@ -601,22 +1239,38 @@ event_handle_map_notify(xcb_map_notify_event_t *event)
       return;
     }
 
+  /* The attributes of a window added upon CreateNotify are needed from
+     now on, the reply has most likely already been received though */
+  if(!unagi_window_setup_finalise(window))
+    return;
+
   window->attributes->map_state = XCB_MAP_STATE_VIEWABLE;
+  unagi_window_stack_insert(window);
 
   if(unagi_window_is_visible(window))
     {
-      /* Create and store the region associated with the window to
-         avoid creating regions all the time, this Region will be
-         destroyed only upon DestroyNotify or re-created upon
-         ConfigureNotify */
-      window->region = unagi_window_get_region(window, true, true);
+      /* The Region and Pixmap are only acquired right before painting,
+         by unagi_event_flush_map_notify(), as many windows may be
+         mapped and unmapped again meanwhile */
+      if(!window->is_acquire_pending)
+        {
+          if(!_event_map_queue.len)
+            _event_map_start_time = ev_time();
+
+          if(!event_window_queue_push(&_event_map_queue, window->id))
+            unagi_fatal("Cannot allocate memory for MapNotify");
+
+          window->is_acquire_pending = true;
+        }
 
-      /* Everytime a window is mapped, a new pixmap is created */
-      unagi_window_free_pixmap(window);
-      window->pixmap = unagi_window_get_pixmap(window);
+      /* PropertyNotify events are not received while the window is
+         unmapped */
+      unagi_window_register_notify(window);
     }
 
   window->damaged = false;
+  window->damage_rate.is_pending = false;
+  unagi_window_stack_update(window);
 
   UNAGI_PLUGINS_EVENT_HANDLE(event, map, window);
 }
@@ -666,17 +1320,24 @@ event_handle_unmap_notify(xcb_unmap_notify_event_t *event)
       return;
     }
 
-  if(unagi_window_is_visible(window))
+  /* Nothing has to be repainted if the window has been mapped and
+     unmapped again before being painted */
+  if(window->is_acquire_pending)
     {
-      unagi_display_add_damaged_region(&window->region, true);
-      window->damaged_ratio = 1.0;
+      window->is_acquire_pending = false;
+      _event_stats.map_discarded++;
     }
+  else if(unagi_window_is_visible(window))
+    unagi_display_add_damaged_window(window, true);
 
   /* Update window state */
   window->attributes->map_state = XCB_MAP_STATE_UNMAPPED;
+  unagi_window_stack_remove(window);
 
-  /* The window is not damaged anymore as it is not visible */
+  /* The window is not damaged anymore as it is not visible, and it is
+     not walked through when painting until it is mapped again */
   window->damaged = false;
+  unagi_window_discard_damage(window);
 
   UNAGI_PLUGINS_EVENT_HANDLE(event, unmap, window);
 }
@@ -699,6 +1360,7 @@ event_handle_property_notify(xcb_property_notify_event_t *event)
       unagi_debug("New background Pixmap set");
       globalconf.background_reset = true;
       (*globalconf.rendering->reset_background)();
+      unagi_paint_schedule();
     }
 
   /* Update _NET_SUPPORTED value */
@@ -709,6 +1371,39 @@ event_handle_property_notify(xcb_property_notify_event_t *event)
      meet the requirements on startup, it can try again... */
   unagi_window_t *window = unagi_window_list_get(event->window);
 
+  /* Whether the window may be unredirected may have changed, these
+     properties are set on the client window which is not managed when
+     it has been reparented by the window manager */
+  if(event->atom == globalconf.ewmh._NET_WM_STATE ||
+     event->atom == UNAGI__NET_WM_BYPASS_COMPOSITOR)
+    {
+      unagi_window_t *client_window =
+        window ? window : unagi_window_get_by_client(event->window);
+
+      if(client_window)
+        {
+          unagi_window_update_unredirect_hints(client_window, event->atom);
+          unagi_paint_schedule();
+        }
+    }
+
+  /* The opaque part of an ARGB window has changed, repaint it whole as
+     the windows below may have been culled */
+  if(window && event->atom == UNAGI__NET_WM_OPAQUE_REGION)
+    {
+      unagi_window_update_opaque_region(window);
+
+      if(unagi_window_is_visible(window))
+        {
+          unagi_display_add_damaged_window(window, false);
+          window->damaged_ratio = 1.0;
+        }
+    }
+
+  /* The maximum damage rate may depend on WM_CLASS */
+  if(window && event->atom == XCB_ATOM_WM_CLASS)
+    unagi_window_update_damage_rate_max(window);
+
   for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
     if(plugin->vtable->events.property)
       {
@@ -746,6 +1441,27 @@ event_handle_mapping_notify(xcb_mapping_notify_event_t *event)
   UNAGI_PLUGINS_EVENT_HANDLE(event, mapping, NULL);
 }
 
+#ifdef HAVE_XCB_PRESENT
+/** Handler for  Present CompleteNotify  event, sent  at the VBlank
+ *  following a NotifyMSC request,  which gives the painting scheduler
+ *  the actual VBlank timestamp
+ *
+ * \param event The X Present CompleteNotify event
+ */
+static void
+event_handle_present_complete_notify(xcb_present_complete_notify_event_t *event)
+{
+  if(event->kind != XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC)
+    return;
+
+  unagi_debug("Present CompleteNotify: serial=%ju, msc=%ju, ust=%ju",
+              (uintmax_t) event->serial, (uintmax_t) event->msc,
+              (uintmax_t) event->ust);
+
+  unagi_paint_vblank(event->ust, event->msc);
+}
+#endif
+
 /** Initialise errors and events handlers
  *
  * \see unagi_display_init_redirect
@@ -773,6 +1489,26 @@ unagi_event_handle(xcb_generic_event_t *event)
       event_handle_randr_screen_change_notify((void *) event);
       return;
     }
+  else if(globalconf.extensions.shape &&
+          response_type == (globalconf.extensions.shape->first_event +
+                            XCB_SHAPE_NOTIFY))
+    {
+      event_handle_shape_notify((void *) event);
+      return;
+    }
+  else if(response_type == XCB_GE_GENERIC)
+    {
+#ifdef HAVE_XCB_PRESENT
+      const xcb_ge_generic_event_t *ge_event = (void *) event;
+
+      if(globalconf.extensions.present &&
+         ge_event->extension == globalconf.extensions.present->major_opcode &&
+         ge_event->event_type == XCB_PRESENT_COMPLETE_NOTIFY)
+        event_handle_present_complete_notify((void *) event);
+#endif
+
+      return;
+    }
 
   switch(response_type)
     {
@@ -794,6 +1530,292 @@ unagi_event_handle(xcb_generic_event_t *event)
     }
 }
 
+/** Get the class of the given event
+ *
+ * \param event The X event
+ * \return The event class
+ */
+static event_class_t
+event_get_class(xcb_generic_event_t *event)
+{
+  const uint8_t response_type = XCB_EVENT_RESPONSE_TYPE(event);
+
+  if(response_type &&
+     response_type == (globalconf.extensions.damage->first_event +
+                       XCB_DAMAGE_NOTIFY))
+    return EVENT_CLASS_DAMAGE;
+
+  switch(response_type)
+    {
+    case XCB_KEY_PRESS:
+    case XCB_KEY_RELEASE:
+    case XCB_BUTTON_PRESS:
+    case XCB_BUTTON_RELEASE:
+    case XCB_MOTION_NOTIFY:
+      return EVENT_CLASS_INPUT;
+    default:
+      return EVENT_CLASS_STRUCTURE;
+    }
+}
+
+/** Defer the given DamageNotify event
+ *
+ * \param event The X DamageNotify event
+ * \return false if it could not be deferred
+ */
+static bool
+event_damage_queue_push(xcb_damage_notify_event_t *event)
+{
+  if(_event_damage_queue.len == _event_damage_queue.size)
+    {
+      const uint32_t size = _event_damage_queue.size ?
+        _event_damage_queue.size * 2 : 64;
+
+      xcb_damage_notify_event_t **events =
+        realloc(_event_damage_queue.events,
+                size * sizeof(xcb_damage_notify_event_t *));
+
+      if(!events)
+        return false;
+
+      _event_damage_queue.events = events;
+      _event_damage_queue.size = size;
+    }
+
+  _event_damage_queue.events[_event_damage_queue.len++] = event;
+  return true;
+}
+
+/** Merge the given DamageNotify events so that only one is left per
+ *  damaged drawable, its area being the bounding box of all the areas
+ *  of this drawable
+ *
+ * \param events The DamageNotify events
+ * \param events_len The number of events
+ * \return The number of events left at the beginning of the array
+ */
+static uint32_t
+event_damage_coalesce(xcb_damage_notify_event_t **events,
+                      const uint32_t events_len)
+{
+  uint32_t coalesced_len = 0;
+
+  for(uint32_t i = 0; i < events_len; i++)
+    {
+      xcb_damage_notify_event_t *event = events[i];
+
+      uint32_t j;
+      for(j = 0; j < coalesced_len; j++)
+        if(events[j]->drawable == event->drawable)
+          break;
+
+      if(j == coalesced_len)
+        {
+          events[coalesced_len++] = event;
+          continue;
+        }
+
+      /* Keep the latest drawable geometry */
+      xcb_damage_notify_event_t *coalesced = events[j];
+      coalesced->geometry = event->geometry;
+
+      const int32_t x1 = min(coalesced->area.x, event->area.x);
+      const int32_t y1 = min(coalesced->area.y, event->area.y);
+      const int32_t x2 = max(coalesced->area.x + coalesced->area.width,
+                             event->area.x + event->area.width);
+      const int32_t y2 = max(coalesced->area.y + coalesced->area.height,
+                             event->area.y + event->area.height);
+
+      coalesced->area = (xcb_rectangle_t) {
+        (int16_t) x1, (int16_t) y1, (uint16_t) (x2 - x1), (uint16_t) (y2 - y1)
+      };
+
+      free(event);
+    }
+
+  _event_stats.coalesced += events_len - coalesced_len;
+  return coalesced_len;
+}
+
+/** Report the events handling statistics once per second at most */
+static void
+event_report_stats(void)
+{
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+  const ev_tstamp elapsed = now - _event_stats.start_time;
+
+  if(!_event_stats.start_time)
+    {
+      _event_stats.start_time = now;
+      return;
+    }
+  else if(elapsed < 1.0)
+    return;
+
+  _event_stats_rates.damage_notify_discarded =
+    (double) _event_stats.discarded / elapsed;
+  _event_stats_rates.configure_notify_coalesced =
+    (double) _event_stats.configure_coalesced / elapsed;
+  _event_stats_rates.windows_unmapped_before_paint =
+    (double) _event_stats.map_discarded / elapsed;
+
+  for(event_class_t class = 0; class < EVENT_CLASS_LEN; class++)
+    if(_event_stats.count[class])
+      unagi_debug("Events: %s: %.2f/s, %.6fs/s (%.6fs per event)",
+                  event_class_label[class],
+                  (double) _event_stats.count[class] / elapsed,
+                  _event_stats.time[class] / elapsed,
+                  _event_stats.time[class] / _event_stats.count[class]);
+
+  if(_event_stats.coalesced)
+    unagi_debug("Events: %.2f DamageNotify/s coalesced",
+                (double) _event_stats.coalesced / elapsed);
+
+  if(_event_stats.discarded)
+    unagi_debug("Events: %.2f DamageNotify/s discarded (fully damaged windows)",
+                _event_stats_rates.damage_notify_discarded);
+
+  if(_event_stats.configure_coalesced)
+    unagi_debug("Events: %.2f ConfigureNotify/s coalesced",
+                _event_stats_rates.configure_notify_coalesced);
+
+  if(_event_stats.map_discarded)
+    unagi_debug("Events: %.2f windows/s unmapped before being painted",
+                _event_stats_rates.windows_unmapped_before_paint);
+
+  memset(&_event_stats, 0, sizeof(_event_stats));
+  _event_stats.start_time = now;
+}
+
+/** Get the events statistics over the last reporting period
+ *
+ * \return The events statistics, per second
+ */
+const unagi_event_stats_t *
+unagi_event_get_stats(void)
+{
+  return &_event_stats_rates;
+}
+
+/** Handle the events received  within the given time budget.  Input
+ *  and structure events are handled as soon as they are received (in
+ *  order) whereas DamageNotify are deferred until there is no more
+ *  event to read.  Once the time budget is exhausted, the connection is
+ *  not read anymore and the DamageNotify left are merged per drawable
+ *  before being handled, so that a damage storm cannot delay input and
+ *  windows changes or the next repaint
+ *
+ * \param start_time When events handling started
+ * \param budget The time budget in seconds
+ */
+void
+unagi_event_handle_budgeted(const ev_tstamp start_time, const double budget)
+{
+  const ev_tstamp end_time = start_time + budget;
+  bool is_over_budget = false;
+  unsigned int events_counter = 0;
+
+  event_class_t current_class = EVENT_CLASS_LEN;
+  ev_tstamp class_start_time = start_time;
+
+  xcb_generic_event_t *event;
+  while((event = (is_over_budget ?
+                  xcb_poll_for_queued_event(globalconf.connection) :
+                  xcb_poll_for_event(globalconf.connection))))
+    {
+      const event_class_t class = event_get_class(event);
+      _event_stats.count[class]++;
+
+      if(class != EVENT_CLASS_DAMAGE ||
+         !event_damage_queue_push((void *) event))
+        {
+          /* Only measure the time when the class changes */
+          if(class != current_class)
+            {
+              const ev_tstamp now = ev_time();
+              if(current_class != EVENT_CLASS_LEN)
+                _event_stats.time[current_class] += now - class_start_time;
+
+              current_class = class;
+              class_start_time = now;
+            }
+
+          unagi_event_handle(event);
+          free(event);
+        }
+
+      if(!is_over_budget &&
+         ++events_counter % EVENT_BUDGET_CHECK_INTERVAL == 0 &&
+         ev_time() > end_time)
+        {
+          unagi_debug("Events handling budget exhausted, not reading "
+                      "the X connection anymore");
+          is_over_budget = true;
+        }
+    }
+
+  ev_tstamp now = ev_time();
+  if(current_class != EVENT_CLASS_LEN)
+    _event_stats.time[current_class] += now - class_start_time;
+
+  /* Now handle the deferred DamageNotify */
+  const ev_tstamp damage_start_time = now;
+  uint32_t i;
+  for(i = 0; i < _event_damage_queue.len; i++)
+    {
+      if(i % EVENT_BUDGET_CHECK_INTERVAL == 0 && i && ev_time() > end_time)
+        break;
+
+      unagi_event_handle((void *) _event_damage_queue.events[i]);
+      free(_event_damage_queue.events[i]);
+    }
+
+  if(i < _event_damage_queue.len)
+    {
+      const uint32_t coalesced_len =
+        event_damage_coalesce(_event_damage_queue.events + i,
+                              _event_damage_queue.len - i);
+
+      for(uint32_t j = i; j < i + coalesced_len; j++)
+        {
+          unagi_event_handle((void *) _event_damage_queue.events[j]);
+          free(_event_damage_queue.events[j]);
+        }
+    }
+
+  if(_event_damage_queue.len)
+    _event_stats.time[EVENT_CLASS_DAMAGE] += ev_time() - damage_start_time;
+
+  _event_damage_queue.len = 0;
+
+  event_report_stats();
+}
+
+/** Free the resources used for events handling */
+void
+unagi_event_cleanup(void)
+{
+  ev_timer_stop(globalconf.event_loop, &_event_damage_throttle_timer);
+  ev_timer_stop(globalconf.event_loop, &_event_resize_settle_timer);
+
+  event_window_queue_free(&_event_configure_queue);
+  event_window_queue_free(&_event_map_queue);
+  event_window_queue_free(&_event_damage_throttle_queue);
+  event_window_queue_free(&_event_resize_settle_queue);
+
+  if(_event_damage_saturate_region)
+    {
+      xcb_xfixes_destroy_region(globalconf.connection,
+                                _event_damage_saturate_region);
+
+      _event_damage_saturate_region = XCB_NONE;
+    }
+
+  unagi_util_free(&_event_damage_queue.events);
+  _event_damage_queue.size = 0;
+  _event_damage_queue.len = 0;
+}
+
 /** Handle all events in the queue
  *
  * \param event_handler The event handler function to call for each event
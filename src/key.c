@@ -27,6 +27,7 @@
 #include <string.h>
 
 #include "key.h"
+#include "display.h"
 #include "structs.h"
 
 /** Set  the  keyboard  masks  from  a  previously  GetModifierMapping
@@ -45,6 +46,7 @@ unagi_key_lock_mask_get_reply(xcb_get_modifier_mapping_cookie_t cookie)
   xcb_keycode_t *capslockcodes = xcb_key_symbols_get_keycode(globalconf.keysyms, XK_Caps_Lock);
   xcb_keycode_t *modeswitchcodes = xcb_key_symbols_get_keycode(globalconf.keysyms, XK_Mode_switch);
 
+  unagi_display_round_trip(cookie.sequence);
   modmap_r = xcb_get_modifier_mapping_reply(globalconf.connection, cookie, NULL);
   modmap = xcb_get_modifier_mapping_keycodes(modmap_r);
 
@@ -0,0 +1,1001 @@
+/* -*-mode:c;coding:utf-8; c-basic-offset:2;fill-column:70;c-file-style:"gnu"-*-
+ *
+ * Copyright (C) 2009 Arnaud "arnau" Fontaine <arnau@mini-dweeb.org>
+ *
+ * This  program is  free  software: you  can  redistribute it  and/or
+ * modify  it under the  terms of  the GNU  General Public  License as
+ * published by the Free Software  Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have  received a copy of the  GNU General Public License
+ *  along      with      this      program.      If      not,      see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ *  \brief Painting scheduler
+ *
+ *  The  paint timer  watcher  is only  running  while there  is
+ *  something to paint: it is stopped (parked) as soon as nothing has
+ *  been damaged since  the last repaint and started  again when a
+ *  Region is  damaged or a  repaint is forced.  This  avoids waking
+ *  up at the screen refresh rate when the screen does not change.
+ *
+ *  Repaints are paced  against refresh deadlines spaced by the screen
+ *  refresh interval: the cost of a repaint is predicted from the last
+ *  repaints  of  the  same  type  (forced  or  partial),  using  the
+ *  maximum  of an  exponentially weighted  moving average  and of a
+ *  high percentile over a sliding window, and the repaint starts as
+ *  late as possible to  be done  before the next deadline.  When the
+ *  predicted cost  keeps exceeding  the frame budget,  only one out
+ *  of 'divisor' deadlines is targeted (e.g. 30Hz on a 60Hz screen),
+ *  and the divisor is only decreased again once the repaints have
+ *  been cheap enough for a while, so that it does not oscillate.
+ *
+ *  Each CRTC  has its own refresh clock, with  the refresh interval of
+ *  its RandR mode: a damage only schedules the clocks of the CRTCs it
+ *  intersects and, when a  repaint is due, only the share of the
+ *  damaged Region within the  CRTCs whose deadline is reached is
+ *  painted, the rest being kept for the other clocks.  Thus, a damage
+ *  on a 60Hz monitor never triggers repaints at the rate of a 144Hz
+ *  monitor next to it.
+ *
+ *  When VSync  with Present is enabled, the refresh  deadlines of the
+ *  CRTC whose  VBlanks are  reported for the  root window (the  one
+ *  covering most of the screen) are the actual VBlanks: a NotifyMSC
+ *  request is sent after each repaint and the UST timestamp of the
+ *  resulting CompleteNotify event gives the phase (and the interval)
+ *  of its refresh deadlines.
+ *
+ *  A repaint is not waited for: once all the  requests have been sent,
+ *  a GetInputFocus  request is  sent  as a  sentinel  and its  reply,
+ *  collected  later by  the events loop,  tells  that the  X server
+ *  has processed the whole  frame.  The cost of  a repaint is thus
+ *  made of  the time spent by unagi  to  send the requests (client
+ *  time) and of the time spent by the X server (server time).  Only one
+ *  frame is in flight at once, a repaint due before the completion of
+ *  the previous frame is done upon its completion.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xfixes.h>
+
+#include "structs.h"
+#include "paint.h"
+#include "display.h"
+#include "window.h"
+#include "plugin.h"
+#include "event.h"
+#include "util.h"
+
+/** Number of repaints kept to compute the cost percentile */
+#define _PAINT_COST_WINDOW_LEN 64
+
+/** Weight given to the last repaint cost in the moving average */
+#define _PAINT_COST_EWMA_WEIGHT 0.125
+
+/** Percentile of the repaint costs used as the pessimistic estimate */
+#define _PAINT_COST_PERCENTILE 0.95
+
+/** Time added to the predicted cost to absorb scheduling latency */
+#define _PAINT_COST_MARGIN 0.001
+
+/** Maximum refresh rate divisor when overloaded */
+#define _PAINT_DIVISOR_MAX 4
+
+/** Part of the frame budget above which a repaint is overloaded */
+#define _PAINT_OVERLOAD_RATIO 0.9
+
+/** Part of the frame budget of the next lower divisor below which a
+    repaint is cheap enough to decrease the divisor */
+#define _PAINT_UNDERLOAD_RATIO 0.6
+
+/** Number of consecutive overloaded repaints before increasing the
+    divisor */
+#define _PAINT_OVERLOAD_STREAK 8
+
+/** Number of consecutive cheap repaints before decreasing the divisor */
+#define _PAINT_UNDERLOAD_STREAK 60
+
+/** Weight given to the last measured VBlank interval */
+#define _PAINT_VBLANK_INTERVAL_WEIGHT 0.125
+
+/** A clock is due when its repaint should start within this time, so
+    that clocks in phase are painted together */
+#define _PAINT_CLOCK_DUE_TOLERANCE 0.0005
+
+/** Type of repaint, their costs are estimated separately */
+typedef enum
+{
+  /** Only the damaged Region is repainted */
+  _PAINT_TYPE_PARTIAL = 0,
+  /** The whole screen is repainted */
+  _PAINT_TYPE_FORCED,
+  _PAINT_TYPE_LEN
+} _paint_type_t;
+
+/** Repaint cost estimator */
+typedef struct
+{
+  /** Exponentially weighted moving average */
+  double ewma;
+  /** Costs of the last repaints (circular buffer) */
+  double window[_PAINT_COST_WINDOW_LEN];
+  /** Number of costs stored in the window */
+  unsigned int window_len;
+  /** Index where the next cost will be stored */
+  unsigned int window_next;
+  /** Percentile of the costs stored in the window */
+  double percentile;
+} _paint_cost_t;
+
+/** Refresh clock of a CRTC */
+typedef struct
+{
+  /** CRTC area on the screen */
+  unagi_region_box_t box;
+  /** Refresh interval of the CRTC mode */
+  double refresh_interval;
+  /** Whether a repaint of the CRTC area is scheduled */
+  bool is_scheduled;
+  /** Refresh deadline targeted by the scheduled repaint (0 if none) */
+  ev_tstamp deadline;
+  /** Refresh deadline targeted by the last repaint */
+  ev_tstamp last_deadline;
+  /** Whether the CRTC area is painted by the frame in flight */
+  bool is_in_frame;
+  /** Only one refresh deadline out of divisor is targeted */
+  unsigned int divisor;
+  /** Number of consecutive overloaded repaints */
+  unsigned int overload_streak;
+  /** Number of consecutive cheap repaints */
+  unsigned int underload_streak;
+} _paint_clock_t;
+
+/** Painting scheduler state */
+static struct
+{
+  /** Whether the paint timer watcher has been initialised */
+  bool initialised;
+  /** One refresh clock per CRTC */
+  _paint_clock_t *clocks;
+  /** Number of refresh clocks */
+  unsigned int clocks_len;
+  /** Refresh clock whose VBlanks are reported by Present */
+  _paint_clock_t *vblank_clock;
+  /** Time of the last VBlank reported by Present (0 if none) */
+  ev_tstamp vblank_time;
+  /** MSC of the last VBlank reported by Present */
+  uint64_t vblank_msc;
+  /** Interval between VBlanks measured from Present timestamps */
+  double vblank_interval;
+  /** Whether a NotifyMSC request has been sent without CompleteNotify */
+  bool vblank_pending;
+  /** Frame sent to the X server and not completed yet */
+  struct
+  {
+    /** Whether the frame has not been completed yet */
+    bool pending;
+    /** Sentinel request cookie */
+    xcb_get_input_focus_cookie_t cookie;
+    /** Repaint type */
+    _paint_type_t type;
+    /** Time of the beginning of the repaint */
+    ev_tstamp start_time;
+    /** Time spent sending the requests */
+    double client_time;
+    /** Earliest refresh deadline targeted */
+    ev_tstamp deadline;
+    /** Whether a repaint has been deferred until completion */
+    bool paint_deferred;
+    /** Number of requests sent for this frame */
+    unsigned int requests;
+    /** Time of the first MapNotify of the windows shown by this frame */
+    ev_tstamp map_time;
+  } frame;
+  /** Time of the first MapNotify of the windows not shown yet */
+  ev_tstamp map_time;
+  /** Time between the first MapNotify and the completion of the frame
+      showing the mapped windows, for the last such frame */
+  double map_latency;
+  /** Sequence number of the sentinel request of the previous frame */
+  unsigned int last_sentinel_sequence;
+  /** Repaint cost estimators, one per repaint type */
+  _paint_cost_t costs[_PAINT_TYPE_LEN];
+  /** Number of repaints */
+  unsigned int paint_counter;
+  /** Number of repaints which missed their deadline */
+  unsigned int missed_deadlines;
+  /** Start of the current wakeups reporting period */
+  ev_tstamp report_start_time;
+  /** Number of times the paint timer fired during the reporting period */
+  unsigned int wakeups;
+  /** Number of times it fired without anything to paint */
+  unsigned int idle_wakeups;
+} _paint_global;
+
+/** Check whether a repaint is required
+ *
+ * \return true if the screen has to be repainted
+ */
+static bool
+_paint_is_needed(void)
+{
+  return (unagi_display_is_damaged() || globalconf.force_repaint ||
+          globalconf.background_reset);
+}
+
+/** Check whether an activated plugin relies on pre_paint being called
+ *  periodically  (this is  the case when  a  plugin with a  pre_paint
+ *  hook is activated, as such  plugin may want to damage windows from
+ *  this hook, e.g. Expose)
+ *
+ * \return true if the paint timer watcher must keep running
+ */
+static bool
+_paint_plugin_needs_timer(void)
+{
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+    if(plugin->enable && plugin->vtable->activated && plugin->vtable->pre_paint)
+      return true;
+
+  return false;
+}
+
+/** Get the interval between two refresh deadlines of the given clock,
+ *  measured from the VBlank timestamps if available
+ *
+ * \param clock The refresh clock
+ * \return The refresh interval in seconds
+ */
+static inline double
+_paint_clock_get_refresh_interval(const _paint_clock_t *clock)
+{
+  return (clock == _paint_global.vblank_clock &&
+          _paint_global.vblank_interval > 0) ?
+    _paint_global.vblank_interval : clock->refresh_interval;
+}
+
+/** Ask for the next VBlank timestamp if VSync with Present is enabled
+ *  and there is no request pending
+ */
+static void
+_paint_request_vblank(void)
+{
+#ifdef HAVE_XCB_PRESENT
+  if(!globalconf.extensions.present || _paint_global.vblank_pending)
+    return;
+
+  display_vsync_present_notify_msc();
+  xcb_flush(globalconf.connection);
+  _paint_global.vblank_pending = true;
+#endif
+}
+
+/** Compare two repaint costs, used by qsort() */
+static int
+_paint_cost_cmp(const void *a, const void *b)
+{
+  const double cost_a = *(const double *) a;
+  const double cost_b = *(const double *) b;
+
+  return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+/** Add the cost of a repaint to the given estimator
+ *
+ * \param cost The repaint cost estimator
+ * \param paint_time The time spent repainting in seconds
+ */
+static void
+_paint_cost_add(_paint_cost_t *cost, const double paint_time)
+{
+  if(!cost->window_len)
+    cost->ewma = paint_time;
+  else
+    cost->ewma += _PAINT_COST_EWMA_WEIGHT * (paint_time - cost->ewma);
+
+  cost->window[cost->window_next] = paint_time;
+  cost->window_next = (cost->window_next + 1) % _PAINT_COST_WINDOW_LEN;
+  if(cost->window_len < _PAINT_COST_WINDOW_LEN)
+    cost->window_len++;
+
+  double sorted[_PAINT_COST_WINDOW_LEN];
+  memcpy(sorted, cost->window, sizeof(double) * cost->window_len);
+  qsort(sorted, cost->window_len, sizeof(double), _paint_cost_cmp);
+
+  cost->percentile = sorted[(unsigned int)
+                            (_PAINT_COST_PERCENTILE * (cost->window_len - 1))];
+}
+
+/** Predict the cost of the next repaint of the given type
+ *
+ * \param type The repaint type
+ * \return The predicted time in seconds
+ */
+static double
+_paint_cost_predict(const _paint_type_t type)
+{
+  const _paint_cost_t *cost = &_paint_global.costs[type];
+
+  /* Without any forced repaint so far, a forced repaint costs at least
+     as much as a partial one */
+  if(!cost->window_len && type != _PAINT_TYPE_PARTIAL)
+    cost = &_paint_global.costs[_PAINT_TYPE_PARTIAL];
+
+  return max(cost->ewma, cost->percentile) + _PAINT_COST_MARGIN;
+}
+
+/** Get the type of the next repaint
+ *
+ * \return The repaint type
+ */
+static inline _paint_type_t
+_paint_get_type(void)
+{
+  return (globalconf.force_repaint || globalconf.background_reset) ?
+    _PAINT_TYPE_FORCED : _PAINT_TYPE_PARTIAL;
+}
+
+/** Update the  refresh rate divisor  of the  given clock according
+ *  to the predicted cost of the repaints of the given type
+ *
+ * \param clock The refresh clock
+ * \param type The type of the repaint which has just been done
+ */
+static void
+_paint_clock_update_divisor(_paint_clock_t *clock, const _paint_type_t type)
+{
+  const double refresh_interval = _paint_clock_get_refresh_interval(clock);
+  const double predicted_cost = _paint_cost_predict(type);
+
+  if(predicted_cost > refresh_interval * clock->divisor *
+     _PAINT_OVERLOAD_RATIO)
+    {
+      clock->underload_streak = 0;
+
+      if(++clock->overload_streak >= _PAINT_OVERLOAD_STREAK &&
+         clock->divisor < _PAINT_DIVISOR_MAX)
+        {
+          clock->divisor++;
+          clock->overload_streak = 0;
+
+          unagi_debug("CRTC %jd+%jd overloaded (predicted cost: %.6fs): "
+                      "painting at 1/%u of the refresh rate",
+                      (intmax_t) clock->box.x1, (intmax_t) clock->box.y1,
+                      predicted_cost, clock->divisor);
+        }
+    }
+  else if(clock->divisor > 1 &&
+          predicted_cost < refresh_interval * (clock->divisor - 1) *
+          _PAINT_UNDERLOAD_RATIO)
+    {
+      clock->overload_streak = 0;
+
+      if(++clock->underload_streak >= _PAINT_UNDERLOAD_STREAK)
+        {
+          clock->divisor--;
+          clock->underload_streak = 0;
+
+          unagi_debug("CRTC %jd+%jd not overloaded anymore (predicted cost: "
+                      "%.6fs): painting at 1/%u of the refresh rate",
+                      (intmax_t) clock->box.x1, (intmax_t) clock->box.y1,
+                      predicted_cost, clock->divisor);
+        }
+    }
+  else
+    {
+      clock->overload_streak = 0;
+      clock->underload_streak = 0;
+    }
+}
+
+/** Set the repaint interval (used as the events processing budget) to
+ *  the shortest interval between two repaints of all the clocks
+ */
+static void
+_paint_update_repaint_interval(void)
+{
+  double repaint_interval = 0;
+
+  for(_paint_clock_t *clock = _paint_global.clocks;
+      clock - _paint_global.clocks < _paint_global.clocks_len;
+      clock++)
+    {
+      const double interval = _paint_clock_get_refresh_interval(clock) *
+        clock->divisor;
+
+      if(!repaint_interval || interval < repaint_interval)
+        repaint_interval = interval;
+    }
+
+  globalconf.repaint_interval = repaint_interval > 0 ?
+    (float) repaint_interval : globalconf.refresh_rate_interval;
+}
+
+/** Compute the refresh deadline of the given clock, so that the repaint
+ *  is done just in time for the next reachable deadline.  Right after a
+ *  repaint, only one deadline out of divisor is considered whereas after
+ *  an idle period, the nearest deadline is targeted
+ *
+ * \param clock The refresh clock
+ * \param now The current time
+ * \param predicted_cost The predicted cost of the repaint
+ */
+static void
+_paint_clock_set_deadline(_paint_clock_t *clock, const ev_tstamp now,
+                          const double predicted_cost)
+{
+  const double refresh_interval = _paint_clock_get_refresh_interval(clock);
+
+  ev_tstamp target = now + predicted_cost;
+  if(clock->last_deadline > 0)
+    target = max(target, clock->last_deadline +
+                 refresh_interval * (clock->divisor - 0.5));
+
+  /* The  refresh deadlines are  aligned on the last  VBlank if known,
+     otherwise on the previous deadline */
+  ev_tstamp anchor;
+  if(clock == _paint_global.vblank_clock && _paint_global.vblank_time > 0)
+    anchor = _paint_global.vblank_time;
+  else if(clock->last_deadline > 0)
+    anchor = clock->last_deadline;
+  else
+    anchor = target;
+
+  clock->deadline = anchor +
+    ceil((target - anchor) / refresh_interval) * refresh_interval;
+}
+
+/** Start the paint timer watcher so that the  next repaint is done just
+ *  in time for the earliest deadline of the scheduled clocks, or park it
+ *  if there is no scheduled clock
+ */
+static void
+_paint_arm(void)
+{
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+  const double predicted_cost = _paint_cost_predict(_paint_get_type());
+
+  ev_tstamp deadline = 0;
+  for(_paint_clock_t *clock = _paint_global.clocks;
+      clock - _paint_global.clocks < _paint_global.clocks_len;
+      clock++)
+    {
+      if(!clock->is_scheduled)
+        continue;
+
+      if(!clock->deadline)
+        _paint_clock_set_deadline(clock, now, predicted_cost);
+
+      if(!deadline || clock->deadline < deadline)
+        deadline = clock->deadline;
+    }
+
+  ev_timer_stop(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+
+  if(!deadline)
+    {
+      unagi_debug("Nothing to paint, stopping the paint timer");
+      return;
+    }
+
+  const ev_tstamp after = max(deadline - predicted_cost - now, 0.0);
+
+  unagi_debug("Next repaint in %.6fs (deadline in %.6fs, predicted cost: %.6fs)",
+              after, deadline - now, predicted_cost);
+
+  ev_timer_set(&globalconf.event_paint_timer_watcher, after, 0);
+  ev_timer_start(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+}
+
+/** Schedule a repaint on the clocks of the CRTCs intersecting the given
+ *  box
+ *
+ * \param box The screen area to repaint, NULL for the whole screen
+ * \return true if a clock was not already scheduled
+ */
+static bool
+_paint_schedule_clocks(const unagi_region_box_t *box)
+{
+  bool has_new_clock = false;
+
+  for(_paint_clock_t *clock = _paint_global.clocks;
+      clock - _paint_global.clocks < _paint_global.clocks_len;
+      clock++)
+    if(!clock->is_scheduled &&
+       (!box || (box->x1 < clock->box.x2 && box->x2 > clock->box.x1 &&
+                 box->y1 < clock->box.y2 && box->y2 > clock->box.y1)))
+      {
+        clock->is_scheduled = true;
+        has_new_clock = true;
+      }
+
+  return has_new_clock;
+}
+
+/** Account a  paint timer  wakeup and  report the number of  idle
+ *  wakeups per second (e.g. when there was nothing to paint) once per
+ *  second at most
+ *
+ * \param is_idle Whether there was nothing to paint
+ */
+static void
+_paint_report_wakeup(bool is_idle)
+{
+  if(is_idle)
+    {
+      _paint_global.idle_wakeups++;
+      return;
+    }
+
+  _paint_global.wakeups++;
+
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+  const ev_tstamp elapsed = now - _paint_global.report_start_time;
+  if(elapsed < 1.0)
+    return;
+
+  unagi_debug("Paint timer: %.2f wakeups/s, %.2f idle wakeups/s",
+              (double) _paint_global.wakeups / elapsed,
+              (double) _paint_global.idle_wakeups / elapsed);
+
+  _paint_global.report_start_time = now;
+  _paint_global.wakeups = 0;
+  _paint_global.idle_wakeups = 0;
+}
+
+static void
+_paint_callback(EV_P_ ev_timer *w, int revents)
+{
+  /* The sentinel reply may have  been read by any blocking call, thus
+     the connection may not be readable */
+  unagi_paint_check_frame_completion();
+
+  /* Do not  queue another frame  until the X server is done with the
+     previous one */
+  if(_paint_global.frame.pending)
+    {
+      unagi_debug("Previous frame not completed yet, deferring repaint");
+      _paint_global.frame.paint_deferred = true;
+      return;
+    }
+
+  _paint_report_wakeup(false);
+
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+    if(plugin->enable && plugin->vtable->activated && plugin->vtable->pre_paint)
+      (*plugin->vtable->pre_paint)();
+
+  /* Apply the ConfigureNotify received since the last repaint and
+     acquire the windows mapped meanwhile */
+  unagi_event_flush_configure_notify();
+
+  const ev_tstamp map_time = unagi_event_flush_map_notify();
+  if(map_time && !_paint_global.map_time)
+    _paint_global.map_time = map_time;
+
+  /* Nothing is painted while the windows are unredirected, and the
+     whole screen is repainted when they are redirected again */
+  if(unagi_display_update_unredirection())
+    {
+      unagi_display_reset_damaged();
+      globalconf.force_repaint = false;
+      globalconf.background_reset = false;
+    }
+
+  /* A damage may have been added without any clock being scheduled,
+     e.g. outside of all the CRTCs */
+  if(_paint_is_needed() && _paint_schedule_clocks(NULL))
+    _paint_arm();
+
+  const _paint_type_t paint_type = _paint_get_type();
+  const ev_tstamp now = ev_now(globalconf.event_loop);
+  const ev_tstamp due_time = now + _paint_cost_predict(paint_type) +
+    _PAINT_CLOCK_DUE_TOLERANCE;
+
+  /* Get the clocks whose repaint should start now, all of them for a
+     forced repaint as the whole screen is repainted anyway */
+  xcb_rectangle_t due_rectangles[_paint_global.clocks_len];
+  uint32_t due_rectangles_len = 0;
+  bool is_all_due = true;
+  ev_tstamp deadline = 0;
+
+  for(_paint_clock_t *clock = _paint_global.clocks;
+      clock - _paint_global.clocks < _paint_global.clocks_len;
+      clock++)
+    {
+      clock->is_in_frame = false;
+
+      if(!clock->is_scheduled)
+        continue;
+
+      if(paint_type != _PAINT_TYPE_FORCED && clock->deadline > due_time)
+        {
+          is_all_due = false;
+          continue;
+        }
+
+      if(!deadline || clock->deadline < deadline)
+        deadline = clock->deadline;
+
+      due_rectangles[due_rectangles_len++] = (xcb_rectangle_t) {
+        (int16_t) clock->box.x1, (int16_t) clock->box.y1,
+        (uint16_t) (clock->box.x2 - clock->box.x1),
+        (uint16_t) (clock->box.y2 - clock->box.y1)
+      };
+
+      /* Damages added while painting will schedule it again */
+      clock->is_scheduled = false;
+      clock->is_in_frame = true;
+      clock->last_deadline = clock->deadline;
+      clock->deadline = 0;
+    }
+
+  /* Now paint the windows */
+  if(due_rectangles_len && _paint_is_needed())
+    {
+      if(globalconf.force_repaint)
+        unagi_display_reset_damaged();
+      else
+        {
+          unagi_display_upload_damaged();
+
+          /* Only paint the share of the damaged Region within the CRTCs
+             whose deadline is reached */
+          if(!is_all_due)
+            unagi_display_restrict_damaged(due_rectangles, due_rectangles_len);
+        }
+
+#ifdef __DEBUG__
+      unagi_debug("COUNT: %u: Begin re-painting", _paint_global.paint_counter);
+
+      /* Display damaged regions */
+      xcb_xfixes_fetch_region_reply_t *r = \
+        xcb_xfixes_fetch_region_reply(globalconf.connection,
+                                      xcb_xfixes_fetch_region(globalconf.connection,
+                                                              globalconf.damaged),
+                                      NULL);
+      if(r)
+        {
+          xcb_rectangle_t *rects = xcb_xfixes_fetch_region_rectangles(r);
+
+          for(int i = 0; i < xcb_xfixes_fetch_region_rectangles_length(r);
+              i++)
+            unagi_debug("Damaged region #%d: %dx%d +%d+%d",
+                        i, rects[i].width, rects[i].height,
+                        rects[i].x, rects[i].y);
+
+          free(r);
+        }
+#endif
+      unagi_window_paint_all();
+
+      /* Also restore the damaged Region of the other CRTCs, if any */
+      if(!globalconf.force_repaint)
+        unagi_display_reset_damaged();
+
+      /* The sentinel reply will be received once the X server has
+         processed all the requests of this frame */
+      _paint_global.frame.cookie = xcb_get_input_focus(globalconf.connection);
+
+      /* Requests sent since the sentinel of the previous frame, which
+         includes the ones sent while handling events */
+      _paint_global.frame.requests = _paint_global.frame.cookie.sequence -
+        _paint_global.last_sentinel_sequence - 1;
+
+      _paint_global.last_sentinel_sequence = _paint_global.frame.cookie.sequence;
+      xcb_flush(globalconf.connection);
+
+      _paint_global.frame.pending = true;
+      _paint_global.frame.type = paint_type;
+      _paint_global.frame.start_time = now;
+      _paint_global.frame.client_time = ev_time() - now;
+      _paint_global.frame.deadline = deadline;
+      _paint_global.frame.map_time = _paint_global.map_time;
+      _paint_global.map_time = 0;
+
+      _paint_global.paint_counter++;
+
+      for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+        if(plugin->enable && plugin->vtable->activated && plugin->vtable->post_paint)
+          (*plugin->vtable->post_paint)();
+
+      globalconf.force_repaint = false;
+
+      /* Keep the refresh deadlines in phase with the VBlanks */
+      _paint_request_vblank();
+
+      /* Some events may have been queued while calling this callback,
+         so make sure by calling this watcher again */
+      ev_invoke(globalconf.event_loop, &globalconf.event_io_watcher, 0);
+    }
+  /* Nothing to paint */
+  else
+    _paint_report_wakeup(true);
+
+  /* Plugins may  damage windows  from their pre_paint hook,  and the
+     unredirection must be checked again, so keep waking up */
+  if(_paint_plugin_needs_timer() || unagi_display_unredirection_is_pending())
+    _paint_schedule_clocks(NULL);
+
+  /* Do not wake up again until something gets damaged */
+  _paint_arm();
+}
+
+/** Check whether the X server has processed the last frame, without
+ *  blocking, and if so update the repaint cost estimators with the
+ *  whole time spent on this frame
+ */
+void
+unagi_paint_check_frame_completion(void)
+{
+  if(!_paint_global.frame.pending)
+    return;
+
+  void *reply;
+  xcb_generic_error_t *error;
+  if(!xcb_poll_for_reply(globalconf.connection,
+                         _paint_global.frame.cookie.sequence,
+                         &reply, &error))
+    return;
+
+  free(reply);
+  free(error);
+
+  const ev_tstamp end_time = ev_time();
+  const _paint_type_t type = _paint_global.frame.type;
+  const double paint_time = end_time - _paint_global.frame.start_time;
+
+  _paint_global.frame.pending = false;
+
+  if(end_time > _paint_global.frame.deadline)
+    _paint_global.missed_deadlines++;
+
+  _paint_cost_add(&_paint_global.costs[type], paint_time);
+
+  for(_paint_clock_t *clock = _paint_global.clocks;
+      clock - _paint_global.clocks < _paint_global.clocks_len;
+      clock++)
+    if(clock->is_in_frame)
+      {
+        _paint_clock_update_divisor(clock, type);
+        clock->is_in_frame = false;
+      }
+
+  _paint_update_repaint_interval();
+
+  unagi_debug("%s repainting time in seconds (#%u): %.6f (client=%.6f, "
+              "server=%.6f), average=%.6f, p%.0f=%.6f, requests=%u, "
+              "missed deadlines=%u",
+              type == _PAINT_TYPE_FORCED ? "FORCED" : "Partial",
+              _paint_global.paint_counter, paint_time,
+              _paint_global.frame.client_time,
+              paint_time - _paint_global.frame.client_time,
+              _paint_global.costs[type].ewma,
+              _PAINT_COST_PERCENTILE * 100,
+              _paint_global.costs[type].percentile,
+              _paint_global.frame.requests,
+              _paint_global.missed_deadlines);
+
+  /* Latency of mapping windows, e.g. when switching workspaces */
+  if(_paint_global.frame.map_time)
+    {
+      _paint_global.map_latency = end_time - _paint_global.frame.map_time;
+      unagi_debug("Mapped windows shown %.6f seconds after the first MapNotify",
+                  _paint_global.map_latency);
+    }
+
+  /* The repaint which was due in the meantime can now be done */
+  if(_paint_global.frame.paint_deferred)
+    {
+      _paint_global.frame.paint_deferred = false;
+      _paint_arm();
+    }
+}
+
+/** Get the latency of mapping windows, e.g. when switching workspaces
+ *
+ * \return Seconds between the first MapNotify and the completion of
+ *         the frame showing the mapped windows, for the last such frame
+ */
+double
+unagi_paint_get_map_latency(void)
+{
+  return _paint_global.map_latency;
+}
+
+/** Create one refresh clock per CRTC, called on startup and whenever the
+ *  screen configuration changes.  All the clocks are then scheduled
+ */
+void
+unagi_paint_update_clocks(void)
+{
+  free(_paint_global.clocks);
+
+  _paint_global.clocks = calloc(globalconf.crtc_len, sizeof(_paint_clock_t));
+  _paint_global.clocks_len = _paint_global.clocks ? globalconf.crtc_len : 0;
+  _paint_global.vblank_clock = NULL;
+
+  uint64_t vblank_clock_area = 0;
+  for(unsigned int i = 0; i < _paint_global.clocks_len; i++)
+    {
+      _paint_clock_t *clock = &_paint_global.clocks[i];
+      const xcb_randr_get_crtc_info_reply_t *crtc = globalconf.crtc[i];
+
+      clock->box = (unagi_region_box_t) {
+        crtc->x, crtc->y, crtc->x + crtc->width, crtc->y + crtc->height
+      };
+
+      clock->refresh_interval = globalconf.crtc_refresh_interval[i];
+      clock->divisor = 1;
+      clock->is_scheduled = true;
+
+      /* Present reports the VBlanks of the root window for the CRTC
+         covering most of it */
+      const uint64_t area = unagi_region_box_area(&clock->box);
+      if(area > vblank_clock_area)
+        {
+          _paint_global.vblank_clock = clock;
+          vblank_clock_area = area;
+        }
+
+      unagi_debug("CRTC %jux%ju +%jd +%jd: refresh interval %.6fs",
+                  (uintmax_t) crtc->width, (uintmax_t) crtc->height,
+                  (intmax_t) crtc->x, (intmax_t) crtc->y,
+                  clock->refresh_interval);
+    }
+
+  /* The measured VBlank interval may not be relevant anymore and the
+     CompleteNotify of a pending NotifyMSC may never come (e.g. the
+     CRTC has been disabled), so request the VBlank again */
+  _paint_global.vblank_time = 0;
+  _paint_global.vblank_interval = 0;
+  _paint_global.vblank_pending = false;
+  if(_paint_global.initialised)
+    _paint_request_vblank();
+  _paint_global.frame.paint_deferred = _paint_global.frame.pending;
+
+  _paint_update_repaint_interval();
+
+  if(_paint_global.initialised && !_paint_global.frame.pending)
+    _paint_arm();
+}
+
+/** Initialise the paint timer watcher and perform the first repaint
+ *  as soon as possible
+ */
+void
+unagi_paint_init(void)
+{
+  ev_init(&globalconf.event_paint_timer_watcher, _paint_callback);
+
+  /* Painting must have precedence over events processing */
+  ev_set_priority(&globalconf.event_paint_timer_watcher, EV_MAXPRI);
+
+  _paint_global.report_start_time = ev_now(globalconf.event_loop);
+  _paint_global.initialised = true;
+
+  _paint_schedule_clocks(NULL);
+  _paint_request_vblank();
+  _paint_arm();
+}
+
+/** Schedule a repaint of the CRTCs intersecting the given box, called
+ *  whenever something has to be repainted.  The  repaint of a CRTC
+ *  targets its nearest refresh deadline which can still be met
+ *
+ * \param box The screen area to repaint, NULL for the whole screen
+ */
+void
+unagi_paint_schedule_box(const unagi_region_box_t *box)
+{
+  if(!_paint_global.initialised || !_paint_schedule_clocks(box))
+    return;
+
+  /* The VBlank phase may have drifted during the idle period */
+  if(!ev_is_active(&globalconf.event_paint_timer_watcher))
+    _paint_request_vblank();
+
+  _paint_arm();
+}
+
+/** Schedule a repaint of the whole screen
+ *
+ * \see unagi_paint_schedule_box
+ */
+void
+unagi_paint_schedule(void)
+{
+  unagi_paint_schedule_box(NULL);
+}
+
+/** Stop the paint timer watcher for good */
+void
+unagi_paint_stop(void)
+{
+  ev_timer_stop(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+  _paint_global.initialised = false;
+
+  unagi_util_free(&_paint_global.clocks);
+  _paint_global.clocks_len = 0;
+  _paint_global.vblank_clock = NULL;
+}
+
+/** Forget  about the  pending NotifyMSC  request as  it failed, thus
+ *  the next repaint will request the VBlank again
+ */
+void
+unagi_paint_vblank_failed(void)
+{
+  _paint_global.vblank_pending = false;
+  _paint_global.vblank_time = 0;
+}
+
+/** Record a VBlank reported by Present CompleteNotify event and align
+ *  the scheduled repaint of the corresponding CRTC (if any) on it.  The
+ *  UST is given in microseconds of the monotonic clock whereas libev
+ *  uses the wall clock, so it has to be converted
+ *
+ * \param ust The VBlank timestamp in microseconds
+ * \param msc The VBlank counter
+ */
+void
+unagi_paint_vblank(uint64_t ust, uint64_t msc)
+{
+  _paint_global.vblank_pending = false;
+
+  struct timespec monotonic_now;
+  if(clock_gettime(CLOCK_MONOTONIC, &monotonic_now))
+    return;
+
+  const ev_tstamp vblank_time = ev_time() -
+    ((double) monotonic_now.tv_sec + (double) monotonic_now.tv_nsec * 1e-9 -
+     (double) ust * 1e-6);
+
+  if(_paint_global.vblank_time > 0 && msc > _paint_global.vblank_msc)
+    {
+      const double interval = (vblank_time - _paint_global.vblank_time) /
+        (double) (msc - _paint_global.vblank_msc);
+
+      /* Ignore obviously wrong measurements (e.g. clock adjustments) */
+      if(interval > 0.001 && interval < 1.0)
+        {
+          if(_paint_global.vblank_interval > 0)
+            _paint_global.vblank_interval += _PAINT_VBLANK_INTERVAL_WEIGHT *
+              (interval - _paint_global.vblank_interval);
+          else
+            _paint_global.vblank_interval = interval;
+        }
+    }
+
+  _paint_global.vblank_time = vblank_time;
+  _paint_global.vblank_msc = msc;
+
+  unagi_debug("VBlank #%ju, interval=%.6fs", (uintmax_t) msc,
+              _paint_global.vblank_interval);
+
+  /* Compute again when the scheduled repaint should start */
+  _paint_clock_t *clock = _paint_global.vblank_clock;
+  if(_paint_global.initialised && clock && clock->is_scheduled &&
+     !_paint_global.frame.pending)
+    {
+      clock->deadline = 0;
+      _paint_arm();
+    }
+}
@@ -133,6 +133,23 @@ unagi_plugin_search_by_name(const char *name)
   return NULL;
 }
 
+/** Check  whether an activated  plugin paints the  screen itself (e.g.
+ *  expose),  thus  with  painting  hooks,  unlike  the  plugins  only
+ *  changing how windows are painted (e.g. opacity)
+ *
+ * \return true if such a plugin is activated
+ */
+bool
+unagi_plugin_is_painting_activated(void)
+{
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+    if(plugin->enable && plugin->vtable->activated &&
+       (plugin->vtable->pre_paint || plugin->vtable->post_paint))
+      return true;
+
+  return false;
+}
+
 /** Unload all the plugins and their allocated memory */
 void
 unagi_plugin_unload_all(void)
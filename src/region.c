@@ -0,0 +1,580 @@
+/* -*-mode:c;coding:utf-8; c-basic-offset:2;fill-column:70;c-file-style:"gnu"-*-
+ *
+ * Copyright (C) 2009 Arnaud "arnau" Fontaine <arnau@mini-dweeb.org>
+ *
+ * This  program is  free  software: you  can  redistribute it  and/or
+ * modify  it under the  terms of  the GNU  General Public  License as
+ * published by the Free Software  Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have  received a copy of the  GNU General Public License
+ *  along      with      this      program.      If      not,      see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ *  \brief Client-side regions
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "region.h"
+#include "util.h"
+
+/** Operations which can be performed on two regions */
+typedef enum
+{
+  _REGION_OP_UNION,
+  _REGION_OP_INTERSECT,
+  _REGION_OP_SUBTRACT
+} _region_op_t;
+
+/** Make sure there is enough room to store the given number of boxes
+ *
+ * \param region The region object
+ * \param boxes_len The number of boxes to be stored
+ * \return false if the memory could not be allocated
+ */
+static bool
+_region_reserve(unagi_region_t *region, const uint32_t boxes_len)
+{
+  if(boxes_len <= region->boxes_size)
+    return true;
+
+  uint32_t boxes_size = region->boxes_size ? region->boxes_size : 8;
+  while(boxes_size < boxes_len)
+    boxes_size *= 2;
+
+  unagi_region_box_t *boxes = realloc(region->boxes,
+                                      sizeof(unagi_region_box_t) * boxes_size);
+
+  if(!boxes)
+    {
+      unagi_warn("Cannot allocate memory for %u region boxes", boxes_size);
+      return false;
+    }
+
+  region->boxes = boxes;
+  region->boxes_size = boxes_size;
+  return true;
+}
+
+/** Compute the extents of the region from its boxes
+ *
+ * \param region The region object
+ */
+static void
+_region_set_extents(unagi_region_t *region)
+{
+  if(!region->boxes_len)
+    {
+      memset(&region->extents, 0, sizeof(unagi_region_box_t));
+      return;
+    }
+
+  /* Boxes are sorted by bands, so only the horizontal bounds have to
+     be computed */
+  region->extents.y1 = region->boxes[0].y1;
+  region->extents.y2 = region->boxes[region->boxes_len - 1].y2;
+  region->extents.x1 = region->boxes[0].x1;
+  region->extents.x2 = region->boxes[0].x2;
+
+  for(uint32_t i = 1; i < region->boxes_len; i++)
+    {
+      if(region->boxes[i].x1 < region->extents.x1)
+        region->extents.x1 = region->boxes[i].x1;
+
+      if(region->boxes[i].x2 > region->extents.x2)
+        region->extents.x2 = region->boxes[i].x2;
+    }
+}
+
+/** Initialise an empty region
+ *
+ * \param region The region object
+ */
+void
+unagi_region_init(unagi_region_t *region)
+{
+  memset(region, 0, sizeof(unagi_region_t));
+}
+
+/** Initialise a region made of the given box
+ *
+ * \param region The region object
+ * \param box The box
+ */
+void
+unagi_region_init_box(unagi_region_t *region, const unagi_region_box_t *box)
+{
+  unagi_region_init(region);
+  unagi_region_reset_box(region, box);
+}
+
+/** Free the memory allocated for the given region, which is then empty
+ *
+ * \param region The region object
+ */
+void
+unagi_region_free(unagi_region_t *region)
+{
+  free(region->boxes);
+  unagi_region_init(region);
+}
+
+/** Empty the given region but keep its memory for later use
+ *
+ * \param region The region object
+ */
+void
+unagi_region_reset(unagi_region_t *region)
+{
+  region->boxes_len = 0;
+  memset(&region->extents, 0, sizeof(unagi_region_box_t));
+}
+
+/** Set the given region to the given box
+ *
+ * \param region The region object
+ * \param box The box
+ */
+void
+unagi_region_reset_box(unagi_region_t *region, const unagi_region_box_t *box)
+{
+  unagi_region_reset(region);
+
+  if(unagi_region_box_is_empty(box) || !_region_reserve(region, 1))
+    return;
+
+  region->boxes[0] = *box;
+  region->boxes_len = 1;
+  region->extents = *box;
+}
+
+/** Copy a region into another one
+ *
+ * \param dst The destination region
+ * \param src The source region
+ * \return false if the memory could not be allocated
+ */
+bool
+unagi_region_copy(unagi_region_t *dst, const unagi_region_t *src)
+{
+  if(dst == src)
+    return true;
+
+  if(!_region_reserve(dst, src->boxes_len))
+    return false;
+
+  if(src->boxes_len)
+    memcpy(dst->boxes, src->boxes, sizeof(unagi_region_box_t) * src->boxes_len);
+
+  dst->boxes_len = src->boxes_len;
+  dst->extents = src->extents;
+  return true;
+}
+
+/** Get the  band of a region  covering the given ordinate, the  band
+ *  index is only increased as the ordinates are given in order
+ *
+ * \param region The region object
+ * \param y The ordinate
+ * \param band_start The index of the first box of the current band
+ * \param band_len The number of boxes of the band covering y (0 if none)
+ */
+static void
+_region_get_band(const unagi_region_t *region,
+                 const int32_t y,
+                 uint32_t *band_start,
+                 uint32_t *band_len)
+{
+  while(*band_start < region->boxes_len &&
+        region->boxes[*band_start].y2 <= y)
+    {
+      const int32_t band_y1 = region->boxes[*band_start].y1;
+      while(*band_start < region->boxes_len &&
+            region->boxes[*band_start].y1 == band_y1)
+        (*band_start)++;
+    }
+
+  *band_len = 0;
+  if(*band_start == region->boxes_len ||
+     region->boxes[*band_start].y1 > y)
+    return;
+
+  const int32_t band_y1 = region->boxes[*band_start].y1;
+  while(*band_start + *band_len < region->boxes_len &&
+        region->boxes[*band_start + *band_len].y1 == band_y1)
+    (*band_len)++;
+}
+
+/** Get the next band edge strictly greater than the given ordinate
+ *
+ * \param region The region object
+ * \param band_start The index of the first box of the current band
+ * \param y The ordinate
+ * \return The edge or INT32_MAX if there is none
+ */
+static int32_t
+_region_get_next_edge(const unagi_region_t *region,
+                      const uint32_t band_start,
+                      const int32_t y)
+{
+  for(uint32_t i = band_start; i < region->boxes_len; i++)
+    {
+      if(region->boxes[i].y1 > y)
+        return region->boxes[i].y1;
+      if(region->boxes[i].y2 > y)
+        return region->boxes[i].y2;
+    }
+
+  return INT32_MAX;
+}
+
+/** Get the abscissa of the given horizontal edge of a band
+ *
+ * \param band The first box of the band
+ * \param band_len The number of boxes in the band
+ * \param edge The edge index (two edges per box)
+ * \return The abscissa or INT32_MAX once all the edges have been seen
+ */
+static inline int32_t
+_region_band_get_edge(const unagi_region_box_t *band,
+                      const uint32_t band_len,
+                      const uint32_t edge)
+{
+  if(edge >= band_len * 2)
+    return INT32_MAX;
+
+  return (edge % 2) ? band[edge / 2].x2 : band[edge / 2].x1;
+}
+
+/** Apply an operation on two bands spanning the same ordinates and
+ *  append the resulting boxes to the given region
+ *
+ * \param result The resulting region
+ * \param op The operation
+ * \param band_a The first band (may be NULL if band_a_len is 0)
+ * \param band_a_len The number of boxes of the first band
+ * \param band_b The second band (may be NULL if band_b_len is 0)
+ * \param band_b_len The number of boxes of the second band
+ * \param y1 The top of the bands
+ * \param y2 The bottom of the bands
+ * \return false if the memory could not be allocated
+ */
+static bool
+_region_band_op(unagi_region_t *result,
+                const _region_op_t op,
+                const unagi_region_box_t *band_a,
+                const uint32_t band_a_len,
+                const unagi_region_box_t *band_b,
+                const uint32_t band_b_len,
+                const int32_t y1,
+                const int32_t y2)
+{
+  bool in_a = false, in_b = false, inside = false;
+  int32_t x_start = 0;
+
+  for(uint32_t edge_a = 0, edge_b = 0;
+      edge_a < band_a_len * 2 || edge_b < band_b_len * 2;)
+    {
+      const int32_t xa = _region_band_get_edge(band_a, band_a_len, edge_a);
+      const int32_t xb = _region_band_get_edge(band_b, band_b_len, edge_b);
+      const int32_t x = min(xa, xb);
+
+      /* Both edges are processed at once when they are equal, so that
+         adjacent boxes are merged */
+      if(xa == x)
+        {
+          in_a = !in_a;
+          edge_a++;
+        }
+      if(xb == x)
+        {
+          in_b = !in_b;
+          edge_b++;
+        }
+
+      bool now_inside;
+      switch(op)
+        {
+        case _REGION_OP_UNION:
+          now_inside = in_a || in_b;
+          break;
+        case _REGION_OP_INTERSECT:
+          now_inside = in_a && in_b;
+          break;
+        default:
+          now_inside = in_a && !in_b;
+          break;
+        }
+
+      if(now_inside && !inside)
+        x_start = x;
+      else if(!now_inside && inside)
+        {
+          if(!_region_reserve(result, result->boxes_len + 1))
+            return false;
+
+          unagi_region_box_t *box = result->boxes + result->boxes_len++;
+          box->x1 = x_start;
+          box->y1 = y1;
+          box->x2 = x;
+          box->y2 = y2;
+        }
+
+      inside = now_inside;
+    }
+
+  return true;
+}
+
+/** Merge the last band of the region with the previous one if they are
+ *  vertically adjacent and have the same horizontal boxes, this keeps
+ *  the number of boxes as low as possible
+ *
+ * \param region The region object
+ * \param prev_band_start The index of the first box of the previous band
+ * \param band_start The index of the first box of the last band
+ * \return The index of the first box of the last band after merging
+ */
+static uint32_t
+_region_coalesce_band(unagi_region_t *region,
+                      const uint32_t prev_band_start,
+                      const uint32_t band_start)
+{
+  const uint32_t band_len = region->boxes_len - band_start;
+
+  if(band_start == prev_band_start ||
+     band_start - prev_band_start != band_len ||
+     region->boxes[prev_band_start].y2 != region->boxes[band_start].y1)
+    return band_start;
+
+  for(uint32_t i = 0; i < band_len; i++)
+    if(region->boxes[prev_band_start + i].x1 != region->boxes[band_start + i].x1 ||
+       region->boxes[prev_band_start + i].x2 != region->boxes[band_start + i].x2)
+      return band_start;
+
+  const int32_t y2 = region->boxes[band_start].y2;
+  for(uint32_t i = 0; i < band_len; i++)
+    region->boxes[prev_band_start + i].y2 = y2;
+
+  region->boxes_len = band_start;
+  return prev_band_start;
+}
+
+/** Apply an operation on two  regions by sweeping all the bands edges
+ *  from the top to the bottom
+ *
+ * \param dst The resulting region (may be one of the operands)
+ * \param a The first operand
+ * \param b The second operand
+ * \param op The operation
+ * \return false if the memory could not be allocated
+ */
+static bool
+_region_op(unagi_region_t *dst,
+           const unagi_region_t *a,
+           const unagi_region_t *b,
+           const _region_op_t op)
+{
+  unagi_region_t result;
+  unagi_region_init(&result);
+
+  if(!_region_reserve(&result, a->boxes_len + b->boxes_len))
+    return false;
+
+  uint32_t band_a_start = 0, band_b_start = 0;
+  uint32_t prev_band_start = 0;
+
+  int32_t y = min(a->boxes_len ? a->boxes[0].y1 : INT32_MAX,
+                  b->boxes_len ? b->boxes[0].y1 : INT32_MAX);
+
+  while(y != INT32_MAX)
+    {
+      uint32_t band_a_len, band_b_len;
+      _region_get_band(a, y, &band_a_start, &band_a_len);
+      _region_get_band(b, y, &band_b_start, &band_b_len);
+
+      const int32_t y_next = min(_region_get_next_edge(a, band_a_start, y),
+                                 _region_get_next_edge(b, band_b_start, y));
+
+      if(y_next == INT32_MAX)
+        break;
+
+      const uint32_t band_start = result.boxes_len;
+
+      if((band_a_len || band_b_len) &&
+         !_region_band_op(&result, op,
+                          a->boxes + band_a_start, band_a_len,
+                          b->boxes + band_b_start, band_b_len,
+                          y, y_next))
+        {
+          unagi_region_free(&result);
+          return false;
+        }
+
+      if(result.boxes_len != band_start)
+        prev_band_start = _region_coalesce_band(&result, prev_band_start,
+                                                band_start);
+
+      y = y_next;
+    }
+
+  _region_set_extents(&result);
+
+  free(dst->boxes);
+  *dst = result;
+  return true;
+}
+
+/** Compute the union of two regions
+ *
+ * \param dst The resulting region (may be one of the operands)
+ * \param a The first operand
+ * \param b The second operand
+ * \return false if the memory could not be allocated
+ */
+bool
+unagi_region_union(unagi_region_t *dst,
+                   const unagi_region_t *a,
+                   const unagi_region_t *b)
+{
+  if(unagi_region_is_empty(a))
+    return unagi_region_copy(dst, b);
+  if(unagi_region_is_empty(b))
+    return unagi_region_copy(dst, a);
+
+  return _region_op(dst, a, b, _REGION_OP_UNION);
+}
+
+/** Add a box to the given region
+ *
+ * \param region The region object
+ * \param box The box to be added
+ * \return false if the memory could not be allocated
+ */
+bool
+unagi_region_union_box(unagi_region_t *region, const unagi_region_box_t *box)
+{
+  if(unagi_region_box_is_empty(box) || unagi_region_contains_box(region, box))
+    return true;
+
+  const unagi_region_t box_region = {
+    .extents = *box,
+    .boxes = (unagi_region_box_t *) box,
+    .boxes_len = 1,
+    .boxes_size = 1
+  };
+
+  return unagi_region_union(region, region, &box_region);
+}
+
+/** Compute the intersection of two regions
+ *
+ * \param dst The resulting region (may be one of the operands)
+ * \param a The first operand
+ * \param b The second operand
+ * \return false if the memory could not be allocated
+ */
+bool
+unagi_region_intersect(unagi_region_t *dst,
+                       const unagi_region_t *a,
+                       const unagi_region_t *b)
+{
+  if(unagi_region_is_empty(a) || unagi_region_is_empty(b) ||
+     a->extents.x2 <= b->extents.x1 || b->extents.x2 <= a->extents.x1 ||
+     a->extents.y2 <= b->extents.y1 || b->extents.y2 <= a->extents.y1)
+    {
+      unagi_region_reset(dst);
+      return true;
+    }
+
+  return _region_op(dst, a, b, _REGION_OP_INTERSECT);
+}
+
+/** Subtract a region from another one
+ *
+ * \param dst The resulting region (may be one of the operands)
+ * \param a The region to subtract from
+ * \param b The region to be subtracted
+ * \return false if the memory could not be allocated
+ */
+bool
+unagi_region_subtract(unagi_region_t *dst,
+                      const unagi_region_t *a,
+                      const unagi_region_t *b)
+{
+  if(unagi_region_is_empty(a) || unagi_region_is_empty(b) ||
+     a->extents.x2 <= b->extents.x1 || b->extents.x2 <= a->extents.x1 ||
+     a->extents.y2 <= b->extents.y1 || b->extents.y2 <= a->extents.y1)
+    return unagi_region_copy(dst, a);
+
+  return _region_op(dst, a, b, _REGION_OP_SUBTRACT);
+}
+
+/** Check whether the given box is entirely contained in the region
+ *
+ * \param region The region object
+ * \param box The box
+ * \return true if the box is within the region
+ */
+bool
+unagi_region_contains_box(const unagi_region_t *region,
+                          const unagi_region_box_t *box)
+{
+  if(unagi_region_box_is_empty(box))
+    return true;
+
+  if(unagi_region_is_empty(region) ||
+     box->x1 < region->extents.x1 || box->x2 > region->extents.x2 ||
+     box->y1 < region->extents.y1 || box->y2 > region->extents.y2)
+    return false;
+
+  /* Walk  the  bands  covering the  box  from  the  top to  the  bottom,
+     there must not be any vertical gap */
+  int32_t y = box->y1;
+  for(uint32_t i = 0; i < region->boxes_len && y < box->y2; i++)
+    {
+      const unagi_region_box_t *r = region->boxes + i;
+      if(r->y2 <= y)
+        continue;
+      if(r->y1 > y)
+        return false;
+
+      /* Boxes within a band are sorted and not adjacent, so the box
+         must fit within one of them */
+      if(r->x1 <= box->x1 && r->x2 >= box->x2)
+        {
+          y = r->y2;
+          /* Skip the remaining boxes of this band */
+          while(i + 1 < region->boxes_len && region->boxes[i + 1].y1 == r->y1)
+            i++;
+        }
+      else if(i + 1 == region->boxes_len || region->boxes[i + 1].y1 != r->y1)
+        return false;
+    }
+
+  return y >= box->y2;
+}
+
+/** Compute the number of pixels of the given region
+ *
+ * \param region The region object
+ * \return The area
+ */
+uint64_t
+unagi_region_area(const unagi_region_t *region)
+{
+  uint64_t area = 0;
+  for(uint32_t i = 0; i < region->boxes_len; i++)
+    area += unagi_region_box_area(region->boxes + i);
+
+  return area;
+}
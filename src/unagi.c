@@ -40,6 +40,10 @@
 #include <xcb/xfixes.h>
 #include <xcb/damage.h>
 #include <xcb/randr.h>
+#ifdef HAVE_XCB_PRESENT
+# include <xcb/present.h>
+#endif
+#include <xcb/shape.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/xcb_keysyms.h>
@@ -56,14 +60,7 @@
 #include "plugin.h"
 #include "key.h"
 #include "dbus.h"
-
-#ifdef __DEBUG__
-/*
- * Basic painting performance benchmark
- */
-#include <float.h>
-#include <math.h>
-#endif
+#include "paint.h"
 
 unagi_conf_t globalconf;
 
@@ -129,8 +126,17 @@ _unagi_set_conf_path(void)
 static void
 _unagi_parse_configuration_file(void)
 {
+  cfg_opt_t damage_rate_opts[] = {
+    CFG_FLOAT("max", 0, CFGF_NONE),
+    CFG_END()
+  };
+
   cfg_opt_t opts[] = {
     CFG_BOOL("vsync-drm", cfg_false, CFGF_NONE),
+    CFG_BOOL("vsync-present", cfg_false, CFGF_NONE),
+    CFG_BOOL("unredirect-fullscreen", cfg_true, CFGF_NONE),
+    CFG_FLOAT("damage-rate-max", 0, CFGF_NONE),
+    CFG_SEC("damage-rate", damage_rate_opts, CFGF_MULTI | CFGF_TITLE),
     CFG_STR("rendering", "render", CFGF_NONE),
     CFG_STR_LIST("plugins", "{}", CFGF_NONE),
     CFG_END()
@@ -147,6 +153,41 @@ _unagi_parse_configuration_file(void)
   free(fname_path);
 }
 
+/** Startup phases timing, reported if --startup-report is given */
+static struct
+{
+  /** Whether --startup-report has been given */
+  bool is_enabled;
+  /** Time when the program started */
+  ev_tstamp start_time;
+  /** Time when the current phase started */
+  ev_tstamp phase_start_time;
+  /** Number of round-trips when the current phase started */
+  unsigned int phase_start_round_trips;
+} _unagi_startup_report;
+
+/** Report the wall time and the number of round-trips of a startup
+ *  phase, only if --startup-report has been given
+ *
+ * \param name The phase name
+ */
+static void
+_unagi_startup_phase(const char *name)
+{
+  if(!_unagi_startup_report.is_enabled)
+    return;
+
+  const ev_tstamp now = ev_time();
+  const unsigned int round_trips = unagi_display_round_trips_get();
+
+  fprintf(stderr, "%-28s %9.3fms %u round-trip(s)\n", name,
+          (now - _unagi_startup_report.phase_start_time) * 1000,
+          round_trips - _unagi_startup_report.phase_start_round_trips);
+
+  _unagi_startup_report.phase_start_time = now;
+  _unagi_startup_report.phase_start_round_trips = round_trips;
+}
+
 /** Display help information */
 static inline void
 _unagi_display_help(void)
@@ -156,7 +197,8 @@ _unagi_display_help(void)
   -v, --version             show version\n\
   -c, --config FILE         configuration file path\n\
   -r, --rendering-path PATH rendering backend path\n\
-  -p, --plugins-path PATH   plugins path\n");
+  -p, --plugins-path PATH   plugins path\n\
+  -s, --startup-report      report startup phases timing and round-trips\n");
 }
 
 /** Parse command line parameters
@@ -173,11 +215,12 @@ _unagi_parse_command_line_parameters(int argc, char **argv)
     { "config-path", 1, NULL, 'c' },
     { "rendering-path", 1, NULL, 'r' },
     { "plugins-path", 1, NULL, 'p' },
+    { "startup-report", 0, NULL, 's' },
     { NULL, 0, NULL, 0 }
   };
 
   int opt;
-  while((opt = getopt_long(argc, argv, "vhc:r:p:",
+  while((opt = getopt_long(argc, argv, "vhsc:r:p:",
 			   long_options, NULL)) != -1)
     {
       switch(opt)
@@ -206,6 +249,9 @@ _unagi_parse_command_line_parameters(int argc, char **argv)
 	  else
 	    unagi_fatal("-p option requires a directory");
 	  break;
+	case 's':
+	  _unagi_startup_report.is_enabled = true;
+	  break;
 	}
     }
 
@@ -244,6 +290,10 @@ _unagi_exit_cleanup(void)
      rendering information associated with each window */
   unagi_rendering_unload();
 
+  /* Free resources related to events handling */
+  unagi_event_cleanup();
+  unagi_display_cleanup();
+
   /* Free resources related to the keymaps */
   xcb_key_symbols_free(globalconf.keysyms);
 
@@ -254,6 +304,7 @@ _unagi_exit_cleanup(void)
     free(globalconf.crtc[i]);
 
   free(globalconf.crtc);
+  free(globalconf.crtc_refresh_interval);
 
   free(globalconf.conf_path);
   cfg_free(globalconf.cfg);
@@ -291,116 +342,6 @@ _unagi_exit_on_signal(struct ev_loop *loop, ev_signal *w, int revents)
   ev_break(loop, EVBREAK_ALL);
 }
 
-static void
-_unagi_paint_callback(EV_P_ ev_timer *w, int revents)
-{
-#ifdef __DEBUG__
-  /* Meaningful to measure painting performances */
-  static double paint_time_min = DBL_MAX;
-  static double paint_time_max = 0;
-
-  /* For online computation of standard deviation */
-  static double paint_time_mean = 0;
-  static double paint_time_variance_sum = 0;
-#endif
-
-  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-    if(plugin->enable && plugin->vtable->activated && plugin->vtable->pre_paint)
-      (*plugin->vtable->pre_paint)();
-
-  /* Now paint the windows */
-  if(globalconf.damaged || globalconf.force_repaint)
-    {
-      if(globalconf.force_repaint)
-        unagi_display_reset_damaged();
-
-#ifdef __DEBUG__
-      unagi_debug("COUNT: %u: Begin re-painting", globalconf.paint_counter);
-
-      /* Display damaged regions */
-      xcb_xfixes_fetch_region_reply_t *r = \
-        xcb_xfixes_fetch_region_reply(globalconf.connection,
-                                      xcb_xfixes_fetch_region(globalconf.connection,
-                                                              globalconf.damaged),
-                                      NULL);
-      if(r)
-        {
-          xcb_rectangle_t *rects = xcb_xfixes_fetch_region_rectangles(r);
-
-          for(int i = 0; i < xcb_xfixes_fetch_region_rectangles_length(r);
-              i++)
-            unagi_debug("Damaged region #%d: %dx%d +%d+%d",
-                        i, rects[i].width, rects[i].height,
-                        rects[i].x, rects[i].y);
-
-          free(r);
-        }
-#endif
-      unagi_window_paint_all(globalconf.windows);
-      if(!globalconf.force_repaint)
-        unagi_display_reset_damaged();
-
-      const float paint_time = (float) (ev_time() - ev_now(globalconf.event_loop));
-
-      if(!globalconf.force_repaint)
-        {
-          globalconf.paint_time_sum += paint_time;
-
-          const float current_average = globalconf.paint_time_sum /
-            (float) ++globalconf.paint_counter;
-
-          /* The next repaint  interval is computed from  the refresh rate
-             interval and repaint global average time */
-          const float current_interval = globalconf.refresh_rate_interval -
-            current_average;
-
-          /* When repainting the whole screen, the painting may have taken
-             a  long time  but the  next repaint  should not  be too  soon
-             neither */
-          if(current_interval < UNAGI_MINIMUM_REPAINT_INTERVAL)
-            globalconf.repaint_interval = globalconf.refresh_rate_interval;
-          else
-            globalconf.repaint_interval = current_interval;
-
-#ifdef __DEBUG__
-          /* Compute standard deviation for this iteration */
-          if(paint_time < paint_time_min)
-            paint_time_min = paint_time;
-          if(paint_time > paint_time_max)
-            paint_time_max = paint_time;
-
-          const double delta = paint_time - paint_time_mean;
-          paint_time_mean += (double) delta / globalconf.paint_counter;
-          paint_time_variance_sum += delta * (paint_time - paint_time_mean);
-
-          unagi_debug("Painting time in seconds (#%u): %.6f, min=%.6f, max=%.6f, "
-                      "average=%.6f (+/- %.6Lf)",
-                      globalconf.paint_counter, paint_time, paint_time_min,
-                      paint_time_max, current_average,
-                      sqrtl(paint_time_variance_sum / globalconf.paint_counter));
-        }
-      else
-        {
-          unagi_debug("FORCED repainting time in seconds (#%u): %.6f",
-                      globalconf.paint_counter + 1, paint_time);
-#endif /* __DEBUG__ */
-        }
-
-      for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-        if(plugin->enable && plugin->vtable->activated && plugin->vtable->post_paint)
-          (*plugin->vtable->post_paint)();
-
-      /* Rearm the paint timer watcher */
-      globalconf.event_paint_timer_watcher.repeat = globalconf.repaint_interval;
-      ev_timer_again(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
-
-      /* Some events may have been queued while calling this callback,
-         so make sure by calling this watcher again */
-      ev_invoke(globalconf.event_loop, &globalconf.event_io_watcher, 0);
-      globalconf.force_repaint = false;
-    }
-}
-
 static void
 _unagi_io_callback(EV_P_ ev_io *w, int revents)
 {
@@ -416,30 +357,47 @@ _unagi_io_callback(EV_P_ ev_io *w, int revents)
   if(xcb_connection_has_error(globalconf.connection))
     unagi_fatal("X connection invalid");
 
-  /* Process all events in the queue because before painting, all the
-     DamageNotify have to be received */
-  xcb_generic_event_t *event;
-  while((event = xcb_poll_for_event(globalconf.connection)) != NULL)
+  /* On startup, all the events must be processed.  Otherwise, handle
+     them within the repaint interval, as DamageNotify would keep being
+     processed forever if many are received */
+  if(revents == -1)
+    unagi_event_handle_poll_loop(unagi_event_handle);
+  else
+    unagi_event_handle_budgeted(now, globalconf.repaint_interval - 0.001);
+
+  /* The GetWindowAttributes replies of the windows created may have been
+     read while polling for events */
+  unagi_window_flush_setup();
+
+  /* The sentinel  reply of  the last frame  may have been  read while
+     polling for events */
+  unagi_paint_check_frame_completion();
+}
+
+/** Called before the event  loop blocks.  Any call waiting for a reply
+ *  (e.g.  D-Bus  or plugins  requests)  reads  all  the  events  and
+ *  replies already received  into the XCB buffers,  in which case the
+ *  connection is not readable anymore, thus nothing would be handled
+ *  until another event is received
+ */
+static void
+_unagi_prepare_callback(EV_P_ ev_prepare *w, int revents)
+{
+  unagi_window_flush_setup();
+  unagi_paint_check_frame_completion();
+
+  /* Handle the remaining events in the I/O callback (which also reads
+     the connection) in this loop iteration */
+  xcb_generic_event_t *event = xcb_poll_for_queued_event(globalconf.connection);
+  if(event)
     {
       unagi_event_handle(event);
       free(event);
 
-      /* Stop processing events (but not  on startup as all the events
-         must be processed) if the  repaint interval has been reached,
-         otherwise DamageNotify  keep being processed forever  if many
-         are received */
-      if(revents != -1 && (ev_time() - now + 0.001) > globalconf.repaint_interval)
-        {
-          /* Process events remaining in the queue without polling the
-             X connection */
-          while((event = xcb_poll_for_queued_event(globalconf.connection)))
-            {
-              unagi_event_handle(event);
-              free(event);
-            }
-          break;
-        }
+      ev_feed_event(EV_A_ &globalconf.event_io_watcher, EV_READ);
     }
+
+  xcb_flush(globalconf.connection);
 }
 
 int
@@ -447,8 +405,13 @@ main(int argc, char **argv)
 {
   memset(&globalconf, 0, sizeof(globalconf));
 
+  _unagi_startup_report.start_time = ev_time();
+  _unagi_startup_report.phase_start_time = _unagi_startup_report.start_time;
+
   _unagi_parse_command_line_parameters(argc, argv);
 
+  unagi_display_round_trips_enable(_unagi_startup_report.is_enabled);
+
   /* libev event loop */
   globalconf.event_loop = ev_default_loop(EVFLAG_NOINOTIFY | EVFLAG_NOSIGMASK);
 
@@ -475,15 +438,21 @@ main(int argc, char **argv)
   if(xcb_connection_has_error(globalconf.connection))
     unagi_fatal("Cannot open display");
 
-  if(cfg_getbool(globalconf.cfg, "vsync-drm"))
+  globalconf.vsync_drm_fd = -1;
+  if(cfg_getbool(globalconf.cfg, "vsync-present"))
+    {
+      if(cfg_getbool(globalconf.cfg, "vsync-drm"))
+        unagi_warn("VSync with Present enabled, disabling VSync with DRM");
+    }
+  else if(cfg_getbool(globalconf.cfg, "vsync-drm"))
     display_vsync_drm_init();
-  else
-    globalconf.vsync_drm_fd = -1;
 
   /* Get the root window */
   globalconf.screen = xcb_aux_get_screen(globalconf.connection,
 					 globalconf.screen_nbr);
 
+  _unagi_startup_phase("Configuration and connection");
+
   /**
    * First round-trip
    */
@@ -491,11 +460,17 @@ main(int argc, char **argv)
   /* Send requests for EWMH atoms initialisation */
   xcb_intern_atom_cookie_t *ewmh_cookies = unagi_atoms_init();
 
-  /* Prefetch the extensions data */
+  /* Prefetch the extensions data, received along the atoms replies so
+     that getting them later does not cost another round-trip */
   xcb_prefetch_extension_data(globalconf.connection, &xcb_composite_id);
   xcb_prefetch_extension_data(globalconf.connection, &xcb_damage_id);
   xcb_prefetch_extension_data(globalconf.connection, &xcb_xfixes_id);
   xcb_prefetch_extension_data(globalconf.connection, &xcb_randr_id);
+  xcb_prefetch_extension_data(globalconf.connection, &xcb_shape_id);
+#ifdef HAVE_XCB_PRESENT
+  if(cfg_getbool(globalconf.cfg, "vsync-present"))
+    xcb_prefetch_extension_data(globalconf.connection, &xcb_present_id);
+#endif
 
   /* Pre-initialisation of the rendering backend */
   if(!unagi_rendering_load())
@@ -510,22 +485,34 @@ main(int argc, char **argv)
        handles by xcb-ewmh when getting the replies */
     unagi_fatal("Cannot initialise atoms");
 
+  _unagi_startup_phase("Atoms and extensions data");
+
+  /**
+   * Second round-trip
+   */
+
   /* First check whether there is already a Compositing Manager (ICCCM) */
   xcb_get_selection_owner_cookie_t wm_cm_owner_cookie =
     xcb_ewmh_get_wm_cm_owner(&globalconf.ewmh, globalconf.screen_nbr);
 
+  /* Send requests to register the CM now, the ownership is only claimed
+     once the PropertyNotify  is received, thus after  checking there is
+     no other Compositing Manager */
+  unagi_display_register_cm();
+
+  globalconf.keysyms = xcb_key_symbols_alloc(globalconf.connection);
+  xcb_get_modifier_mapping_cookie_t key_mapping_cookie =
+    xcb_get_modifier_mapping_unchecked(globalconf.connection);
+
   /* Initialiase libev event watcher on XCB connection */
   ev_io_init(&globalconf.event_io_watcher, _unagi_io_callback,
              xcb_get_file_descriptor(globalconf.connection), EV_READ);
 
   ev_io_start(globalconf.event_loop, &globalconf.event_io_watcher);
 
-  /* Flush the X events queue before blocking */
-  xcb_flush(globalconf.connection);
-
-  /**
-   * Second round-trip
-   */
+  ev_prepare_init(&globalconf.event_prepare_watcher, _unagi_prepare_callback);
+  ev_prepare_start(globalconf.event_loop, &globalconf.event_prepare_watcher);
+  ev_unref(globalconf.event_loop);
 
   /* All the plugins given in the configuration file
 
@@ -539,27 +526,35 @@ main(int argc, char **argv)
   if(!(*globalconf.rendering->init)())
     return EXIT_FAILURE;
 
+  /* Flush the X events queue before blocking */
+  xcb_flush(globalconf.connection);
+
   /* Check ownership for WM_CM_Sn before actually claiming it (ICCCM) */
   xcb_window_t wm_cm_owner_win;
+  unagi_display_round_trip(wm_cm_owner_cookie.sequence);
   if(xcb_ewmh_get_wm_cm_owner_reply(&globalconf.ewmh, wm_cm_owner_cookie,
 				    &wm_cm_owner_win, NULL) &&
      wm_cm_owner_win != XCB_NONE)
     unagi_fatal("A compositing manager is already active (window=%jx)",
                 (uintmax_t) wm_cm_owner_win);
 
-  /* Now send requests to register the CM */
-  unagi_display_register_cm();
-  
-  /**
-   * Third round-trip
-   */
-
   /* Check  extensions  version   and  finish  initialisation  of  the
      rendering backend */
   unagi_display_init_extensions_finalise();
   if(!(*globalconf.rendering->init_finalise)())
     return EXIT_FAILURE;
 
+  /* Validate errors and get PropertyNotify needed to acquire
+     _NET_WM_CM_Sn ownership, already received as the replies above were
+     sent after the CM registration requests */
+  unagi_event_handle_poll_loop(unagi_event_handle_startup);
+
+  _unagi_startup_phase("Extensions and rendering");
+
+  /**
+   * Third round-trip
+   */
+
   xcb_randr_get_screen_info_cookie_t randr_screen_info_cookie = { .sequence = 0 };
   xcb_randr_get_screen_resources_cookie_t randr_screen_resources_cookie = { .sequence = 0 };
   if(globalconf.extensions.randr)
@@ -579,44 +574,58 @@ main(int argc, char **argv)
                              XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE);
     }
 
-  /* Validate  errors   and  get  PropertyNotify   needed  to  acquire
-     _NET_WM_CM_Sn ownership */
-  xcb_aux_sync(globalconf.connection);
-  unagi_event_handle_poll_loop(unagi_event_handle_startup);
-
-  globalconf.keysyms = xcb_key_symbols_alloc(globalconf.connection);
-  xcb_get_modifier_mapping_cookie_t key_mapping_cookie =
-    xcb_get_modifier_mapping_unchecked(globalconf.connection);
-
-  /* Finish CM X registration */
-  if(!unagi_display_register_cm_finalise())
-    unagi_fatal("Could not acquire _NET_WM_CM_Sn ownership");
-
-  /**
-   * Last initialisation round-trip
-   */
+#ifdef HAVE_XCB_PRESENT
+  /* Get CompleteNotify events to synchronise painting with VBlank */
+  if(globalconf.extensions.present)
+    display_vsync_present_init();
+#endif
 
   /* Grab the server before performing redirection and get the tree of
      windows  to ensure  there  won't  be anything  else  at the  same
      time */
   xcb_grab_server(globalconf.connection);
+  const ev_tstamp grab_time = ev_time();
+
+  /* Now redirect windows and get the existing windows */
+  unagi_display_init_redirect();
+
+  /* Finish CM X registration */
+  if(!unagi_display_register_cm_finalise())
+    unagi_fatal("Could not acquire _NET_WM_CM_Sn ownership");
 
-  /* Set the refresh rate (necessary to define painting intervals) and
-     screen sizes and geometries */
+  /* Send the requests to get the refresh rate (necessary to define
+     painting intervals) and screen sizes and geometries */
   unagi_display_update_screen_information(randr_screen_info_cookie,
                                           randr_screen_resources_cookie);
 
-  /* Now redirect windows and add existing windows */
-  unagi_display_init_redirect();
+  /* Send the requests to manage existing windows */
+  unagi_display_init_redirect_finalise();
 
-  /* Validate errors handlers during redirect */
-  xcb_aux_sync(globalconf.connection);
+  /* Validate errors handlers during redirect, already received as the
+     QueryTree reply was sent after the redirection requests */
   unagi_event_handle_poll_loop(unagi_event_handle_startup);
 
-  /* Manage existing windows */
-  unagi_display_init_redirect_finalise();
-
+  /* The requests already sent are processed before the server is
+     ungrabbed, thus the windows state is consistent with the tree and
+     any later change  is reported  by an  event,  so there is no need
+     to hold the grab while waiting for the replies */
   xcb_ungrab_server(globalconf.connection);
+  xcb_flush(globalconf.connection);
+  const ev_tstamp ungrab_time = ev_time();
+
+  _unagi_startup_phase("Ownership and redirection");
+
+  /**
+   * Last initialisation round-trip
+   */
+
+  /* The CRTCs requests were sent before the existing windows ones */
+  unagi_display_update_screen_information_finalise();
+
+  /* Manage existing windows, sending all their requests at once */
+  const int nwindows = unagi_window_manage_existing_finalise();
+
+  _unagi_startup_phase("Screen and existing windows");
 
   /* Check the  plugin requirements  which will disable  plugins which
      don't meet the requirements, but  before initialize D-Bus so that
@@ -626,19 +635,8 @@ main(int argc, char **argv)
 
   unagi_plugin_check_requirements();
 
-  globalconf.repaint_interval = globalconf.refresh_rate_interval;
-
   /* Initialise painting timer depending on the screen refresh rate */
-  ev_init(&globalconf.event_paint_timer_watcher,
-          _unagi_paint_callback);
-
-  /* Painting must have precedence over events processing */
-  ev_set_priority(&globalconf.event_paint_timer_watcher, EV_MAXPRI);
-
-  /* Set the initial repaint interval to the screen refresh rate, it
-     will be adjust later on according to the repaint times */
-  globalconf.event_paint_timer_watcher.repeat = globalconf.repaint_interval;
-  ev_timer_again(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+  unagi_paint_init();
  
   /* Get the lock masks reply of the request previously sent */ 
   unagi_key_lock_mask_get_reply(key_mapping_cookie);
@@ -647,9 +645,23 @@ main(int argc, char **argv)
      may have been received in the meantime */
   xcb_flush(globalconf.connection);
 
-  unagi_window_paint_all(globalconf.windows);
+  unagi_window_paint_all();
   ev_invoke(globalconf.event_loop, &globalconf.event_io_watcher, -1);
 
+  _unagi_startup_phase("First painting");
+
+  const ev_tstamp startup_duration = ev_time() - _unagi_startup_report.start_time;
+  if(_unagi_startup_report.is_enabled)
+    {
+      fprintf(stderr, "%-28s %9.3fms %u round-trip(s)\n", "Total",
+              startup_duration * 1000, unagi_display_round_trips_get());
+
+      unagi_display_round_trips_enable(false);
+    }
+
+  unagi_info("Started in %.3fs with %d windows (server grabbed for %.3fs)",
+             startup_duration, nwindows, ungrab_time - grab_time);
+
   if(globalconf.dbus_connection && !unagi_dbus_ev_init())
     unagi_warn("D-Bus disabled, see warnings above");
 
@@ -657,7 +669,10 @@ main(int argc, char **argv)
   ev_run(globalconf.event_loop, 0);
 
   ev_io_stop(globalconf.event_loop, &globalconf.event_io_watcher);
-  ev_timer_stop(globalconf.event_loop, &globalconf.event_paint_timer_watcher);
+
+  ev_ref(globalconf.event_loop);
+  ev_prepare_stop(globalconf.event_loop, &globalconf.event_prepare_watcher);
+  unagi_paint_stop();
 
   return EXIT_SUCCESS;
 }
@@ -395,6 +395,206 @@ util_itree_size(unagi_util_itree_t *tree)
   return util_itree_size(tree->left) + util_itree_size(tree->right) + 1;
 }
 
+/** Initial number of slots of a hash table (a power of two) */
+#define UTIL_ITABLE_INITIAL_SIZE 64
+
+/** Hash a key, namely an  XID which are mostly sequential within the
+ *  same client, with Fibonacci hashing to spread them over the slots
+ *
+ * \param table The hash table
+ * \param key The key
+ * \return The index of the first slot to look at
+ */
+static inline uint32_t
+util_itable_hash(const unagi_util_itable_t *table, uint32_t key)
+{
+  return (uint32_t) (key * 2654435769U) >> table->shift;
+}
+
+/** Allocate the slots of a hash table
+ *
+ * \param table The hash table
+ * \param size The number of slots, a power of two
+ * \return false in case of malloc error
+ */
+static bool
+util_itable_alloc_slots(unagi_util_itable_t *table, uint32_t size)
+{
+  table->slots = calloc(size, sizeof(unagi_util_itable_slot_t));
+  if(table->slots == NULL)
+    return false;
+
+  table->size = size;
+  table->len = 0;
+
+  for(table->shift = 32; size > 1; size >>= 1)
+    table->shift--;
+
+  return true;
+}
+
+/** Create a new empty hash table
+ *
+ * \return NULL in case of malloc error
+ */
+unagi_util_itable_t *
+util_itable_new(void)
+{
+  unagi_util_itable_t *table = malloc(sizeof(unagi_util_itable_t));
+  if(table == NULL)
+    return NULL;
+
+  if(!util_itable_alloc_slots(table, UTIL_ITABLE_INITIAL_SIZE))
+    {
+      free(table);
+      return NULL;
+    }
+
+  return table;
+}
+
+/** Get the slot where the given key is, or the empty slot where it
+ *  should be inserted
+ *
+ * \param table The hash table
+ * \param key The key
+ * \return The slot
+ */
+static unagi_util_itable_slot_t *
+util_itable_lookup(const unagi_util_itable_t *table, uint32_t key)
+{
+  const uint32_t mask = table->size - 1;
+
+  for(uint32_t i = util_itable_hash(table, key);; i = (i + 1) & mask)
+    if(table->slots[i].key == key || table->slots[i].key == 0)
+      return table->slots + i;
+}
+
+/** Double the number of slots of a hash table and insert again all
+ *  its keys
+ *
+ * \param table The hash table
+ * \return false in case of malloc error
+ */
+static bool
+util_itable_grow(unagi_util_itable_t *table)
+{
+  unagi_util_itable_t old_table = *table;
+
+  if(!util_itable_alloc_slots(table, old_table.size * 2))
+    {
+      *table = old_table;
+      return false;
+    }
+
+  for(uint32_t i = 0; i < old_table.size; i++)
+    if(old_table.slots[i].key)
+      {
+        *util_itable_lookup(table, old_table.slots[i].key) = old_table.slots[i];
+        table->len++;
+      }
+
+  free(old_table.slots);
+  return true;
+}
+
+/** Insert a value in the hash table, keeping it at most half full so
+ *  that probe sequences remain short. The value of an existing key is
+ *  replaced
+ *
+ * \param table The hash table
+ * \param key The key, which must not be 0
+ * \param value The value
+ * \return false in case of malloc error
+ */
+bool
+util_itable_insert(unagi_util_itable_t *table, uint32_t key, void *value)
+{
+  if((table->len + 1) * 2 > table->size && !util_itable_grow(table))
+    return false;
+
+  unagi_util_itable_slot_t *slot = util_itable_lookup(table, key);
+  if(slot->key == 0)
+    {
+      slot->key = key;
+      table->len++;
+    }
+
+  slot->value = value;
+  return true;
+}
+
+/** Get the value corresponding to a key
+ *
+ * \return NULL if key is not found
+ */
+void *
+util_itable_get(const unagi_util_itable_t *table, uint32_t key)
+{
+  if(table == NULL || key == 0)
+    return NULL;
+
+  return util_itable_lookup(table, key)->value;
+}
+
+/** Remove a key from  the hash table.  Instead of leaving a tombstone,
+ *  the following keys of the probe sequence are shifted backward, so
+ *  that lookups never get slower over time
+ *
+ * \param table The hash table
+ * \param key The key
+ */
+void
+util_itable_remove(unagi_util_itable_t *table, uint32_t key)
+{
+  if(key == 0)
+    return;
+
+  unagi_util_itable_slot_t *slot = util_itable_lookup(table, key);
+  if(slot->key == 0)
+    return;
+
+  const uint32_t mask = table->size - 1;
+  uint32_t i = (uint32_t) (slot - table->slots);
+
+  for(uint32_t j = (i + 1) & mask; table->slots[j].key; j = (j + 1) & mask)
+    {
+      const uint32_t k = util_itable_hash(table, table->slots[j].key);
+
+      /* Move the key to the hole if its first slot is not between the
+         hole and its current slot (cyclically) */
+      if(((j - k) & mask) >= ((j - i) & mask))
+        {
+          table->slots[i] = table->slots[j];
+          i = j;
+        }
+    }
+
+  table->slots[i].key = 0;
+  table->slots[i].value = NULL;
+  table->len--;
+}
+
+/** Get the number of keys of a hash table */
+uint32_t
+util_itable_size(const unagi_util_itable_t *table)
+{
+  return table ? table->len : 0;
+}
+
+/** Destroy a hash table. Be careful, you need to manually handle the
+ *  freeing of values
+ */
+void
+unagi_util_itable_free(unagi_util_itable_t *table)
+{
+  if(table == NULL)
+    return;
+
+  free(table->slots);
+  free(table);
+}
+
 #ifdef __DEBUG__
 /** Print the tree, inner function */
 static void
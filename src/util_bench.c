@@ -0,0 +1,212 @@
+/* -*-mode:c;coding:utf-8; c-basic-offset:2;fill-column:70;c-file-style:"gnu"-*-
+ *
+ * This  program is  free  software: you  can  redistribute it  and/or
+ * modify  it under the  terms of  the GNU  General Public  License as
+ * published by the Free Software  Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * General Public License for more details.
+ *
+ * You should have  received a copy of the  GNU General Public License
+ *  along      with      this      program.      If      not,      see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ *  \brief Microbenchmark of the windows lookup structures
+ *
+ *  Compare  the  AVL  tree  previously  used to  look  up  windows
+ *  against the hash table now used instead, for inserting, looking up
+ *  and removing  100, 1000 and 10000  windows identifiers.  This is
+ *  not built by default, run 'make util_bench' in 'src/'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "structs.h"
+#include "util.h"
+
+/** Required by util.c */
+unagi_conf_t globalconf;
+
+/** Number of lookups done for each window */
+#define UTIL_BENCH_LOOKUPS_PER_KEY 16
+
+/** Number of windows for each run */
+static const uint32_t _util_bench_keys_len[] = { 100, 1000, 10000 };
+
+/** Get the current monotonic time
+ *
+ * \return The time in nanoseconds
+ */
+static uint64_t
+util_bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/** Generate window-like identifiers, as allocated by the X server for
+ *  several clients (resource base and increasing resource identifier)
+ *
+ * \param keys The identifiers
+ * \param keys_len The number of identifiers
+ */
+static void
+util_bench_generate_keys(uint32_t *keys, const uint32_t keys_len)
+{
+  for(uint32_t i = 0; i < keys_len; i++)
+    keys[i] = ((uint32_t) (rand() % 64 + 1) << 21) | (i + 1);
+
+  /* Shuffle them so that the order is not the allocation one */
+  for(uint32_t i = keys_len - 1; i > 0; i--)
+    {
+      const uint32_t j = (uint32_t) rand() % (i + 1);
+      const uint32_t key = keys[i];
+      keys[i] = keys[j];
+      keys[j] = key;
+    }
+}
+
+/** Print the result of an operation
+ *
+ * \param name The data structure name
+ * \param operation The operation name
+ * \param elapsed The elapsed time in nanoseconds
+ * \param count The number of operations
+ */
+static void
+util_bench_print(const char *name, const char *operation,
+                 const uint64_t elapsed, const uint32_t count)
+{
+  printf("  %-7s %-7s %10.1f ns/op\n", name, operation,
+         (double) elapsed / (double) count);
+}
+
+/** Benchmark the AVL tree
+ *
+ * \param keys The identifiers
+ * \param keys_len The number of identifiers
+ * \return The number of values found, to prevent optimisation
+ */
+static uint32_t
+util_bench_itree(const uint32_t *keys, const uint32_t keys_len)
+{
+  uint32_t found = 0;
+  uint64_t start = util_bench_now();
+
+  unagi_util_itree_t *tree = util_itree_new();
+  for(uint32_t i = 0; i < keys_len; i++)
+    tree = util_itree_insert(tree, keys[i], (void *) (keys + i));
+
+  util_bench_print("itree", "insert", util_bench_now() - start, keys_len);
+
+  start = util_bench_now();
+  for(uint32_t n = 0; n < UTIL_BENCH_LOOKUPS_PER_KEY; n++)
+    for(uint32_t i = 0; i < keys_len; i++)
+      if(util_itree_get(tree, keys[(i * 7919) % keys_len]))
+        found++;
+
+  util_bench_print("itree", "lookup", util_bench_now() - start,
+                   keys_len * UTIL_BENCH_LOOKUPS_PER_KEY);
+
+  start = util_bench_now();
+  for(uint32_t i = 0; i < keys_len; i++)
+    tree = util_itree_remove(tree, keys[i]);
+
+  util_bench_print("itree", "remove", util_bench_now() - start, keys_len);
+
+  unagi_util_itree_free(tree);
+  return found;
+}
+
+/** Benchmark the hash table
+ *
+ * \param keys The identifiers
+ * \param keys_len The number of identifiers
+ * \return The number of values found, to prevent optimisation
+ */
+static uint32_t
+util_bench_itable(const uint32_t *keys, const uint32_t keys_len)
+{
+  uint32_t found = 0;
+  uint64_t start = util_bench_now();
+
+  unagi_util_itable_t *table = util_itable_new();
+  if(!table)
+    {
+      fprintf(stderr, "Cannot allocate memory for hash table\n");
+      exit(EXIT_FAILURE);
+    }
+
+  for(uint32_t i = 0; i < keys_len; i++)
+    if(!util_itable_insert(table, keys[i], (void *) (keys + i)))
+      {
+        fprintf(stderr, "Cannot allocate memory for hash table\n");
+        exit(EXIT_FAILURE);
+      }
+
+  util_bench_print("itable", "insert", util_bench_now() - start, keys_len);
+
+  start = util_bench_now();
+  for(uint32_t n = 0; n < UTIL_BENCH_LOOKUPS_PER_KEY; n++)
+    for(uint32_t i = 0; i < keys_len; i++)
+      if(util_itable_get(table, keys[(i * 7919) % keys_len]))
+        found++;
+
+  util_bench_print("itable", "lookup", util_bench_now() - start,
+                   keys_len * UTIL_BENCH_LOOKUPS_PER_KEY);
+
+  start = util_bench_now();
+  for(uint32_t i = 0; i < keys_len; i++)
+    util_itable_remove(table, keys[i]);
+
+  util_bench_print("itable", "remove", util_bench_now() - start, keys_len);
+
+  if(util_itable_size(table))
+    {
+      fprintf(stderr, "Hash table not empty after removing all keys\n");
+      exit(EXIT_FAILURE);
+    }
+
+  unagi_util_itable_free(table);
+  return found;
+}
+
+int
+main(void)
+{
+  srand(42);
+
+  for(ssize_t n = 0; n < unagi_countof(_util_bench_keys_len); n++)
+    {
+      const uint32_t keys_len = _util_bench_keys_len[n];
+      uint32_t *keys = malloc(keys_len * sizeof(uint32_t));
+      if(!keys)
+        return EXIT_FAILURE;
+
+      util_bench_generate_keys(keys, keys_len);
+
+      printf("%u windows:\n", keys_len);
+      const uint32_t itree_found = util_bench_itree(keys, keys_len);
+      const uint32_t itable_found = util_bench_itable(keys, keys_len);
+
+      free(keys);
+
+      if(itree_found != itable_found)
+        {
+          fprintf(stderr, "Lookups mismatch: %u != %u\n",
+                  itree_found, itable_found);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -30,13 +30,133 @@
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 #include <xcb/composite.h>
-
-#include <xcb/xcb_aux.h>
+#include <xcb/xcbext.h>
+#include <xcb/shape.h>
 
 #include "window.h"
 #include "structs.h"
 #include "atoms.h"
 #include "display.h"
+#include "region.h"
+
+/** Number of window records allocated at once */
+#define WINDOW_STORE_SLAB_LEN 64
+
+/** Window record,  embedding  the  GetWindowAttributes  and GetGeometry
+    replies rather than allocating them separately */
+typedef struct
+{
+  /** Must be the first member to get the record from the window */
+  unagi_window_t window;
+  xcb_get_window_attributes_reply_t attributes;
+  xcb_get_geometry_reply_t geometry;
+} window_record_t;
+
+/** Window records, allocated by slabs which are only freed on exit */
+static struct
+{
+  /** Slabs of WINDOW_STORE_SLAB_LEN records */
+  window_record_t **slabs;
+  /** Number of slabs */
+  uint32_t slabs_len;
+  /** Records not used, linked through the next field of the window */
+  unagi_window_t *free_records;
+} _window_store;
+
+/** Windows added upon CreateNotify whose GetWindowAttributes reply has
+    not been got yet, in requests order */
+static struct
+{
+  xcb_window_t *ids;
+  /** Number of windows in the queue */
+  uint32_t len;
+  /** Number of windows which can be stored without reallocation */
+  uint32_t size;
+} _window_setup_queue;
+
+/** Get a zeroed window record, allocating a new slab if needed
+ *
+ * \return The window object or NULL in case of malloc error
+ */
+static unagi_window_t *
+window_store_alloc(void)
+{
+  if(!_window_store.free_records)
+    {
+      window_record_t **slabs = realloc(_window_store.slabs,
+                                        (_window_store.slabs_len + 1) *
+                                        sizeof(window_record_t *));
+      if(!slabs)
+        return NULL;
+
+      _window_store.slabs = slabs;
+
+      window_record_t *slab = malloc(WINDOW_STORE_SLAB_LEN *
+                                     sizeof(window_record_t));
+      if(!slab)
+        return NULL;
+
+      _window_store.slabs[_window_store.slabs_len++] = slab;
+
+      for(uint32_t i = WINDOW_STORE_SLAB_LEN; i-- > 0;)
+        {
+          slab[i].window.next = _window_store.free_records;
+          _window_store.free_records = &slab[i].window;
+        }
+    }
+
+  unagi_window_t *window = _window_store.free_records;
+  _window_store.free_records = window->next;
+
+  memset(window, 0, sizeof(window_record_t));
+  window->is_record = true;
+  return window;
+}
+
+/** Give back a window record, once all its resources have been freed,
+ *  copies made by plugins being freed by the plugins themselves
+ *
+ * \param window The window object
+ */
+static void
+window_store_release(unagi_window_t *window)
+{
+  if(!window->is_record)
+    return;
+
+  window->next = _window_store.free_records;
+  _window_store.free_records = window;
+}
+
+/** Free all the slabs of window records */
+static void
+window_store_cleanup(void)
+{
+  for(uint32_t i = 0; i < _window_store.slabs_len; i++)
+    free(_window_store.slabs[i]);
+
+  unagi_util_free(&_window_store.slabs);
+  _window_store.slabs_len = 0;
+  _window_store.free_records = NULL;
+}
+
+/** Set the window geometry, stored in its record, or in the geometry
+ *  allocated by the plugin for a copy
+ *
+ * \param window The window object
+ * \param geometry The window geometry
+ */
+void
+unagi_window_set_geometry(unagi_window_t *window,
+                          const xcb_get_geometry_reply_t *geometry)
+{
+  if(window->is_record)
+    window->geometry = &((window_record_t *) window)->geometry;
+
+  *window->geometry = *geometry;
+
+  unagi_window_stack_update(window);
+}
 
 /** Append a window to the end  of the windows list which is organized
  *  from the bottommost to the topmost window
@@ -47,7 +167,11 @@
 static unagi_window_t *
 window_list_append(const xcb_window_t new_window_id)
 {
-  unagi_window_t *new_window = calloc(1, sizeof(unagi_window_t));
+  unagi_window_t *new_window = window_store_alloc();
+  if(!new_window ||
+     !util_itable_insert(globalconf.windows_itable, new_window_id, new_window))
+    unagi_fatal("Cannot allocate memory for window %jx",
+                (uintmax_t) new_window_id);
 
   new_window->id = new_window_id;
   new_window->prev = NULL;
@@ -67,673 +191,2664 @@ window_list_append(const xcb_window_t new_window_id)
       globalconf.windows_tail = new_window;
     }
 
-  globalconf.windows_itree = util_itree_insert(globalconf.windows_itree,
-                                               new_window_id, new_window);
-
   return new_window;
 }
 
-/** Free a given window and its associated resources
+/** Maximum depth of the client window below the top-level window */
+#define WINDOW_CLIENT_DEPTH_MAX 3
+
+/** Stop looking for the client window, discarding the replies which
+ *  have not been got yet
  *
- * \param window The window object to be freed
- * \param do_itree_remove Should the window be removed from the itree as well
+ * \param window The window object
  */
 static void
-window_list_free_window(unagi_window_t *window, bool do_itree_remove)
+window_client_discard(unagi_window_t *window)
 {
-  if(do_itree_remove)
-    globalconf.windows_itree = util_itree_remove(globalconf.windows_itree,
-                                                 window->id);
-
-  /* Destroy the damage object if any */
-  if(window->damage != XCB_NONE)
-    {
-      xcb_damage_destroy(globalconf.connection, window->damage);
-      window->damage = XCB_NONE;
-    }
-
-  if(window->region != XCB_NONE)
-    {
-      xcb_xfixes_destroy_region(globalconf.connection, window->region);
-      window->region = XCB_NONE;
-    }
-
-  /* TODO: free plugins memory? */
-  unagi_window_free_pixmap(window);
-  (*globalconf.rendering->free_window)(window);
-
-  free(window->attributes);
-  free(window->geometry);
-  free(window);
+  for(uint32_t i = window->client.replies_len;
+      i < window->client.windows_len * 2;
+      i++)
+    xcb_discard_reply(globalconf.connection, window->client.sequences[i]);
+
+  unagi_util_free(&window->client.windows);
+  unagi_util_free(&window->client.sequences);
+  unagi_util_free(&window->client.children);
+
+  window->client.windows_len = 0;
+  window->client.replies_len = 0;
+  window->client.children_len = 0;
 }
 
-/** Remove the given window object from the windows list
+/** Look for the client window among the given windows by sending their
+ *  GetProperty(WM_STATE) and QueryTree requests
  *
- * \param window The window to remove from the windows list
- * \param do_delete If true, also free the memory used by the window structure
+ * \param window The window object
+ * \param windows The windows of the level, freed by the window object
+ * \param windows_len The number of windows
+ * \return false if the memory could not be allocated
  */
-void
-unagi_window_list_remove_window(unagi_window_t *window, bool do_delete)
+static bool
+window_client_lookup_level(unagi_window_t *window, xcb_window_t *windows,
+                           const uint32_t windows_len)
 {
-  if(!window || !globalconf.windows)
-    return;
-
-  if(window->next)
-    window->next->prev = window->prev;
+  unsigned int *sequences = malloc(sizeof(unsigned int) * windows_len * 2);
+  if(!sequences)
+    return false;
 
-  if(window->prev)
-    window->prev->next = window->next;
-
-  if(globalconf.windows == window)
-    globalconf.windows = window->next;
+  for(uint32_t i = 0; i < windows_len; i++)
+    {
+      /* Only the property type is needed to know whether it is set */
+      sequences[i * 2] =
+        xcb_get_property_unchecked(globalconf.connection, false, windows[i],
+                                   UNAGI_WM_STATE, UNAGI_WM_STATE,
+                                   0, 0).sequence;
+
+      sequences[i * 2 + 1] =
+        xcb_query_tree_unchecked(globalconf.connection, windows[i]).sequence;
+    }
 
-  if(globalconf.windows_tail == window)
-    globalconf.windows_tail = window->prev;
+  window->client.windows = windows;
+  window->client.windows_len = windows_len;
+  window->client.sequences = sequences;
+  window->client.depth++;
 
-  if(do_delete)
-    window_list_free_window(window, true);
+  xcb_flush(globalconf.connection);
+  return true;
 }
 
-/** Free all resources allocated for the windows list */
-void
-unagi_window_list_cleanup(void)
+/** Send  the  requests  to  get  _NET_WM_STATE  and
+ *  _NET_WM_BYPASS_COMPOSITOR of the client window
+ *
+ * \param window The window object
+ */
+static void
+window_client_get_unredirect_hints(unagi_window_t *window)
 {
-  unagi_window_t *window = globalconf.windows;
-  unagi_window_t *window_next;
-
-  /* Destroy  the binary  tree,  values will  be  actually freed  when
-     clearing the linked list */
-  unagi_util_itree_free(globalconf.windows_itree);
+  window->wm_state_cookie = xcb_ewmh_get_wm_state_unchecked(&globalconf.ewmh,
+                                                            window->client.id);
 
-  while(window != NULL)
-    {
-      window_next = window->next;
+  window->bypass_compositor_cookie =
+    xcb_get_property_unchecked(globalconf.connection, false,
+                               window->client.id,
+                               UNAGI__NET_WM_BYPASS_COMPOSITOR,
+                               XCB_ATOM_CARDINAL, 0, 1);
 
-      /* Do not  remove it from the  itree as this is  already done by
-         unagi_util_itree_free() */
-      window_list_free_window(window, false);
-      window = window_next;
-    }
+  window->is_unredirect_hints_stale = false;
+  xcb_flush(globalconf.connection);
 }
 
-/** Free  a  Window Pixmap  which  has  been  previously allocated  by
- *  NameWindowPixmap Composite request
+/** Start looking for the client window, the window itself may be the
+ *  client window if it has not been reparented by a window manager
  *
- * \param window The window object to free the Pixmap from
+ * \param window The window object
  */
-void
-unagi_window_free_pixmap(unagi_window_t *window)
+static void
+window_client_lookup(unagi_window_t *window)
 {
-  if(window->pixmap)
+  window_client_discard(window);
+  window->client.id = XCB_NONE;
+  window->client.depth = 0;
+
+  xcb_window_t *windows = malloc(sizeof(xcb_window_t));
+  if(windows)
     {
-      xcb_free_pixmap(globalconf.connection, window->pixmap);
-      window->pixmap = XCB_NONE;
+      windows[0] = window->id;
+      if(window_client_lookup_level(window, windows, 1))
+        return;
 
-      /* If the Pixmap  is freed, then free its  associated Picture as
-	 it does not make sense to keep it */
-      (*globalconf.rendering->free_window_pixmap)(window);
+      free(windows);
     }
+
+  window->client.id = window->id;
+  window->is_unredirect_hints_stale = true;
 }
 
-/** Send ChangeWindowAttributes request in order to get events related
- *  to a window
+/** Poll for the replies of the requests sent to look for the client
+ *  window, going down the hierarchy until a window holding WM_STATE
+ *  is found, the lookup being started first if needed.  Once found,
+ *  its unredirection hints have to be requested
  *
  * \param window The window object
+ * \return true if the client window is known
  */
-void
-unagi_window_register_notify(const unagi_window_t *window)
+static bool
+window_client_resolve(unagi_window_t *window)
 {
-  /* Get transparency notifications */
-  const uint32_t select_input_val = XCB_EVENT_MASK_PROPERTY_CHANGE;
-
-  xcb_change_window_attributes(globalconf.connection, window->id,
-			       XCB_CW_EVENT_MASK, &select_input_val);
-}
-
-/* TODO: Need to figure out a better way to do (not thread-safe!) */
-static xcb_get_property_cookie_t root_background_cookies[2];
+  if(window->client.id != XCB_NONE)
+    return true;
 
-/* Get  the root window  background pixmap  whose identifier  is given
- * usually by either XROOTPMAP_ID or UNAGI__XSETROOT_ID Property Atoms
- */
-void
-unagi_window_get_root_background_pixmap(void)
-{
-  for(uint8_t background_property_n = 0;
-      unagi_background_properties_atoms[background_property_n];
-      background_property_n++)
+  if(!window->client.windows_len)
     {
-      root_background_cookies[background_property_n] =
-	xcb_get_property_unchecked(globalconf.connection, false,
-				   globalconf.screen->root,
-				   *unagi_background_properties_atoms[background_property_n],
-				   XCB_GET_PROPERTY_TYPE_ANY,
-				   0, 4);
+      window_client_lookup(window);
+      return window->client.id != XCB_NONE;
     }
-}
-
-/** Get the  first Property  whose reply is  valid and get  the stored
- *  Pixmap
- *
- * \return The root window background image Pixmap, otherwise None
- */
-xcb_pixmap_t
-unagi_window_get_root_background_pixmap_finalise(void)
-{
-  xcb_pixmap_t root_background_pixmap = XCB_NONE;
-  xcb_get_property_reply_t *root_property_reply;
 
-  for(uint8_t background_property_n = 0;
-      unagi_background_properties_atoms[background_property_n];
-      background_property_n++)
+  while(window->client.id == XCB_NONE)
     {
-      assert(root_background_cookies[background_property_n].sequence);
+      while(window->client.replies_len < window->client.windows_len * 2)
+        {
+          const uint32_t n = window->client.replies_len;
+          void *reply = NULL;
+          xcb_generic_error_t *error = NULL;
 
-      root_property_reply =
-	xcb_get_property_reply(globalconf.connection,
-			       root_background_cookies[background_property_n],
-			       NULL);
+          if(!xcb_poll_for_reply(globalconf.connection,
+                                 window->client.sequences[n], &reply, &error))
+            return false;
 
-      if(root_property_reply && root_property_reply->type == XCB_ATOM_PIXMAP &&
-	 (xcb_get_property_value_length(root_property_reply)) == 4)
-	{
-	  memcpy(&root_background_pixmap,
-		 xcb_get_property_value(root_property_reply), 4);
+          window->client.replies_len++;
+          free(error);
 
-	  free(root_property_reply);
-	  break;
-	}
+          /* The window may have been destroyed in the meantime */
+          if(!reply)
+            continue;
+
+          if(n % 2 == 0)
+            {
+              const bool has_wm_state =
+                ((xcb_get_property_reply_t *) reply)->type != XCB_NONE;
+
+              free(reply);
+              if(has_wm_state)
+                {
+                  window->client.id = window->client.windows[n / 2];
+                  break;
+                }
+            }
+          else
+            {
+              const int children_len =
+                xcb_query_tree_children_length(reply);
+
+              xcb_window_t *children = children_len <= 0 ? NULL :
+                realloc(window->client.children, sizeof(xcb_window_t) *
+                        (window->client.children_len + (uint32_t) children_len));
+
+              if(children)
+                {
+                  memcpy(children + window->client.children_len,
+                         xcb_query_tree_children(reply),
+                         sizeof(xcb_window_t) * (size_t) children_len);
+
+                  window->client.children = children;
+                  window->client.children_len += (uint32_t) children_len;
+                }
+
+              free(reply);
+            }
+        }
 
-      free(root_property_reply);
+      if(window->client.id != XCB_NONE)
+        break;
 
-      unagi_debug("Can't get such property for the root window");
+      /* Look at the next level, if any, otherwise assume the window
+         is the client window itself */
+      xcb_window_t *children = window->client.children;
+      const uint32_t children_len = window->client.children_len;
+      window->client.children = NULL;
+      window_client_discard(window);
+
+      if(!children_len || window->client.depth > WINDOW_CLIENT_DEPTH_MAX ||
+         !window_client_lookup_level(window, children, children_len))
+        {
+          free(children);
+          window->client.id = window->id;
+        }
     }
 
-  return root_background_pixmap;
+  window_client_discard(window);
+
+  /* PropertyNotify  events  of  the  client window  are  needed  when
+     reparented, they are already selected on the window otherwise */
+  if(window->client.id != window->id)
+    {
+      const uint32_t select_input_val = XCB_EVENT_MASK_PROPERTY_CHANGE;
+
+      xcb_change_window_attributes(globalconf.connection, window->client.id,
+                                   XCB_CW_EVENT_MASK, &select_input_val);
+    }
+
+  window->is_unredirect_hints_stale = true;
+  return true;
 }
 
-/** Create a new Pixmap for the  root Window background if there is no
- *  image set
+/** Discard the replies of the _NET_WM_STATE and
+ *  _NET_WM_BYPASS_COMPOSITOR requests which have not been got yet, and
+ *  of the requests sent to look for the client window
  *
- * \return The new Pixmap
+ * \param window The window object
  */
-xcb_pixmap_t
-unagi_window_new_root_background_pixmap(void)
+static void
+window_discard_unredirect_hints(unagi_window_t *window)
 {
-  xcb_pixmap_t root_pixmap = xcb_generate_id(globalconf.connection);
+  window_client_discard(window);
 
-  xcb_create_pixmap(globalconf.connection, globalconf.screen->root_depth,
-		    root_pixmap, globalconf.screen->root, 1, 1);
+  if(window->wm_state_cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection, window->wm_state_cookie.sequence);
+      window->wm_state_cookie.sequence = 0;
+    }
 
-  return root_pixmap;
+  if(window->bypass_compositor_cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection,
+                        window->bypass_compositor_cookie.sequence);
+      window->bypass_compositor_cookie.sequence = 0;
+    }
 }
 
-/** Get  the Pixmap  associated with  the  given Window  by sending  a
- *  NameWindowPixmap Composite  request. Must be careful  when to free
- *  this Pixmap, because  a new one is generated  each time the window
- *  is mapped or resized
+/** Region used as repair Region of DamageSubtract */
+static xcb_xfixes_region_t _window_repair_region = XCB_NONE;
+
+/** Coverage of the  damages received by the windows since they were
+    last painted,  kept aside from the  window objects as plugins may
+    copy these ones */
+static struct
+{
+  /** Damaged windows */
+  struct
+  {
+    /** Window XID */
+    xcb_window_t id;
+    /** Union of the damaged areas, relative to the window */
+    unagi_region_t region;
+  } *windows;
+  /** Number of damaged windows */
+  uint32_t len;
+  /** Number of elements which can be stored without reallocation */
+  uint32_t size;
+} _window_damaged_coverage;
+
+/** Get the damaged coverage of the given window from its index
  *
  * \param window The window object
- * \return The Pixmap associated with the Window
+ * \return The damaged coverage region or NULL if none
  */
-xcb_pixmap_t
-unagi_window_get_pixmap(const unagi_window_t *window)
+static unagi_region_t *
+window_get_damaged_coverage(const unagi_window_t *window)
 {
-  /* Update the pixmap thanks to CompositeNameWindowPixmap */
-  xcb_pixmap_t pixmap = xcb_generate_id(globalconf.connection);
+  const uint32_t index = window->damaged_coverage_index;
 
-  xcb_composite_name_window_pixmap(globalconf.connection,
-				   window->id,
-				   pixmap);
+  if(!index || index > _window_damaged_coverage.len ||
+     _window_damaged_coverage.windows[index - 1].id != window->id)
+    return NULL;
 
-  return pixmap;
+  return &_window_damaged_coverage.windows[index - 1].region;
 }
 
-/** Check whether the given window is rectangular to optimize painting
- *  as most windows are rectangular
+/** Forget the damaged coverage of the given window, the memory of its
+ *  region being kept for the next damaged window
  *
  * \param window The window object
- * \return True if the window is rectangular
  */
-bool
-unagi_window_is_rectangular(unagi_window_t *window)
+static void
+window_discard_damaged_coverage(unagi_window_t *window)
 {
-  if(!window->shape_cookie.sequence)
-    return window->is_rectangular;
-
-  xcb_xfixes_fetch_region_reply_t *r =
-    xcb_xfixes_fetch_region_reply(globalconf.connection,
-                                  window->shape_cookie,
-                                  NULL);
-  if(r)
+  if(!window_get_damaged_coverage(window))
     {
-      window->is_rectangular = xcb_xfixes_fetch_region_rectangles_length(r) <= 1;
-      free(r);
+      window->damaged_coverage_index = 0;
+      return;
     }
-  else
-    window->is_rectangular = true;
 
-  window->shape_cookie.sequence = 0;
+  const uint32_t i = window->damaged_coverage_index - 1;
+  const uint32_t last = --_window_damaged_coverage.len;
+  window->damaged_coverage_index = 0;
 
-  return window->is_rectangular;
+  if(i != last)
+    {
+      const unagi_region_t region = _window_damaged_coverage.windows[i].region;
+      _window_damaged_coverage.windows[i] = _window_damaged_coverage.windows[last];
+      _window_damaged_coverage.windows[last].region = region;
+
+      /* The last damaged coverage has been moved */
+      unagi_window_t *moved =
+        unagi_window_list_get(_window_damaged_coverage.windows[i].id);
+      if(moved)
+        moved->damaged_coverage_index = i + 1;
+    }
 }
 
-/** No need to include Shape extension header just for that */
-#define XCB_SHAPE_SK_BOUNDING 0
+/** Free the memory allocated for the damaged coverage */
+static void
+window_damaged_coverage_cleanup(void)
+{
+  for(uint32_t i = 0; i < _window_damaged_coverage.size; i++)
+    unagi_region_free(&_window_damaged_coverage.windows[i].region);
 
-/** Get   the  region   of  the   given  Window   and  take   care  of
- *  non-rectangular windows by using CreateRegionFromWindow instead of
- *  Window size and position
+  unagi_util_free(&_window_damaged_coverage.windows);
+  _window_damaged_coverage.len = 0;
+  _window_damaged_coverage.size = 0;
+}
+
+/** Add the given damaged area to the damaged coverage of the window and
+ *  update its damaged ratio, that is to say the part of the window
+ *  actually covered by the union of the damaged areas
  *
  * \param window The window object
- * \return The region associated with the given Window
+ * \param area The damaged area, relative to the window
+ * \return The damaged ratio
  */
-xcb_xfixes_region_t
-unagi_window_get_region(unagi_window_t *window, bool screen_relative, bool check_shape)
+float
+unagi_window_add_damaged_area(unagi_window_t *window,
+                              const xcb_rectangle_t *area)
 {
-  xcb_xfixes_region_t new_region = xcb_generate_id(globalconf.connection);
+  const int32_t width = window->geometry->width;
+  const int32_t height = window->geometry->height;
 
-  xcb_xfixes_create_region_from_window(globalconf.connection,
-                                       new_region,
-                                       window->id,
-                                       XCB_SHAPE_SK_BOUNDING);
+  if(!width || !height)
+    return window->damaged_ratio = 1.0;
 
+  unagi_region_t *region = window_get_damaged_coverage(window);
+  if(!region)
+    {
+      if(_window_damaged_coverage.len == _window_damaged_coverage.size)
+        {
+          const uint32_t size = _window_damaged_coverage.size ?
+            _window_damaged_coverage.size * 2 : 16;
 
-  if(screen_relative)
-    xcb_xfixes_translate_region(globalconf.connection,
-                                new_region,
-                                (int16_t) (window->geometry->x +
-                                           window->geometry->border_width),
-                                (int16_t) (window->geometry->y +
-                                           window->geometry->border_width));
+          void *windows = realloc(_window_damaged_coverage.windows,
+                                  sizeof(*_window_damaged_coverage.windows) * size);
+          if(!windows)
+            return window->damaged_ratio = 1.0;
 
-  unagi_debug("Created new region %x from window %x", new_region, window->id);
+          _window_damaged_coverage.windows = windows;
+          for(uint32_t i = _window_damaged_coverage.size; i < size; i++)
+            unagi_region_init(&_window_damaged_coverage.windows[i].region);
+
+          _window_damaged_coverage.size = size;
+        }
+
+      _window_damaged_coverage.windows[_window_damaged_coverage.len].id = window->id;
+      region = &_window_damaged_coverage.windows[_window_damaged_coverage.len++].region;
+      window->damaged_coverage_index = _window_damaged_coverage.len;
+      unagi_region_reset(region);
+    }
+
+  /* Only the window content is damaged, not its border */
+  const unagi_region_box_t box = {
+    max(area->x, 0), max(area->y, 0),
+    min(area->x + area->width, width), min(area->y + area->height, height)
+  };
+
+  if(!unagi_region_box_is_empty(&box) && !unagi_region_union_box(region, &box))
+    return window->damaged_ratio = 1.0;
+
+  window->damaged_ratio = (float) ((double) unagi_region_area(region) /
+                                   ((double) width * (double) height));
+
+  return window->damaged_ratio;
+}
+
+/** Pixels needlessly repainted  so far by all the windows, including
+    the ones which do not exist anymore */
+static uint64_t _window_wasted_pixels;
+
+/** Account the pixels  needlessly repainted when the whole window is
+ *  repainted whereas only a part of it has been damaged
+ *
+ * \param window The window object
+ */
+void
+unagi_window_account_wasted_pixels(unagi_window_t *window)
+{
+  const uint64_t area = (uint64_t) window->geometry->width *
+    (uint64_t) window->geometry->height;
 
-  if(check_shape)
+  const unagi_region_t *region = window_get_damaged_coverage(window);
+  const uint64_t damaged_area = region ? unagi_region_area(region) : 0;
+
+  if(damaged_area < area)
     {
-      window->shape_cookie = xcb_xfixes_fetch_region_unchecked(globalconf.connection,
-                                                               new_region);
+      window->wasted_pixels += area - damaged_area;
+      _window_wasted_pixels += area - damaged_area;
+    }
 
-      xcb_flush(globalconf.connection);
+  unagi_debug("Window %jx fully repainted: %ju pixels wasted so far",
+              (uintmax_t) window->id, (uintmax_t) window->wasted_pixels);
+}
+
+/** Get the number of pixels needlessly repainted so far by all windows
+ *
+ * \return The number of wasted pixels
+ */
+uint64_t
+unagi_window_get_wasted_pixels(void)
+{
+  return _window_wasted_pixels;
+}
+
+/** Free a given window and its associated resources
+ *
+ * \param window The window object to be freed
+ * \param do_itable_remove Should the window be removed from the hash table as well
+ */
+static void
+window_list_free_window(unagi_window_t *window, bool do_itable_remove)
+{
+  if(do_itable_remove)
+    util_itable_remove(globalconf.windows_itable, window->id);
+
+  unagi_window_stack_remove(window);
+
+  /* Destroy the damage object if any */
+  if(window->damage != XCB_NONE)
+    {
+      xcb_damage_destroy(globalconf.connection, window->damage);
+      window->damage = XCB_NONE;
     }
 
-  return new_region;
+  if(window->region != XCB_NONE)
+    {
+      xcb_xfixes_destroy_region(globalconf.connection, window->region);
+      window->region = XCB_NONE;
+    }
+
+  window_discard_damaged_coverage(window);
+
+  /* The pending requests and the client window lookup are only owned by
+     the record, not by the copies made by plugins */
+  if(window->is_record)
+    {
+      window_discard_unredirect_hints(window);
+      unagi_window_discard_shape(window);
+
+      if(window->setup.is_pending)
+        xcb_discard_reply(globalconf.connection, window->setup.cookie.sequence);
+
+      if(window->opaque_region.cookie.sequence)
+        xcb_discard_reply(globalconf.connection,
+                          window->opaque_region.cookie.sequence);
+
+      if(window->damage_rate.wm_class_cookie.sequence)
+        xcb_discard_reply(globalconf.connection,
+                          window->damage_rate.wm_class_cookie.sequence);
+    }
+
+  /* TODO: free plugins memory? */
+  unagi_window_free_pixmap(window);
+  (*globalconf.rendering->free_window)(window);
+
+  window_store_release(window);
 }
 
-/** Check whether the window is visible within the screen geometry
+/** Copy a window object for a plugin (e.g. Expose), without the pending
+ *  requests nor the client window lookup which are only owned by the
+ *  window record
+ *
+ * \param copy The window object to copy to
+ * \param window The window object to copy
+ */
+void
+unagi_window_copy(unagi_window_t *copy, const unagi_window_t *window)
+{
+  memcpy(copy, window, sizeof(unagi_window_t));
+  copy->is_record = false;
+
+  copy->setup.is_pending = false;
+  copy->setup.cookie.sequence = 0;
+  copy->shape.cookie.sequence = 0;
+  copy->wm_state_cookie.sequence = 0;
+  copy->bypass_compositor_cookie.sequence = 0;
+  memset(&copy->client, 0, sizeof(copy->client));
+  copy->opaque_region.cookie.sequence = 0;
+  copy->damage_rate.wm_class_cookie.sequence = 0;
+}
+
+/** Remove the given window object from the windows list
+ *
+ * \param window The window to remove from the windows list
+ * \param do_delete If true, also free the memory used by the window structure
+ */
+void
+unagi_window_list_remove_window(unagi_window_t *window, bool do_delete)
+{
+  if(!window || !globalconf.windows)
+    return;
+
+  if(window->next)
+    window->next->prev = window->prev;
+
+  if(window->prev)
+    window->prev->next = window->next;
+
+  if(globalconf.windows == window)
+    globalconf.windows = window->next;
+
+  if(globalconf.windows_tail == window)
+    globalconf.windows_tail = window->prev;
+
+  if(do_delete)
+    window_list_free_window(window, true);
+}
+
+/** Viewable  windows sorted from the bottommost to the topmost, kept
+    in sync with the windows list upon MapNotify, UnmapNotify and
+    restacking so that painting only walks contiguous memory */
+static struct
+{
+  unagi_window_stack_entry_t *entries;
+  /** Number of windows in the array */
+  uint32_t len;
+  /** Number of windows which can be stored without reallocation */
+  uint32_t size;
+} _window_stack;
+
+/** Check whether the window may be painted and thus belongs to the
+ *  stacking array, namely it is viewable and not InputOnly
  *
  * \param window The window object
- * \return true if the window is visible
+ * \return true if the window has to be in the stacking array
  */
-bool
-unagi_window_is_visible(const unagi_window_t *window)
+static inline bool
+window_is_stackable(const unagi_window_t *window)
 {
   return (window->attributes &&
           window->attributes->map_state == XCB_MAP_STATE_VIEWABLE &&
-          window->geometry &&
-	  window->geometry->x + window->geometry->width >= 1 &&
-	  window->geometry->y + window->geometry->height >= 1 &&
-	  window->geometry->x < globalconf.screen->width_in_pixels &&
-	  window->geometry->y < globalconf.screen->height_in_pixels);
+          window->attributes->_class != XCB_WINDOW_CLASS_INPUT_ONLY &&
+          window->geometry);
 }
 
-/** Send ChangeWindowAttributes  request to set  the override-redirect
- *  flag  on the  given window  to define  whether the  window manager
- *  should take care of the window or not
+/** Check whether the window of a stacking array entry is on the screen,
+ *  as unagi_window_is_visible() but only reading the entry itself
+ *
+ * \param entry The stacking array entry
+ * \return true if the window is visible
+ */
+static inline bool
+window_stack_entry_is_visible(const unagi_window_stack_entry_t *entry)
+{
+  return (entry->box.x2 >= 1 && entry->box.y2 >= 1 &&
+          entry->box.x1 < globalconf.screen->width_in_pixels &&
+          entry->box.y1 < globalconf.screen->height_in_pixels);
+}
+
+/** Set the fields of a stacking array entry from the window, the box
+ *  being computed from the window geometry
+ *
+ * \param entry The stacking array entry
+ */
+static inline void
+window_stack_set_entry(unagi_window_stack_entry_t *entry)
+{
+  const unagi_window_t *window = entry->window;
+  const xcb_get_geometry_reply_t *geometry = window->geometry;
+
+  entry->box.x1 = geometry->x;
+  entry->box.y1 = geometry->y;
+  entry->box.x2 = geometry->x + window_width_with_border(geometry);
+  entry->box.y2 = geometry->y + window_height_with_border(geometry);
+
+  entry->is_damaged = window->damaged;
+  entry->pixmap = window->pixmap;
+}
+
+/** Update the index of the windows whose entry has been moved
+ *
+ * \param from The index of the first entry moved
+ */
+static void
+window_stack_reindex(const uint32_t from)
+{
+  for(uint32_t i = from; i < _window_stack.len; i++)
+    _window_stack.entries[i].window->stack_index = i;
+}
+
+/** Insert the window  in the stacking array if it is viewable, right
+ *  above the nearest viewable window below it in the windows list
  *
  * \param window The window object
- * \param do_override_redirect The value to set to override-redirect flag
  */
-static inline void
-window_set_override_redirect(const unagi_window_t *window,
-			     const uint32_t do_override_redirect)
+void
+unagi_window_stack_insert(unagi_window_t *window)
+{
+  if(window->is_stacked || !window_is_stackable(window))
+    return;
+
+  if(_window_stack.len == _window_stack.size)
+    {
+      const uint32_t size = _window_stack.size ? _window_stack.size * 2 : 64;
+      unagi_window_stack_entry_t *entries =
+        realloc(_window_stack.entries, sizeof(unagi_window_stack_entry_t) * size);
+
+      if(!entries)
+        unagi_fatal("Cannot allocate memory for the stacking array");
+
+      _window_stack.entries = entries;
+      _window_stack.size = size;
+    }
+
+  unagi_window_t *window_below;
+  for(window_below = window->prev;
+      window_below && !window_below->is_stacked;
+      window_below = window_below->prev)
+    ;
+
+  const uint32_t index = window_below ? window_below->stack_index + 1 : 0;
+
+  memmove(_window_stack.entries + index + 1, _window_stack.entries + index,
+          sizeof(unagi_window_stack_entry_t) * (_window_stack.len - index));
+
+  _window_stack.len++;
+
+  unagi_window_stack_entry_t *entry = _window_stack.entries + index;
+  entry->window = window;
+  entry->id = window->id;
+  /* The visual of a window never changes */
+  entry->is_argb = (*globalconf.rendering->is_window_argb)(window);
+  window_stack_set_entry(entry);
+
+  window->is_stacked = true;
+  window_stack_reindex(index);
+}
+
+/** Remove the window from the stacking array if it is there
+ *
+ * \param window The window object
+ */
+void
+unagi_window_stack_remove(unagi_window_t *window)
+{
+  if(!window->is_stacked)
+    return;
+
+  const uint32_t index = window->stack_index;
+
+  _window_stack.len--;
+  memmove(_window_stack.entries + index, _window_stack.entries + index + 1,
+          sizeof(unagi_window_stack_entry_t) * (_window_stack.len - index));
+
+  window->is_stacked = false;
+  window_stack_reindex(index);
+}
+
+/** Update the stacking array entry of the window when its geometry,
+ *  damaged field or Pixmap has changed
+ *
+ * \param window The window object
+ */
+void
+unagi_window_stack_update(unagi_window_t *window)
+{
+  if(window->is_stacked)
+    window_stack_set_entry(_window_stack.entries + window->stack_index);
+}
+
+/** Build the stacking array again from the windows list, when the list
+ *  itself has been replaced (e.g. by Expose plugin)
+ */
+void
+unagi_window_stack_rebuild(void)
+{
+  for(uint32_t i = 0; i < _window_stack.len; i++)
+    _window_stack.entries[i].window->is_stacked = false;
+
+  _window_stack.len = 0;
+
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    {
+      window->is_stacked = false;
+      unagi_window_stack_insert(window);
+    }
+}
+
+/** Get the viewable windows, from the bottommost to the topmost
+ *
+ * \param len The number of windows
+ * \return The stacking array entries
+ */
+const unagi_window_stack_entry_t *
+unagi_window_stack_get(uint32_t *len)
+{
+  *len = _window_stack.len;
+  return _window_stack.entries;
+}
+
+/** Free the memory allocated for the stacking array */
+static void
+window_stack_cleanup(void)
+{
+  for(uint32_t i = 0; i < _window_stack.len; i++)
+    _window_stack.entries[i].window->is_stacked = false;
+
+  unagi_util_free(&_window_stack.entries);
+  _window_stack.len = 0;
+  _window_stack.size = 0;
+}
+
+/** Scratch memory of the occlusion culling, kept across repaints to
+    avoid allocating it each time */
+static struct
+{
+  /** Part of each window which is not covered by opaque windows */
+  unagi_region_t *visible_regions;
+  /** Number of elements which can be stored in the arrays above */
+  uint32_t size;
+  /** Region covered by opaque windows painted so far */
+  unagi_region_t opaque_region;
+  /** Opaque part of the current ARGB window */
+  unagi_region_t window_opaque_region;
+} _window_occlusion;
+
+/** Free the memory allocated for the occlusion culling */
+static void
+window_occlusion_cleanup(void)
+{
+  for(uint32_t i = 0; i < _window_occlusion.size; i++)
+    unagi_region_free(&_window_occlusion.visible_regions[i]);
+
+  unagi_util_free(&_window_occlusion.visible_regions);
+  unagi_region_free(&_window_occlusion.opaque_region);
+  unagi_region_free(&_window_occlusion.window_opaque_region);
+  _window_occlusion.size = 0;
+}
+
+/** Free all resources allocated for the windows list */
+void
+unagi_window_list_cleanup(void)
+{
+  unagi_window_t *window = globalconf.windows;
+  unagi_window_t *window_next;
+
+  /* Destroy the hash table, values will be actually freed when
+     clearing the linked list */
+  unagi_util_itable_free(globalconf.windows_itable);
+  globalconf.windows_itable = NULL;
+
+  /* Likewise, do not remove the windows from the stacking array one by
+     one */
+  window_stack_cleanup();
+
+  while(window != NULL)
+    {
+      window_next = window->next;
+
+      /* Do not remove it from the hash table as this is already done
+         by unagi_util_itable_free() */
+      window_list_free_window(window, false);
+      window = window_next;
+    }
+
+  window_store_cleanup();
+
+  unagi_util_free(&_window_setup_queue.ids);
+  _window_setup_queue.len = 0;
+  _window_setup_queue.size = 0;
+
+  window_occlusion_cleanup();
+  window_damaged_coverage_cleanup();
+
+  if(_window_repair_region)
+    {
+      xcb_xfixes_destroy_region(globalconf.connection, _window_repair_region);
+      _window_repair_region = XCB_NONE;
+    }
+}
+
+/** Free  a  Window Pixmap  which  has  been  previously allocated  by
+ *  NameWindowPixmap Composite request
+ *
+ * \param window The window object to free the Pixmap from
+ */
+void
+unagi_window_free_pixmap(unagi_window_t *window)
+{
+  if(window->pixmap)
+    {
+      xcb_free_pixmap(globalconf.connection, window->pixmap);
+      window->pixmap = XCB_NONE;
+      unagi_window_stack_update(window);
+
+      /* If the Pixmap  is freed, then free its  associated Picture as
+	 it does not make sense to keep it */
+      (*globalconf.rendering->free_window_pixmap)(window);
+    }
+
+  window->resize.is_pending = false;
+}
+
+/** Get the size  of the Pixmap currently held for  the window, which
+ *  differs from the  window size while a resize  is pending, in which
+ *  case the window is painted clipped to the previous Pixmap
+ *
+ * \param window The window object
+ * \param width The Pixmap width (including border)
+ * \param height The Pixmap height (including border)
+ */
+void
+unagi_window_get_pixmap_size(const unagi_window_t *window,
+                             uint16_t *width, uint16_t *height)
+{
+  *width = (uint16_t) window_width_with_border(window->geometry);
+  *height = (uint16_t) window_height_with_border(window->geometry);
+
+  if(window->resize.is_pending)
+    {
+      *width = min(*width, window->resize.width);
+      *height = min(*height, window->resize.height);
+    }
+}
+
+/** Send ChangeWindowAttributes request in order to get events related
+ *  to a window
+ *
+ * \param window The window object
+ */
+void
+unagi_window_register_notify(const unagi_window_t *window)
+{
+  /* Get transparency notifications */
+  const uint32_t select_input_val = XCB_EVENT_MASK_PROPERTY_CHANGE;
+
+  xcb_change_window_attributes(globalconf.connection, window->id,
+			       XCB_CW_EVENT_MASK, &select_input_val);
+}
+
+/* TODO: Need to figure out a better way to do (not thread-safe!) */
+static xcb_get_property_cookie_t root_background_cookies[2];
+
+/* Get  the root window  background pixmap  whose identifier  is given
+ * usually by either XROOTPMAP_ID or UNAGI__XSETROOT_ID Property Atoms
+ */
+void
+unagi_window_get_root_background_pixmap(void)
+{
+  for(uint8_t background_property_n = 0;
+      unagi_background_properties_atoms[background_property_n];
+      background_property_n++)
+    {
+      root_background_cookies[background_property_n] =
+	xcb_get_property_unchecked(globalconf.connection, false,
+				   globalconf.screen->root,
+				   *unagi_background_properties_atoms[background_property_n],
+				   XCB_GET_PROPERTY_TYPE_ANY,
+				   0, 4);
+    }
+}
+
+/** Get the  first Property  whose reply is  valid and get  the stored
+ *  Pixmap
+ *
+ * \return The root window background image Pixmap, otherwise None
+ */
+xcb_pixmap_t
+unagi_window_get_root_background_pixmap_finalise(void)
+{
+  xcb_pixmap_t root_background_pixmap = XCB_NONE;
+  xcb_get_property_reply_t *root_property_reply;
+
+  for(uint8_t background_property_n = 0;
+      unagi_background_properties_atoms[background_property_n];
+      background_property_n++)
+    {
+      assert(root_background_cookies[background_property_n].sequence);
+      unagi_display_round_trip(root_background_cookies[background_property_n].sequence);
+
+      root_property_reply =
+	xcb_get_property_reply(globalconf.connection,
+			       root_background_cookies[background_property_n],
+			       NULL);
+
+      if(root_property_reply && root_property_reply->type == XCB_ATOM_PIXMAP &&
+	 (xcb_get_property_value_length(root_property_reply)) == 4)
+	{
+	  memcpy(&root_background_pixmap,
+		 xcb_get_property_value(root_property_reply), 4);
+
+	  free(root_property_reply);
+	  break;
+	}
+
+      free(root_property_reply);
+
+      unagi_debug("Can't get such property for the root window");
+    }
+
+  return root_background_pixmap;
+}
+
+/** Create a new Pixmap for the  root Window background if there is no
+ *  image set
+ *
+ * \return The new Pixmap
+ */
+xcb_pixmap_t
+unagi_window_new_root_background_pixmap(void)
+{
+  xcb_pixmap_t root_pixmap = xcb_generate_id(globalconf.connection);
+
+  xcb_create_pixmap(globalconf.connection, globalconf.screen->root_depth,
+		    root_pixmap, globalconf.screen->root, 1, 1);
+
+  return root_pixmap;
+}
+
+/** Get  the Pixmap  associated with  the  given Window  by sending  a
+ *  NameWindowPixmap Composite  request. Must be careful  when to free
+ *  this Pixmap, because  a new one is generated  each time the window
+ *  is mapped or resized
+ *
+ * \param window The window object
+ * \return The Pixmap associated with the Window
+ */
+xcb_pixmap_t
+unagi_window_get_pixmap(const unagi_window_t *window)
+{
+  /* NameWindowPixmap fails on windows which are not redirected */
+  if(unagi_display_is_unredirected())
+    return XCB_NONE;
+
+  /* Update the pixmap thanks to CompositeNameWindowPixmap */
+  xcb_pixmap_t pixmap = xcb_generate_id(globalconf.connection);
+
+  xcb_composite_name_window_pixmap(globalconf.connection,
+				   window->id,
+				   pixmap);
+
+  return pixmap;
+}
+
+/** Acquire the Region and Pixmap of a window mapped since the last
+ *  repaint, this is only done when it is about to be painted
+ *
+ * \param window The window object
+ */
+void
+unagi_window_acquire(unagi_window_t *window)
+{
+  if(!window->is_acquire_pending)
+    return;
+
+  window->is_acquire_pending = false;
+
+  /* Without ShapeNotify, the shape may have changed while unmapped */
+  if(!globalconf.extensions.shape)
+    unagi_window_discard_shape(window);
+
+  /* Create and store the region associated with the window to avoid
+     creating regions all the time, this Region will be destroyed only
+     upon UnmapNotify or DestroyNotify or re-created upon
+     ConfigureNotify */
+  if(window->region)
+    xcb_xfixes_destroy_region(globalconf.connection, window->region);
+
+  window->region = unagi_window_get_region(window, true, true);
+
+  /* Everytime a window is mapped, a new pixmap is created */
+  unagi_window_free_pixmap(window);
+  window->pixmap = unagi_window_get_pixmap(window);
+  unagi_window_stack_update(window);
+
+  /* PropertyNotify events are not received while the window is
+     unmapped, so get the unredirection hints again */
+  unagi_window_update_unredirect_hints(window, XCB_NONE);
+  unagi_window_update_damage_rate_max(window);
+  unagi_window_update_opaque_region(window);
+}
+
+/** Forget  _NET_WM_STATE  and  _NET_WM_BYPASS_COMPOSITOR of the client
+ *  window, the properties telling whether the window may be
+ *  unredirected.  When the window has just been mapped, the client
+ *  window is forgotten as well.  Nothing is requested here: the client
+ *  window is  looked for and the properties are requested only when
+ *  the window is evaluated for unredirection, thus never when it is
+ *  disabled, and only for the topmost window
+ *
+ * \param window The window object
+ * \param atom The property which has changed, or None for both
+ */
+void
+unagi_window_update_unredirect_hints(unagi_window_t *window,
+                                     const xcb_atom_t atom)
+{
+  /* Copies made by plugins never own requests */
+  if(!window->is_record)
+    return;
+
+  if(atom == XCB_NONE)
+    {
+      window_discard_unredirect_hints(window);
+      window->is_fullscreen = false;
+      window->bypass_compositor = 0;
+      window->client.id = XCB_NONE;
+      window->client.depth = 0;
+    }
+  /* Otherwise requested once the client window is found */
+  else if(window->client.id != XCB_NONE)
+    {
+      window_discard_unredirect_hints(window);
+      window->is_unredirect_hints_stale = true;
+    }
+}
+
+/** Get the window whose client window is the given one
+ *
+ * \param id The client window identifier
+ * \return The window object or NULL
+ */
+unagi_window_t *
+unagi_window_get_by_client(const xcb_window_t id)
+{
+  for(uint32_t i = 0; i < _window_stack.len; i++)
+    if(_window_stack.entries[i].window->client.id == id)
+      return _window_stack.entries[i].window;
+
+  return NULL;
+}
+
+/** Send the request to get _NET_WM_OPAQUE_REGION of an ARGB window, only
+ *  meaningful for these windows as the others are entirely opaque.
+ *  Until the reply is received, no part of the window is considered
+ *  opaque
+ *
+ * \param window The window object
+ */
+void
+unagi_window_update_opaque_region(unagi_window_t *window)
+{
+  /* Copies made by plugins never own requests */
+  if(!window->is_record)
+    return;
+
+  if(window->opaque_region.cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection,
+                        window->opaque_region.cookie.sequence);
+
+      window->opaque_region.cookie.sequence = 0;
+    }
+
+  window->opaque_region.rectangles_len = 0;
+
+  if(!(*globalconf.rendering->is_window_argb)(window))
+    return;
+
+  window->opaque_region.cookie =
+    xcb_get_property_unchecked(globalconf.connection, false, window->id,
+                               UNAGI__NET_WM_OPAQUE_REGION,
+                               XCB_ATOM_CARDINAL, 0,
+                               UNAGI_WINDOW_OPAQUE_RECTANGLES_MAX * 4);
+}
+
+/** Get the  opaque part of an ARGB window  given by _NET_WM_OPAQUE_REGION,
+ *  without blocking if the reply has not been received yet
+ *
+ * \param window The window object
+ * \param region Where to store the opaque part (screen relative)
+ * \return false if no part of the window is known to be opaque
+ */
+bool
+unagi_window_get_opaque_region(unagi_window_t *window, unagi_region_t *region)
+{
+  if(window->opaque_region.cookie.sequence)
+    {
+      xcb_get_property_reply_t *reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             window->opaque_region.cookie.sequence,
+                             (void **) &reply, &error))
+        return false;
+
+      window->opaque_region.cookie.sequence = 0;
+
+      if(reply && reply->type == XCB_ATOM_CARDINAL && reply->format == 32)
+        {
+          const uint32_t *value = xcb_get_property_value(reply);
+          const uint32_t rectangles_len =
+            min((uint32_t) xcb_get_property_value_length(reply) / 16,
+                UNAGI_WINDOW_OPAQUE_RECTANGLES_MAX);
+
+          for(uint32_t i = 0; i < rectangles_len; i++, value += 4)
+            window->opaque_region.rectangles[i] = (xcb_rectangle_t) {
+              (int16_t) value[0], (int16_t) value[1],
+              (uint16_t) value[2], (uint16_t) value[3]
+            };
+
+          window->opaque_region.rectangles_len = rectangles_len;
+        }
+
+      free(reply);
+      free(error);
+    }
+
+  if(!window->opaque_region.rectangles_len)
+    return false;
+
+  /* The rectangles are relative to the window, inside its border */
+  const int32_t x = window->geometry->x + window->geometry->border_width;
+  const int32_t y = window->geometry->y + window->geometry->border_width;
+
+  unagi_region_reset(region);
+
+  for(uint32_t i = 0; i < window->opaque_region.rectangles_len; i++)
+    {
+      const xcb_rectangle_t *rectangle = window->opaque_region.rectangles + i;
+
+      const unagi_region_box_t box = {
+        x + max(rectangle->x, 0),
+        y + max(rectangle->y, 0),
+        x + min(rectangle->x + rectangle->width, window->geometry->width),
+        y + min(rectangle->y + rectangle->height, window->geometry->height)
+      };
+
+      if(!unagi_region_box_is_empty(&box) &&
+         !unagi_region_union_box(region, &box))
+        {
+          unagi_region_reset(region);
+          return false;
+        }
+    }
+
+  return !unagi_region_is_empty(region);
+}
+
+/** Check whether the window is fullscreen or asked to be unredirected
+ *  through  _NET_WM_BYPASS_COMPOSITOR  (which may  also  forbid  its
+ *  unredirection)
+ *
+ * \param window The window object
+ * \return true if the window may be unredirected
+ */
+static bool
+window_has_unredirect_hint(unagi_window_t *window)
+{
+  /* Nothing is known until the replies have been received, and this is
+     called when painting, so never block.  Copies made by plugins never
+     own requests */
+  if(!window->is_record || !window_client_resolve(window))
+    return false;
+
+  if(window->is_unredirect_hints_stale)
+    {
+      window_client_get_unredirect_hints(window);
+      return false;
+    }
+
+  xcb_get_property_reply_t *reply;
+  xcb_generic_error_t *error;
+
+  if(window->wm_state_cookie.sequence)
+    {
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             window->wm_state_cookie.sequence,
+                             (void **) &reply, &error))
+        return false;
+
+      window->wm_state_cookie.sequence = 0;
+      window->is_fullscreen = false;
+
+      if(reply && reply->type == XCB_ATOM_ATOM && reply->format == 32)
+        {
+          const xcb_atom_t *atoms = xcb_get_property_value(reply);
+          const int atoms_len = xcb_get_property_value_length(reply) / 4;
+
+          for(int i = 0; i < atoms_len; i++)
+            if(atoms[i] == globalconf.ewmh._NET_WM_STATE_FULLSCREEN)
+              {
+                window->is_fullscreen = true;
+                break;
+              }
+        }
+
+      free(reply);
+      free(error);
+    }
+
+  if(window->bypass_compositor_cookie.sequence)
+    {
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             window->bypass_compositor_cookie.sequence,
+                             (void **) &reply, &error))
+        return false;
+
+      window->bypass_compositor_cookie.sequence = 0;
+
+      if(reply && reply->type == XCB_ATOM_CARDINAL && reply->format == 32 &&
+         xcb_get_property_value_length(reply) == 4)
+        window->bypass_compositor = *((uint32_t *) xcb_get_property_value(reply));
+      else
+        window->bypass_compositor = 0;
+
+      free(reply);
+      free(error);
+    }
+
+  /* As per  EWMH, 1 requests  the unredirection  whereas 2 asks  to
+     keep compositing the window */
+  return (window->bypass_compositor == 1 ||
+          (window->is_fullscreen && window->bypass_compositor != 2));
+}
+
+/** Send  the request to get  WM_CLASS, used to  look for  a specific
+ *  maximum damage rate,  whose reply is polled for when the rate of
+ *  the window is checked
+ *
+ * \param window The window object
+ */
+void
+unagi_window_update_damage_rate_max(unagi_window_t *window)
+{
+  /* Copies made by plugins never own requests */
+  if(!window->is_record)
+    return;
+
+  window->damage_rate.is_max_known = false;
+
+  if(window->damage_rate.wm_class_cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection,
+                        window->damage_rate.wm_class_cookie.sequence);
+
+      window->damage_rate.wm_class_cookie.sequence = 0;
+    }
+
+  if(cfg_size(globalconf.cfg, "damage-rate"))
+    window->damage_rate.wm_class_cookie =
+      xcb_get_property_unchecked(globalconf.connection, false, window->id,
+                                 XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, 256);
+}
+
+/** Get the  maximum number of  updates per second of the window, given
+ *  by the damage-rate section whose title  is either the  instance or
+ *  class name of WM_CLASS, or by damage-rate-max otherwise (also used
+ *  until the WM_CLASS reply has been received, as this is called upon
+ *  DamageNotify)
+ *
+ * \param window The window object
+ * \return The maximum rate, 0 if unlimited
+ */
+float
+unagi_window_get_damage_rate_max(unagi_window_t *window)
+{
+  if(window->damage_rate.is_max_known)
+    return window->damage_rate.max;
+
+  float max = (float) cfg_getfloat(globalconf.cfg, "damage-rate-max");
+
+  if(window->damage_rate.wm_class_cookie.sequence)
+    {
+      xcb_get_property_reply_t *reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             window->damage_rate.wm_class_cookie.sequence,
+                             (void **) &reply, &error))
+        return max > 0 ? max : 0;
+
+      free(error);
+      window->damage_rate.wm_class_cookie.sequence = 0;
+
+      int len;
+      if(reply && reply->type == XCB_ATOM_STRING && reply->format == 8 &&
+         (len = xcb_get_property_value_length(reply)) > 0)
+        {
+          /* WM_CLASS is made of two NULL-terminated strings, but the
+             last NULL may be missing */
+          char wm_class[len + 1];
+          memcpy(wm_class, xcb_get_property_value(reply), (size_t) len);
+          wm_class[len] = '\0';
+
+          for(const char *name = wm_class; name < wm_class + len;
+              name += strlen(name) + 1)
+            {
+              cfg_t *section = cfg_gettsec(globalconf.cfg, "damage-rate", name);
+              if(section)
+                {
+                  max = (float) cfg_getfloat(section, "max");
+                  break;
+                }
+            }
+        }
+
+      free(reply);
+    }
+
+  window->damage_rate.max = max > 0 ? max : 0;
+  window->damage_rate.is_max_known = true;
+  return window->damage_rate.max;
+}
+
+/** Check whether the given window is rectangular to optimize painting
+ *  as most windows are rectangular
+ *
+ * \param window The window object
+ * \return True if the window is rectangular
+ */
+bool
+unagi_window_is_rectangular(unagi_window_t *window)
+{
+  if(window->shape.cookie.sequence)
+    {
+      xcb_xfixes_fetch_region_reply_t *reply = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      /* Never block  (this is called while painting): until the reply
+         is received, the window is considered as non-rectangular, which
+         is slower but always correct */
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             window->shape.cookie.sequence,
+                             (void **) &reply, &error))
+        return false;
+
+      window->is_rectangular = !reply ||
+        xcb_xfixes_fetch_region_rectangles_length(reply) <= 1;
+
+      window->shape.cookie.sequence = 0;
+      window->shape.is_known = true;
+
+      free(reply);
+      free(error);
+    }
+  else if(!window->shape.is_known)
+    return false;
+
+  return window->is_rectangular;
+}
+
+/** Discard the shape of  the window, which will be fetched again when
+ *  its Region is re-created (upon ShapeNotify or, when the Shape
+ *  extension is not available, upon MapNotify)
+ *
+ * \param window The window object
+ */
+void
+unagi_window_discard_shape(unagi_window_t *window)
+{
+  if(window->shape.cookie.sequence)
+    {
+      xcb_discard_reply(globalconf.connection, window->shape.cookie.sequence);
+      window->shape.cookie.sequence = 0;
+    }
+
+  window->shape.is_known = false;
+}
+
+/** Get   the  region   of  the   given  Window   and  take   care  of
+ *  non-rectangular windows by using CreateRegionFromWindow instead of
+ *  Window size and position.  The Region of a window known to be
+ *  rectangular is created from its geometry instead
+ *
+ * \param window The window object
+ * \param screen_relative Whether the Region is relative to the screen
+ *        rather than to the window
+ * \param check_shape Whether the shape should be fetched if not known
+ * \return The region associated with the given Window
+ */
+xcb_xfixes_region_t
+unagi_window_get_region(unagi_window_t *window, bool screen_relative, bool check_shape)
+{
+  xcb_xfixes_region_t new_region = xcb_generate_id(globalconf.connection);
+
+  /* Bounding  shape  of  a  non-shaped  window,  including  its border,
+     relative to the window origin (inside the border) */
+  if(window->shape.is_known && window->is_rectangular)
+    {
+      const xcb_rectangle_t rectangle = {
+        (int16_t) (screen_relative ? window->geometry->x :
+                   -window->geometry->border_width),
+        (int16_t) (screen_relative ? window->geometry->y :
+                   -window->geometry->border_width),
+        window_width_with_border(window->geometry),
+        window_height_with_border(window->geometry)
+      };
+
+      xcb_xfixes_create_region(globalconf.connection, new_region, 1,
+                               &rectangle);
+
+      return new_region;
+    }
+
+  xcb_xfixes_create_region_from_window(globalconf.connection,
+                                       new_region,
+                                       window->id,
+                                       XCB_SHAPE_SK_BOUNDING);
+
+
+  if(screen_relative)
+    xcb_xfixes_translate_region(globalconf.connection,
+                                new_region,
+                                (int16_t) (window->geometry->x +
+                                           window->geometry->border_width),
+                                (int16_t) (window->geometry->y +
+                                           window->geometry->border_width));
+
+  unagi_debug("Created new region %x from window %x", new_region, window->id);
+
+  if(check_shape && window->is_record && !window->shape.is_known &&
+     !window->shape.cookie.sequence)
+    {
+      window->shape.cookie = xcb_xfixes_fetch_region_unchecked(globalconf.connection,
+                                                               new_region);
+
+      xcb_flush(globalconf.connection);
+    }
+
+  return new_region;
+}
+
+/** Check whether the window is visible within the screen geometry
+ *
+ * \param window The window object
+ * \return true if the window is visible
+ */
+bool
+unagi_window_is_visible(const unagi_window_t *window)
+{
+  return (window->attributes &&
+          window->attributes->map_state == XCB_MAP_STATE_VIEWABLE &&
+          window->geometry &&
+	  window->geometry->x + window->geometry->width >= 1 &&
+	  window->geometry->y + window->geometry->height >= 1 &&
+	  window->geometry->x < globalconf.screen->width_in_pixels &&
+	  window->geometry->y < globalconf.screen->height_in_pixels);
+}
+
+/** Send ChangeWindowAttributes  request to set  the override-redirect
+ *  flag  on the  given window  to define  whether the  window manager
+ *  should take care of the window or not
+ *
+ * \param window The window object
+ * \param do_override_redirect The value to set to override-redirect flag
+ */
+static inline void
+window_set_override_redirect(const unagi_window_t *window,
+			     const uint32_t do_override_redirect)
+{
+  xcb_change_window_attributes(globalconf.connection,
+			       window->id,
+			       XCB_CW_OVERRIDE_REDIRECT,
+			       &do_override_redirect);
+}
+
+/** Get  the Pixmap associated  with a  previously unmapped  window by
+ *  simply mapping  it and setting override-redirect to  true to avoid
+ *  the  window manager managing  it anymore.   This function  is only
+ *  relevant for plugins which may  want to get the Pixmap of unmapped
+ *  windows
+ *
+ * \param window The window object to get the Pixmap from
+ */
+void
+unagi_window_get_invisible_window_pixmap(unagi_window_t *window)
+{
+  unagi_debug("Getting Pixmap of invisible window %jx", (uintmax_t) window->id);
+
+  if(!window->attributes->override_redirect)
+    window_set_override_redirect(window, true);
+
+  xcb_map_window(globalconf.connection, window->id);
+  xcb_flush(globalconf.connection);
+}
+
+/** This  function must  be called  on  each window  object which  was
+ *  previously  unmapped once  the plugin  is not  enabled  anymore to
+ *  restore the state before the plugin was run
+ *
+ * \param window The window object to act on
+ */
+void
+unagi_window_get_invisible_window_pixmap_finalise(unagi_window_t *window)
+{
+  window_set_override_redirect(window, false);
+  xcb_unmap_window(globalconf.connection, window->id);
+  xcb_flush(globalconf.connection);
+}
+
+typedef struct
+{
+  xcb_get_window_attributes_cookie_t attributes;
+  xcb_get_geometry_cookie_t geometry;
+} window_add_requests_cookies_t;
+
+/** Send requests when a window is added (CreateNotify or on startup),
+ *  e.g. GetWindowAttributes request and  GetGeometry if specified (in
+ *  most cases,  it is necessary  except on CreateNotify event  as the
+ *  geometry is already given in the event itself)
+ *
+ * \param window_id The Window XID
+ * \param get_geometry Should GetGeometry request be sent
+ * \return The cookie associated with the request
+ */
+static window_add_requests_cookies_t
+window_add_requests(const xcb_window_t window_id, bool get_geometry)
+{
+  window_add_requests_cookies_t cookies;
+  cookies.geometry.sequence = 0;
+
+  cookies.attributes = xcb_get_window_attributes(globalconf.connection,
+                                                 window_id);
+
+  if(get_geometry)
+    cookies.geometry = xcb_get_geometry(globalconf.connection, window_id);
+
+  return cookies;
+}
+
+/** Create the Damage object of the window and select ShapeNotify.  An
+ *  error is only  returned if the window has been destroyed meanwhile,
+ *  which is then  removed upon DestroyNotify, so it is ignored rather
+ *  than waited for
+ *
+ * \param window The window object
+ */
+static void
+window_create_damage(unagi_window_t *window)
+{
+  window->damage = xcb_generate_id(globalconf.connection);
+
+  /* With DamageReportRawRectangles level, no attempt to compress
+     out overlapping rectangles is made, therefore many events are
+     received and handled needlessly, whereas with DamageReportNonEmpty
+     level only a single event specifying the full window region is sent
+     thus this is not efficient for small damage regions.  Start with
+     DamageReportDeltaRectangles, the level is then adapted to the
+     damages of the window when painting it */
+  window->damage_level.level = XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES;
+  window->damage_level.time = ev_now(globalconf.event_loop);
+
+  xcb_discard_reply(globalconf.connection,
+                    xcb_damage_create_checked(globalconf.connection,
+                                              window->damage, window->id,
+                                              window->damage_level.level).sequence);
+
+  /* Its shape is then only fetched again when it changes */
+  if(globalconf.extensions.shape)
+    xcb_shape_select_input(globalconf.connection, window->id, 1);
+}
+
+/** Get  the GetWindowAttributes  and GetGeometry  (if requested  when
+ *  calling window_add_requests) replies and  also associated a Damage
+ *  object to  it and  set the  attributes field  of the  given window
+ *  object
+ *
+ * \see window_add_requests
+ * \param window The window object
+ * \param attributes_cookie The cookie associated with the GetWindowAttributes request
+ * \return The GetWindowAttributes reply
+ */
+static bool
+window_add_requests_finalise(unagi_window_t * const window,
+			     const window_add_requests_cookies_t window_add_cookies)
+{
+  unagi_display_round_trip(window_add_cookies.attributes.sequence);
+
+  xcb_get_window_attributes_reply_t *attributes =
+    xcb_get_window_attributes_reply(globalconf.connection,
+                                    window_add_cookies.attributes,
+                                    NULL);
+
+  if(!attributes)
+    {
+      unagi_debug("GetWindowAttributes failed for window %jx", (uintmax_t) window->id);
+      return false;
+    }
+
+  window_record_t *record = (window_record_t *) window;
+  record->attributes = *attributes;
+  window->attributes = &record->attributes;
+  free(attributes);
+
+  /* No  need to create  a Damage  object for  an InputOnly  window as
+     nothing will never be painted in it */
+  if(window->attributes->_class == XCB_WINDOW_CLASS_INPUT_ONLY)
+    window->damage = XCB_NONE;
+  else
+    window_create_damage(window);
+
+  if(window_add_cookies.geometry.sequence)
+    {
+      unagi_display_round_trip(window_add_cookies.geometry.sequence);
+
+      xcb_get_geometry_reply_t *geometry =
+        xcb_get_geometry_reply(globalconf.connection,
+                               window_add_cookies.geometry,
+                               NULL);
+
+      if(!geometry)
+        {
+          unagi_debug("GetGeometry failed for window %jx", (uintmax_t) window->id);
+          return false;
+        }
+
+      unagi_window_set_geometry(window, geometry);
+      free(geometry);
+    }
+
+  unagi_window_stack_insert(window);
+  return true;
+}
+
+/** Check whether the given window has been created by unagi itself,
+ *  namely the CM window and the Composite overlay window
+ *
+ * \param window_id The Window XID
+ * \return true if the window must not be managed
+ */
+static inline bool
+window_is_internal(const xcb_window_t window_id)
+{
+  return (window_id == globalconf.cm_window ||
+          (globalconf.overlay_window != XCB_NONE &&
+           window_id == globalconf.overlay_window));
+}
+
+/** Existing windows being managed on startup, between the requests
+    sent by unagi_window_manage_existing() and their replies got by
+    unagi_window_manage_existing_finalise() */
+static struct
+{
+  unagi_window_t **windows;
+  window_add_requests_cookies_t *cookies;
+  int len;
+} _window_manage_existing;
+
+/** Manage all existing windows: send the GetWindowAttributes and
+ *  GetGeometry requests of all of them at once, and add them to the
+ *  windows list.  This function is called on startup while the server
+ *  is grabbed,  which can then be ungrabbed right away as the requests
+ *  will be processed before
+ *
+ * \see unagi_window_manage_existing_finalise
+ * \param nwindows The number of windows to add
+ * \param new_windows_id The Windows XIDs
+ */
+void
+unagi_window_manage_existing(const int nwindows,
+                             const xcb_window_t * const new_windows_id)
+{
+  globalconf.windows_itable = util_itable_new();
+  if(!globalconf.windows_itable)
+    unagi_fatal("Cannot allocate memory for windows hash table");
+
+  if(!nwindows)
+    return;
+
+  _window_manage_existing.windows = malloc(sizeof(unagi_window_t *) *
+                                           (size_t) nwindows);
+
+  _window_manage_existing.cookies = malloc(sizeof(window_add_requests_cookies_t) *
+                                           (size_t) nwindows);
+
+  if(!_window_manage_existing.windows || !_window_manage_existing.cookies)
+    unagi_fatal("Cannot allocate memory for existing windows");
+
+  _window_manage_existing.len = nwindows;
+
+  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
+    {
+      /* Ignore the CM and overlay windows */
+      if(!window_is_internal(new_windows_id[nwindow]))
+        _window_manage_existing.cookies[nwindow] =
+          window_add_requests(new_windows_id[nwindow], true);
+
+      _window_manage_existing.windows[nwindow] =
+        window_list_append(new_windows_id[nwindow]);
+    }
+
+  xcb_flush(globalconf.connection);
+}
+
+/** Finish managing the existing windows: get the replies of the
+ *  requests sent by unagi_window_manage_existing() (thus a single round
+ *  trip whatever the number of windows), then send all the requests
+ *  needed to paint the mapped windows (Damage, Pixmap, Region and
+ *  properties) at once without waiting for any reply, their errors
+ *  being handled in the event loop
+ *
+ * \return The number of windows managed
+ */
+int
+unagi_window_manage_existing_finalise(void)
+{
+  const int nwindows = _window_manage_existing.len;
+  unagi_window_t **new_windows = _window_manage_existing.windows;
+  int nwindows_managed = 0;
+
+  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
+    {
+      /* Ignore the CM and overlay windows */
+      if(window_is_internal(new_windows[nwindow]->id))
+	continue;
+
+      if(!window_add_requests_finalise(new_windows[nwindow],
+					_window_manage_existing.cookies[nwindow]))
+	{
+          unagi_warn("Cannot manage window %jx", (uintmax_t) new_windows[nwindow]->id);
+	  unagi_window_list_remove_window(new_windows[nwindow], true);
+          new_windows[nwindow] = NULL;
+	  continue;
+	}
+
+      nwindows_managed++;
+
+      /* The opacity  property is only  meaningful when the  window is
+	 mapped, because when the window is unmapped, we don't receive
+	 PropertyNotify */
+      if(unagi_window_is_visible(new_windows[nwindow]))
+	{
+	  unagi_window_register_notify(new_windows[nwindow]);
+          unagi_window_update_unredirect_hints(new_windows[nwindow], XCB_NONE);
+          unagi_window_update_opaque_region(new_windows[nwindow]);
+          unagi_window_update_damage_rate_max(new_windows[nwindow]);
+	  new_windows[nwindow]->pixmap = unagi_window_get_pixmap(new_windows[nwindow]);
+          unagi_window_stack_update(new_windows[nwindow]);
+
+          /* Get the Window Region as  well, this is also performed in
+             CreateNotify   and   ConfigureNotify   handler  for   new
+             Windows */
+          new_windows[nwindow]->region = unagi_window_get_region(new_windows[nwindow],
+                                                                 true, true);
+	}
+    }
+
+  /* Only give the windows actually managed to the plugins */
+  int nwindows_plugins = 0;
+  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
+    if(new_windows[nwindow] && !window_is_internal(new_windows[nwindow]->id))
+      new_windows[nwindows_plugins++] = new_windows[nwindow];
+
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+    if(plugin->vtable->window_manage_existing)
+      (*plugin->vtable->window_manage_existing)(nwindows_plugins, new_windows);
+
+  unagi_util_free(&_window_manage_existing.windows);
+  unagi_util_free(&_window_manage_existing.cookies);
+  _window_manage_existing.len = 0;
+
+  return nwindows_managed;
+}
+
+/** Add  the  given   window  to  the  windows  list   and  also  send
+ *  GetWindowAttributes request  (no need  to split this  function for
+ *  now) and GetGeometry if specified
+ *
+ * \see window_add_requests
+ * \param new_window_id The new Window XID
+ * \param get_geometry Should GetGeometry request be sent
+ * \return The new window object
+ */
+unagi_window_t *
+window_add(const xcb_window_t new_window_id, bool get_geometry)
+{
+  if(window_is_internal(new_window_id))
+    return NULL;
+
+  window_add_requests_cookies_t cookies = window_add_requests(new_window_id,
+                                                              get_geometry);
+
+  unagi_window_t *new_window = window_list_append(new_window_id);
+
+  /* The request should never fail... */
+  if(!window_add_requests_finalise(new_window, cookies))
+    {
+      unagi_window_list_remove_window(new_window, true);
+      return NULL;
+    }
+
+  return new_window;
+}
+
+/** Add a window created  (CreateNotify) without waiting for any reply:
+ *  the GetWindowAttributes request is sent and its reply only got from
+ *  the  event  loop  by  unagi_window_flush_setup(),  or  when  the
+ *  attributes are actually needed (MapNotify).  Meanwhile, the window
+ *  is known to be unmapped and is  considered InputOnly, thus nothing
+ *  is painted for it
+ *
+ * \param new_window_id The new Window XID
+ * \param geometry The window geometry given in CreateNotify
+ * \param override_redirect The override-redirect flag given in CreateNotify
+ * \return The new window object
+ */
+unagi_window_t *
+unagi_window_add_created(const xcb_window_t new_window_id,
+                         const xcb_get_geometry_reply_t *geometry,
+                         const bool override_redirect)
+{
+  if(window_is_internal(new_window_id))
+    return NULL;
+
+  if(_window_setup_queue.len == _window_setup_queue.size)
+    {
+      const uint32_t size = _window_setup_queue.size ?
+        _window_setup_queue.size * 2 : 64;
+
+      xcb_window_t *ids = realloc(_window_setup_queue.ids,
+                                  sizeof(xcb_window_t) * size);
+      if(!ids)
+        return NULL;
+
+      _window_setup_queue.ids = ids;
+      _window_setup_queue.size = size;
+    }
+
+  unagi_window_t *new_window = window_list_append(new_window_id);
+
+  new_window->setup.cookie = xcb_get_window_attributes(globalconf.connection,
+                                                       new_window_id);
+  new_window->setup.is_pending = true;
+
+  _window_setup_queue.ids[_window_setup_queue.len++] = new_window_id;
+
+  window_record_t *record = (window_record_t *) new_window;
+  record->attributes._class = XCB_WINDOW_CLASS_INPUT_ONLY;
+  record->attributes.map_state = XCB_MAP_STATE_UNMAPPED;
+  record->attributes.override_redirect = override_redirect;
+  new_window->attributes = &record->attributes;
+
+  unagi_window_set_geometry(new_window, geometry);
+  return new_window;
+}
+
+/** Complete the setup of a window added upon CreateNotify given its
+ *  GetWindowAttributes reply:  the map state and override-redirect
+ *  flag are kept as they have been tracked from the events since then
+ *
+ * \param window The window object
+ * \param attributes The GetWindowAttributes reply, NULL on error
+ * \return false if the window does not exist anymore
+ */
+static bool
+window_setup_complete(unagi_window_t *window,
+                      xcb_get_window_attributes_reply_t *attributes)
+{
+  window->setup.is_pending = false;
+  window->setup.cookie.sequence = 0;
+
+  /* The window has  been destroyed meanwhile, it is removed upon
+     DestroyNotify and is never painted until then */
+  if(!attributes)
+    {
+      unagi_debug("GetWindowAttributes failed for window %jx",
+                  (uintmax_t) window->id);
+
+      return false;
+    }
+
+  const uint8_t map_state = window->attributes->map_state;
+  const uint8_t override_redirect = window->attributes->override_redirect;
+
+  /* Through the pointer rather than  the record as the window may be a
+     copy made by a plugin, sharing the attributes of the record */
+  *window->attributes = *attributes;
+  window->attributes->map_state = map_state;
+  window->attributes->override_redirect = override_redirect;
+  free(attributes);
+
+  if(window->attributes->_class != XCB_WINDOW_CLASS_INPUT_ONLY)
+    window_create_damage(window);
+
+  return true;
+}
+
+/** Complete the setup of a window added upon CreateNotify right now,
+ *  blocking until the GetWindowAttributes reply has been received if
+ *  needed
+ *
+ * \param window The window object
+ * \return false if the window does not exist anymore
+ */
+bool
+unagi_window_setup_finalise(unagi_window_t *window)
+{
+  if(!window->setup.is_pending)
+    return true;
+
+  unagi_debug("Waiting for GetWindowAttributes reply of window %jx",
+              (uintmax_t) window->id);
+
+  unagi_display_round_trip(window->setup.cookie.sequence);
+
+  return window_setup_complete(window,
+                               xcb_get_window_attributes_reply(globalconf.connection,
+                                                               window->setup.cookie,
+                                                               NULL));
+}
+
+/** Complete the setup  of the windows added upon CreateNotify whose
+ *  GetWindowAttributes reply has already been received, without ever
+ *  blocking.  This is called  from the event loop once the events have
+ *  been handled, so that a burst of CreateNotify is pipelined
+ */
+void
+unagi_window_flush_setup(void)
+{
+  uint32_t i;
+  for(i = 0; i < _window_setup_queue.len; i++)
+    {
+      unagi_window_t *window = unagi_window_list_get(_window_setup_queue.ids[i]);
+
+      /* Destroyed or already set up (MapNotify) */
+      if(!window || !window->setup.is_pending)
+        continue;
+
+      xcb_get_window_attributes_reply_t *attributes = NULL;
+      xcb_generic_error_t *error = NULL;
+
+      /* As  replies are received  in requests order, the next ones are
+         not there either */
+      if(!xcb_poll_for_reply(globalconf.connection,
+                             window->setup.cookie.sequence,
+                             (void **) &attributes, &error))
+        break;
+
+      free(error);
+      window_setup_complete(window, attributes);
+    }
+
+  _window_setup_queue.len -= i;
+  memmove(_window_setup_queue.ids, _window_setup_queue.ids + i,
+          sizeof(xcb_window_t) * _window_setup_queue.len);
+
+  /* Make sure the requests of the windows left have been sent */
+  if(_window_setup_queue.len)
+    xcb_flush(globalconf.connection);
+}
+
+/** Raise and map given window above all other windows. This is just a
+ *  convenient function implemented by XMapRaised() in Xlib
+ *
+ * \param window The window object to raise and map
+ */
+void
+unagi_window_map_raised(const unagi_window_t *window)
+{
+  const uint32_t value = XCB_STACK_MODE_ABOVE;
+
+  xcb_configure_window(globalconf.connection,
+                       window->id,
+                       XCB_CONFIG_WINDOW_STACK_MODE,
+                       &value);
+
+  xcb_map_window(globalconf.connection, window->id);
+  xcb_flush(globalconf.connection);
+}
+
+/** Restack  the given  window object  by placing  it below  the given
+ *  window  (e.g. it  simply inserts  before the  given  window object
+ *  _before_ the new above window)
+ *
+ * \param window The window object to restack
+ * \param window_new_above_id The window which is going to above
+ */
+void
+unagi_window_restack(unagi_window_t *window, xcb_window_t window_new_above_id)
+{
+  assert(globalconf.windows);
+  assert(window);
+
+  /* If the  window is on the bottom  of the stack, then  insert it at
+     the beginning of the windows list */
+  if(window_new_above_id == XCB_NONE)
+    {
+      /* Most ConfigureNotify do not change the stacking order */
+      if(globalconf.windows == window)
+        return;
+
+      /* Remove the window from the list, but don't delete its data */
+      unagi_window_list_remove_window(window, false);
+      unagi_window_stack_remove(window);
+
+      window->next = globalconf.windows;
+      window->prev = NULL;
+      globalconf.windows = window;
+      if(window->next)
+        window->next->prev = window;
+      else
+        globalconf.windows_tail = window;
+    }
+  /* Otherwise insert it before the above window */
+  else
+    {
+      /* If it is asked to put a window below itself, or the asked
+         window doesn't exists, do nothing */
+      unagi_window_t *window_below = unagi_window_list_get(window_new_above_id);
+      if(window_below == window || window_below == NULL ||
+         window->prev == window_below)
+        return;
+
+      /* Remove the window from the list, but don't delete its data */
+      unagi_window_list_remove_window(window, false);
+      unagi_window_stack_remove(window);
+
+      window->next = window_below->next;
+      window->prev = window_below;
+      window_below->next = window;
+      if(window->next)
+        window->next->prev = window;
+      else
+        globalconf.windows_tail = window;
+    }
+
+  unagi_window_stack_insert(window);
+}
+
+/** Make sure the occlusion culling arrays can hold the given number of
+ *  windows
+ *
+ * \param windows_len The number of windows
+ * \return false if the memory could not be allocated
+ */
+static bool
+window_occlusion_reserve(const uint32_t windows_len)
+{
+  if(windows_len <= _window_occlusion.size)
+    return true;
+
+  uint32_t size = _window_occlusion.size ? _window_occlusion.size * 2 : 64;
+  while(size < windows_len)
+    size *= 2;
+
+  unagi_region_t *regions = realloc(_window_occlusion.visible_regions,
+                                    sizeof(unagi_region_t) * size);
+  if(!regions)
+    return false;
+
+  for(uint32_t i = _window_occlusion.size; i < size; i++)
+    unagi_region_init(&regions[i]);
+
+  _window_occlusion.visible_regions = regions;
+  _window_occlusion.size = size;
+  return true;
+}
+
+/** Get the opacity of a window as given by the first plugin defining
+ *  window_get_opacity hook (the same one used by the rendering backend)
+ *
+ * \param window The window object
+ * \return The window opacity
+ */
+static uint16_t
+window_get_opacity(unagi_window_t *window)
+{
+  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
+    if(plugin->enable && plugin->vtable->activated &&
+       plugin->vtable->window_get_opacity)
+      return (*plugin->vtable->window_get_opacity)(window);
+
+  return UINT16_MAX;
+}
+
+/** Check whether the opaque pixels of the window hide what is painted
+ *  below, meaning that it is not transformed, fully opaque and not
+ *  painted clipped to the Pixmap of its previous size
+ *
+ * \param window The window object
+ * \return true if the opaque pixels of the window are painted as is
+ */
+static bool
+window_is_painted_as_is(unagi_window_t *window)
+{
+  return (window->transform_status == UNAGI_WINDOW_TRANSFORM_STATUS_NONE &&
+          !window->resize.is_pending &&
+          window_get_opacity(window) == UINT16_MAX);
+}
+
+/** Check whether  the window  of a stacking array entry hides entirely
+ *  what is painted below  within its area, meaning that it is without
+ *  alpha channel (checked first from the entry itself), rectangular,
+ *  not transformed, fully opaque and not painted clipped to the Pixmap
+ *  of its previous size
+ *
+ * \param entry The stacking array entry
+ * \return true if the window is opaque
+ */
+static inline bool
+window_stack_entry_is_opaque(const unagi_window_stack_entry_t *entry)
 {
-  xcb_change_window_attributes(globalconf.connection,
-			       window->id,
-			       XCB_CW_OVERRIDE_REDIRECT,
-			       &do_override_redirect);
+  return (!entry->is_argb &&
+          window_is_painted_as_is(entry->window) &&
+          unagi_window_is_rectangular(entry->window));
 }
 
-/** Get  the Pixmap associated  with a  previously unmapped  window by
- *  simply mapping  it and setting override-redirect to  true to avoid
- *  the  window manager managing  it anymore.   This function  is only
- *  relevant for plugins which may  want to get the Pixmap of unmapped
- *  windows
+/** Get the window which may be unredirected, that is to say the
+ *  topmost visible window if it is fullscreen (or asked to be
+ *  unredirected), opaque and covers all the CRTCs.  As all the windows
+ *  are then unredirected, covering only one CRTC is not enough with
+ *  several monitors, whose windows would not be composited anymore
  *
- * \param window The window object to get the Pixmap from
+ * \return The window object or NULL
  */
-void
-unagi_window_get_invisible_window_pixmap(unagi_window_t *window)
+unagi_window_t *
+unagi_window_get_unredirect_candidate(void)
 {
-  unagi_debug("Getting Pixmap of invisible window %jx", (uintmax_t) window->id);
+  uint32_t n;
+  for(n = _window_stack.len;
+      n > 0 && !window_stack_entry_is_visible(_window_stack.entries + n - 1);
+      n--)
+    ;
 
-  if(!window->attributes->override_redirect)
-    window_set_override_redirect(window, true);
+  if(!n)
+    return NULL;
 
-  xcb_map_window(globalconf.connection, window->id);
-  xcb_flush(globalconf.connection);
+  const unagi_window_stack_entry_t *entry = _window_stack.entries + n - 1;
+
+  const int32_t x1 = entry->box.x1;
+  const int32_t y1 = entry->box.y1;
+  const int32_t x2 = entry->box.x2;
+  const int32_t y2 = entry->box.y2;
+
+  for(unsigned int i = 0; i < globalconf.crtc_len; i++)
+    {
+      const xcb_randr_get_crtc_info_reply_t *crtc = globalconf.crtc[i];
+
+      if(x1 > crtc->x || y1 > crtc->y ||
+         x2 < crtc->x + crtc->width || y2 < crtc->y + crtc->height)
+        return NULL;
+    }
+
+  /* Checked last as the hints may have to be requested */
+  if(!window_stack_entry_is_opaque(entry) ||
+     !window_has_unredirect_hint(entry->window))
+    return NULL;
+
+  return entry->window;
 }
 
-/** This  function must  be called  on  each window  object which  was
- *  previously  unmapped once  the plugin  is not  enabled  anymore to
- *  restore the state before the plugin was run
+/** Number of  consecutive repaints where  the window was fully damaged
+    before reporting only the bounding box of its damages */
+#define WINDOW_DAMAGE_LEVEL_BOUNDING_BOX_STREAK 30
+
+/** Number of  consecutive repaints where  the window was fully damaged
+    with DamageReportBoundingBox before only reporting that it has been
+    damaged (DamageReportNonEmpty) */
+#define WINDOW_DAMAGE_LEVEL_NON_EMPTY_STREAK 120
+
+/** Number  of consecutive repaints  where the bounding box  of the
+    damages covered less than WINDOW_DAMAGE_LEVEL_PARTIAL_RATIO of the
+    window before reporting all the damaged rectangles again */
+#define WINDOW_DAMAGE_LEVEL_DELTA_RECTANGLES_STREAK 10
+#define WINDOW_DAMAGE_LEVEL_PARTIAL_RATIO 0.5
+
+/** As nothing can be  known about the  damages with DamageReportNonEmpty,
+    report their bounding box again after this time (in seconds) to check
+    whether the window is still fully damaged */
+#define WINDOW_DAMAGE_LEVEL_NON_EMPTY_PROBE_INTERVAL 5.0
+
+/** Number of DamageNotify events received per report level */
+static uint64_t _window_damage_level_events[XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY + 1];
+
+/** Account a DamageNotify event received for the given window, whose
+ *  damage has to be subtracted
  *
- * \param window The window object to act on
+ * \param window The window object
  */
 void
-unagi_window_get_invisible_window_pixmap_finalise(unagi_window_t *window)
+unagi_window_account_damage_notify(unagi_window_t *window)
 {
-  window_set_override_redirect(window, false);
-  xcb_unmap_window(globalconf.connection, window->id);
-  xcb_flush(globalconf.connection);
+  /* Its damage will have to be subtracted before painting it */
+  window->is_damage_reported = true;
+
+  if(window->damage_level.level <= XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY)
+    _window_damage_level_events[window->damage_level.level]++;
 }
 
-typedef struct
+/** Get the number of windows currently  using the given report level
+ *  and the number of DamageNotify events received with this level
+ *
+ * \param level The Damage report level
+ * \param windows_len Where to store the number of windows
+ * \return The number of DamageNotify events
+ */
+uint64_t
+unagi_window_get_damage_level_stats(const xcb_damage_report_level_t level,
+                                    uint32_t *windows_len)
 {
-  xcb_get_window_attributes_cookie_t attributes;
-  xcb_get_geometry_cookie_t geometry;
-} window_add_requests_cookies_t;
+  *windows_len = 0;
+  for(unagi_window_t *window = globalconf.windows; window; window = window->next)
+    if(window->damage && window->damage_level.level == level)
+      (*windows_len)++;
 
-/** Send requests when a window is added (CreateNotify or on startup),
- *  e.g. GetWindowAttributes request and  GetGeometry if specified (in
- *  most cases,  it is necessary  except on CreateNotify event  as the
- *  geometry is already given in the event itself)
+  return level <= XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY ?
+    _window_damage_level_events[level] : 0;
+}
+
+/** Recreate the Damage object  of the given window with another report
+ *  level.  The new Damage object  reports the whole window as damaged,
+ *  so the damage state of the window starts again from scratch
  *
- * \param window_id The Window XID
- * \param get_geometry Should GetGeometry request be sent
- * \return The cookie associated with the request
+ * \param window The window object
+ * \param level The new report level
  */
-static window_add_requests_cookies_t
-window_add_requests(const xcb_window_t window_id, bool get_geometry)
+static void
+window_set_damage_level(unagi_window_t *window,
+                        const xcb_damage_report_level_t level)
 {
-  window_add_requests_cookies_t cookies;
-  cookies.geometry.sequence = 0;
+  unagi_debug("Window %jx: Damage report level %d -> %d",
+              (uintmax_t) window->id, window->damage_level.level, level);
 
-  cookies.attributes = xcb_get_window_attributes(globalconf.connection,
-                                                 window_id);
+  xcb_damage_destroy(globalconf.connection, window->damage);
 
-  cookies.geometry = xcb_get_geometry(globalconf.connection, window_id);
+  window->damage = xcb_generate_id(globalconf.connection);
+  xcb_damage_create(globalconf.connection, window->damage, window->id, level);
 
-  return cookies;
+  window->damage_level.level = level;
+  window->damage_level.streak = 0;
+  window->damage_level.time = ev_now(globalconf.event_loop);
 }
 
-/** Get  the GetWindowAttributes  and GetGeometry  (if requested  when
- *  calling window_add_requests) replies and  also associated a Damage
- *  object to  it and  set the  attributes field  of the  given window
- *  object
+/** Adapt the  Damage report level  of the given window  to its damage
+ *  pattern, once it has been painted: DeltaRectangles for windows with
+ *  small updates (such as terminals), BoundingBox and then NonEmpty for
+ *  windows fully damaged at each repaint (such as videos or games)
  *
- * \see window_add_requests
  * \param window The window object
- * \param attributes_cookie The cookie associated with the GetWindowAttributes request
- * \return The GetWindowAttributes reply
+ * \return true if the Damage object has been recreated
  */
 static bool
-window_add_requests_finalise(unagi_window_t * const window,
-			     const window_add_requests_cookies_t window_add_cookies)
+window_update_damage_level(unagi_window_t *window)
 {
-  window->attributes = xcb_get_window_attributes_reply(globalconf.connection,
-						       window_add_cookies.attributes,
-						       NULL);
+  /* Plugins may paint copies of the window objects, only the actual
+     window object owns its Damage object */
+  if(!window->damage || unagi_window_list_get(window->id) != window)
+    return false;
 
-  if(!window->attributes)
-    {
-      unagi_debug("GetWindowAttributes failed for window %jx", (uintmax_t) window->id);
-      return false;
-    }
+  const bool is_fully_damaged =
+    window->damaged_ratio >= UNAGI_WINDOW_FULLY_DAMAGED_RATIO;
 
-  /* No  need to create  a Damage  object for  an InputOnly  window as
-     nothing will never be painted in it */
-  if(window->attributes->_class == XCB_WINDOW_CLASS_INPUT_ONLY)
-    window->damage = XCB_NONE;
-  else
+  switch(window->damage_level.level)
     {
-      window->damage = xcb_generate_id(globalconf.connection);
-
-      /* With DamageReportRawRectangles level, no attempt to compress
-         out overlapping rectangles is made, therefore many events are
-         received and handled needlessly, whereas with DamageReportNonEmpty
-         level only a single event specifying the full window region is sent
-         thus this is not efficient for small damage regions */
-      xcb_generic_error_t *error;
-      if((error = xcb_request_check(globalconf.connection,
-                                    xcb_damage_create_checked(globalconf.connection,
-                                                              window->damage,
-                                                              window->id,
-                                                              XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES))))
+    case XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES:
+      if(!is_fully_damaged)
+        window->damage_level.streak = 0;
+      else if(++window->damage_level.streak >=
+              WINDOW_DAMAGE_LEVEL_BOUNDING_BOX_STREAK)
         {
-          free(error);
-          unagi_debug("DamageCreate failed for window %jx", (uintmax_t) window->id);
-          return false;
+          window_set_damage_level(window, XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX);
+          return true;
         }
-    }
 
-  if(window_add_cookies.geometry.sequence)
-    {
-      window->geometry = xcb_get_geometry_reply(globalconf.connection,
-                                                window_add_cookies.geometry,
-                                                NULL);
+      break;
 
-      if(!window->geometry)
+    case XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX:
+      /* The streak counts fully damaged repaints when positive and
+         partially damaged ones otherwise */
+      if(is_fully_damaged)
         {
-          unagi_debug("GetGeometry failed for window %jx", (uintmax_t) window->id);
-          return false;
+          if(window->damage_level.streak < 0)
+            window->damage_level.streak = 0;
+
+          if(++window->damage_level.streak >= WINDOW_DAMAGE_LEVEL_NON_EMPTY_STREAK)
+            {
+              window_set_damage_level(window, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+              return true;
+            }
+        }
+      else if(window->damaged_ratio < WINDOW_DAMAGE_LEVEL_PARTIAL_RATIO)
+        {
+          if(window->damage_level.streak > 0)
+            window->damage_level.streak = 0;
+
+          if(--window->damage_level.streak <=
+             -WINDOW_DAMAGE_LEVEL_DELTA_RECTANGLES_STREAK)
+            {
+              window_set_damage_level(window,
+                                      XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES);
+              return true;
+            }
+        }
+      else
+        window->damage_level.streak = 0;
+
+      break;
+
+    case XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY:
+      if(ev_now(globalconf.event_loop) - window->damage_level.time >=
+         WINDOW_DAMAGE_LEVEL_NON_EMPTY_PROBE_INTERVAL)
+        {
+          window_set_damage_level(window, XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX);
+          return true;
         }
+
+      break;
+
+    default:
+      break;
     }
 
-  return true;
+  return false;
 }
 
-/** Manage  all  existing   windows  and  get  information  (geometry,
- *  attributes and opacity). This function is called on startup to add
- *  existing windows
+/** Subtract the  damage  of the given window  about  to be painted.
+ *  This is done before sending any painting request, so that whatever
+ *  is drawn in the window afterwards is always reported again.  When
+ *  the damaged Region has  been restricted to some areas, only these
+ *  ones are subtracted, the rest being painted later on
  *
- * \param nwindows The number of windows to add
- * \param new_windows_id The Windows XIDs
+ * \param window The window object
+ * \param areas The areas painted, NULL if the whole damaged Region is
+ * \param areas_len The number of areas
  */
-void
-unagi_window_manage_existing(const int nwindows,
-                             const xcb_window_t * const new_windows_id)
+static void
+window_subtract_damage(unagi_window_t *window,
+                       const xcb_rectangle_t *areas,
+                       const uint32_t areas_len)
 {
-  window_add_requests_cookies_t window_add_cookies[nwindows];
+  /* The new Damage object reports the whole window anyway */
+  if(window->damaged_ratio && window_update_damage_level(window))
+    {
+      window->is_damage_reported = false;
+      return;
+    }
 
-  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
-    /* Ignore the CM window */
-    if(new_windows_id[nwindow] != globalconf.cm_window)
-      window_add_cookies[nwindow] = window_add_requests(new_windows_id[nwindow],
-                                                        true);
+  /* Nothing to subtract if no DamageNotify has been received since the
+     last subtraction (for example when the window has only been moved) */
+  if(!window->damage || !window->is_damage_reported)
+    return;
 
-  globalconf.windows_itree = util_itree_new();
+  if(areas_len)
+    {
+      const int32_t x = window->geometry->x + window->geometry->border_width;
+      const int32_t y = window->geometry->y + window->geometry->border_width;
+      const int32_t width = window->geometry->width;
+      const int32_t height = window->geometry->height;
 
-  unagi_window_t *new_windows[nwindows];
-  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
-    new_windows[nwindow] = window_list_append(new_windows_id[nwindow]);
+      /* Painted areas, relative to the window */
+      xcb_rectangle_t repairs[areas_len];
+      uint32_t repairs_len = 0;
+      bool is_covered = false;
 
-  for(int nwindow = 0; nwindow < nwindows; ++nwindow)
-    {
-      /* Ignore the CM window */
-      if(new_windows_id[nwindow] == globalconf.cm_window)
-	continue;
+      for(uint32_t i = 0; i < areas_len && !is_covered; i++)
+        {
+          const int32_t x1 = max(areas[i].x - x, 0);
+          const int32_t y1 = max(areas[i].y - y, 0);
+          const int32_t x2 = min(areas[i].x + areas[i].width - x, width);
+          const int32_t y2 = min(areas[i].y + areas[i].height - y, height);
 
-      if(!window_add_requests_finalise(new_windows[nwindow],
-					window_add_cookies[nwindow]))
-	{
-          unagi_warn("Cannot manage window %jx", (uintmax_t) new_windows_id[nwindow]);
-	  unagi_window_list_remove_window(new_windows[nwindow], true);
-	  continue;
-	}
+          if(x1 >= x2 || y1 >= y2)
+            continue;
 
-      /* The opacity  property is only  meaningful when the  window is
-	 mapped, because when the window is unmapped, we don't receive
-	 PropertyNotify */
-      if(unagi_window_is_visible(new_windows[nwindow]))
-	{
-	  unagi_window_register_notify(new_windows[nwindow]);
-	  new_windows[nwindow]->pixmap = unagi_window_get_pixmap(new_windows[nwindow]);
+          is_covered = (!x1 && !y1 && x2 == width && y2 == height);
 
-          /* Get the Window Region as  well, this is also performed in
-             CreateNotify   and   ConfigureNotify   handler  for   new
-             Windows */
-          new_windows[nwindow]->region = unagi_window_get_region(new_windows[nwindow],
-                                                                 true, true);
-	}
+          repairs[repairs_len++] = (xcb_rectangle_t) {
+            (int16_t) x1, (int16_t) y1, (uint16_t) (x2 - x1), (uint16_t) (y2 - y1)
+          };
+        }
+
+      /* The damage of the window will only be painted later on */
+      if(!repairs_len)
+        return;
+
+      if(!is_covered)
+        {
+          if(_window_repair_region)
+            xcb_xfixes_set_region(globalconf.connection, _window_repair_region,
+                                  repairs_len, repairs);
+          else
+            {
+              _window_repair_region = xcb_generate_id(globalconf.connection);
+              xcb_xfixes_create_region(globalconf.connection,
+                                       _window_repair_region,
+                                       repairs_len, repairs);
+            }
+
+          /* The rest of the damage remains to be subtracted */
+          xcb_damage_subtract(globalconf.connection, window->damage,
+                              _window_repair_region, XCB_NONE);
+
+          return;
+        }
     }
 
-  for(unagi_plugin_t *plugin = globalconf.plugins; plugin; plugin = plugin->next)
-    if(plugin->vtable->window_manage_existing)
-      (*plugin->vtable->window_manage_existing)(nwindows, new_windows);
+  /* Reset  the  damaged  region   in  order  to  get  damages  occurring
+     after   the    repaint,   otherwise,    with
+     DamageReportDeltaRectangles level,  DamageNotify won't be send if
+     the same region  was already damaged  during the previous repaint */
+  xcb_damage_subtract(globalconf.connection, window->damage,
+                      XCB_NONE, XCB_NONE);
+
+  window->is_damage_reported = false;
 }
 
-/** Add  the  given   window  to  the  windows  list   and  also  send
- *  GetWindowAttributes request  (no need  to split this  function for
- *  now) and GetGeometry if specified
+/** Subtract the damage of  all the windows  about to be painted, at one
+ *  point of the frame
  *
- * \see window_add_requests
- * \param new_window_id The new Window XID
- * \param get_geometry Should GetGeometry request be sent
- * \return The new window object
+ * \see window_subtract_damage
  */
-unagi_window_t *
-window_add(const xcb_window_t new_window_id, bool get_geometry)
+static void
+window_subtract_damages(void)
 {
-  window_add_requests_cookies_t cookies = window_add_requests(new_window_id,
-                                                              get_geometry);
+  uint32_t areas_len;
+  const xcb_rectangle_t *areas = unagi_display_get_restricted_area(&areas_len);
 
-  unagi_window_t *new_window = window_list_append(new_window_id);
+  for(uint32_t i = 0; i < _window_stack.len; i++)
+    window_subtract_damage(_window_stack.entries[i].window, areas, areas_len);
+}
 
-  /* The request should never fail... */
-  if(!window_add_requests_finalise(new_window, cookies))
+/** Reset the damage of the given window once it has been painted
+ *
+ * \param window The window object
+ */
+static void
+window_reset_damage(unagi_window_t *window)
+{
+  /* When the  window has been damaged  or was damaged but  is not
+     visible anymore */
+  if(window->damaged_ratio)
     {
-      unagi_window_list_remove_window(new_window, true);
-      return NULL;
-    }
+      /* Reset damaged ratio for the next repaint */
+      window->damaged_ratio = 0.0;
 
-  return new_window;
+      /* And the DamageNotify events counter */
+      window->damage_notify_counter = 0;
+
+      /* And the damaged areas */
+      window_discard_damaged_coverage(window);
+    }
 }
 
-/** Raise and map given window above all other windows. This is just a
- *  convenient function implemented by XMapRaised() in Xlib
+/** Discard the damage of a window which is not painted anymore, such as
+ *  an unmapped window, as  its damage is otherwise only subtracted and
+ *  reset when painting it
  *
- * \param window The window object to raise and map
+ * \param window The window object
  */
 void
-unagi_window_map_raised(const unagi_window_t *window)
+unagi_window_discard_damage(unagi_window_t *window)
 {
-  const uint32_t value = XCB_STACK_MODE_ABOVE;
+  if(window->damage && window->is_damage_reported)
+    {
+      xcb_damage_subtract(globalconf.connection, window->damage,
+                          XCB_NONE, XCB_NONE);
 
-  xcb_configure_window(globalconf.connection,
-                       window->id,
-                       XCB_CONFIG_WINDOW_STACK_MODE,
-                       &value);
+      window->is_damage_reported = false;
+    }
 
-  xcb_map_window(globalconf.connection, window->id);
-  xcb_flush(globalconf.connection);
+  window_reset_damage(window);
 }
 
-/** Restack  the given  window object  by placing  it below  the given
- *  window  (e.g. it  simply inserts  before the  given  window object
- *  _before_ the new above window)
+/** Get the window which can be painted directly on the screen rather
+ *  than in the buffer: the topmost  window intersecting the damaged
+ *  region if it is opaque and contains the whole damaged region (such
+ *  as a terminal repainting within its own bounds). Nothing else is
+ *  visible  within the damaged region, thus  painting it directly
+ *  does not flicker
  *
- * \param window The window object to restack
- * \param window_new_above_id The window which is going to above
- * \todo optimization
+ * \return The window object or NULL
  */
-void
-unagi_window_restack(unagi_window_t *window, xcb_window_t window_new_above_id)
+static unagi_window_t *
+window_get_direct_paint_window(void)
 {
-  assert(globalconf.windows);
-  assert(window);
-
-  /* If the  window is on the bottom  of the stack, then  insert it at
-     the beginning of the windows list */
-  if(window_new_above_id == XCB_NONE)
+  unagi_region_box_t extents;
+  if(globalconf.background_reset || globalconf.force_repaint ||
+     !unagi_display_get_damaged_extents(&extents) ||
+     unagi_region_box_is_empty(&extents))
+    return NULL;
+
+  /* Plugins such as expose paint their own windows, whereas opacity
+     is already taken into account by window_stack_entry_is_opaque() */
+  if(unagi_plugin_is_painting_activated())
+    return NULL;
+
+  for(uint32_t i = _window_stack.len; i-- > 0;)
     {
-      /* Remove the window from the list, but don't delete its data */
-      unagi_window_list_remove_window(window, false);
+      const unagi_window_stack_entry_t *entry = _window_stack.entries + i;
 
-      window->next = globalconf.windows;
-      window->prev = NULL;
-      globalconf.windows = window;
-      if(window->next)
-        window->next->prev = window;
-      else
-        globalconf.windows_tail = window;
-    }
-  /* Otherwise insert it before the above window */
-  else
-    {
-      /* If it is asked to put a window below itself, or the asked
-         window doesn't exists, do nothing */
-      unagi_window_t *window_below = unagi_window_list_get(window_new_above_id);
-      if(window_below == window || window_below == NULL)
-        return;
+      if(entry->pixmap == XCB_NONE || !window_stack_entry_is_visible(entry))
+        continue;
 
-      /* Remove the window from the list, but don't delete its data */
-      unagi_window_list_remove_window(window, false);
+      const unagi_region_box_t window_box = entry->box;
 
-      window->next = window_below->next;
-      window->prev = window_below;
-      window_below->next = window;
-      if(window->next)
-        window->next->prev = window;
-      else
-        globalconf.windows_tail = window;
+      /* Does not intersect the damaged region */
+      if(window_box.x2 <= extents.x1 || window_box.x1 >= extents.x2 ||
+         window_box.y2 <= extents.y1 || window_box.y1 >= extents.y2)
+        continue;
+
+      if(entry->is_damaged &&
+         window_box.x1 <= extents.x1 && window_box.y1 <= extents.y1 &&
+         window_box.x2 >= extents.x2 && window_box.y2 >= extents.y2 &&
+         window_stack_entry_is_opaque(entry))
+        return entry->window;
+
+      return NULL;
     }
+
+  return NULL;
 }
 
 /** Paint all windows  on the screen by calling  the rendering backend
- *  hooks (not all windows may be painted though)
+ *  hooks (not all windows may be painted though).
  *
- * \param windows The list of windows currently managed
+ *  Only the viewable windows of the stacking array are walked. Before
+ *  painting, they are walked from the topmost to the bottommost to
+ *  compute the region covered by opaque windows: then, only the part
+ *  of a window not covered by the opaque windows above it is painted,
+ *  and the window is not painted at all if it is entirely covered
  */
 void
-unagi_window_paint_all(unagi_window_t *windows)
+unagi_window_paint_all(void)
 {
   /* If the background  is reset, then repaint the  whole screen, it's
      bad from a performance point of view, but it's done rarely */
   if(globalconf.background_reset)
     unagi_display_reset_damaged();
 
-  (*globalconf.rendering->paint_background)();
+  window_subtract_damages();
 
-  for(unagi_window_t *window = windows; window; window = window->next)
+  unagi_window_t *direct_window = window_get_direct_paint_window();
+  if(direct_window)
     {
-      if(globalconf.force_repaint && unagi_window_is_visible(window))
+      unagi_debug("Painting window %jx directly on the screen",
+                  (uintmax_t) direct_window->id);
+
+      for(uint32_t i = 0; i < _window_stack.len; i++)
+        if(_window_stack.entries[i].is_damaged)
+          window_reset_damage(_window_stack.entries[i].window);
+
+      xcb_flush(globalconf.connection);
+      display_vsync_drm_wait();
+      (*globalconf.rendering->paint_window_direct)(direct_window);
+      return;
+    }
+
+  (*globalconf.rendering->paint_background)();
+
+  const uint32_t windows_len = _window_stack.len;
+  if(!window_occlusion_reserve(windows_len))
+    unagi_fatal("Cannot allocate memory for occlusion culling");
+
+  if(globalconf.force_repaint)
+    for(uint32_t i = 0; i < windows_len; i++)
+      if(window_stack_entry_is_visible(_window_stack.entries + i))
         {
-          window->damaged = true;
-          window->damaged_ratio = 1.0;
+          _window_stack.entries[i].is_damaged = true;
+          _window_stack.entries[i].window->damaged = true;
+          _window_stack.entries[i].window->damaged_ratio = 1.0;
         }
 
-      if(window->damaged)
+  /* Compute the visible part  of each window to be painted, from the
+     topmost to the bottommost */
+  const unagi_region_box_t screen_box = {
+    0, 0,
+    globalconf.screen->width_in_pixels, globalconf.screen->height_in_pixels
+  };
+
+  unagi_region_reset(&_window_occlusion.opaque_region);
+
+  for(uint32_t i = windows_len; i-- > 0;)
+    {
+      const unagi_window_stack_entry_t *entry = _window_stack.entries + i;
+      if(!entry->is_damaged || entry->pixmap == XCB_NONE ||
+         !window_stack_entry_is_visible(entry))
+        continue;
+
+      unagi_window_t *window = entry->window;
+
+      unagi_region_box_t window_box = entry->box;
+
+      unagi_region_t *visible_region = &_window_occlusion.visible_regions[i];
+      unagi_region_reset_box(visible_region, &window_box);
+      unagi_region_subtract(visible_region, visible_region,
+                            &_window_occlusion.opaque_region);
+
+      if(window_stack_entry_is_opaque(entry))
         {
-          unagi_debug("Painting window %jx (ptr=%p), damaged_ratio=%.2f",
-                      (uintmax_t) window->id, window, window->damaged_ratio);
+          window_box.x1 = max(window_box.x1, screen_box.x1);
+          window_box.y1 = max(window_box.y1, screen_box.y1);
+          window_box.x2 = min(window_box.x2, screen_box.x2);
+          window_box.y2 = min(window_box.y2, screen_box.y2);
 
-          (*globalconf.rendering->paint_window)(window);
+          unagi_region_union_box(&_window_occlusion.opaque_region, &window_box);
         }
-      /* When the  window has been damaged  or was damaged but  is not
-         visible anymore */
-      if(window->damaged_ratio)
-        {
-          /* Reset damaged ratio for the next repaint */
-          window->damaged_ratio = 0.0;
+      /* Only the part given by _NET_WM_OPAQUE_REGION of ARGB windows */
+      else if(window_is_painted_as_is(window) &&
+              unagi_window_get_opaque_region(window,
+                                             &_window_occlusion.window_opaque_region))
+        unagi_region_union(&_window_occlusion.opaque_region,
+                           &_window_occlusion.opaque_region,
+                           &_window_occlusion.window_opaque_region);
+    }
 
-          /* And the DamageNotify events counter */
-          window->damage_notify_counter = 0;
+  uint32_t culled_composites = 0;
+  uint64_t culled_pixels = 0;
 
-          /* Reset  the  damaged  region   in  order  to  get  damages
-             occurring    after   the    repaint,   otherwise,    with
-             DamageReportDeltaRectangles level,  DamageNotify won't be
-             send if  the same region  was already damaged  during the
-             previous repaint */
-          xcb_damage_subtract(globalconf.connection, window->damage,
-                              XCB_NONE, XCB_NONE);
+  for(uint32_t i = 0; i < windows_len; i++)
+    {
+      const unagi_window_stack_entry_t *entry = _window_stack.entries + i;
+      unagi_window_t *window = entry->window;
+
+      if(entry->is_damaged)
+        {
+          if(entry->pixmap != XCB_NONE && window_stack_entry_is_visible(entry))
+            {
+              const unagi_region_t *visible_region =
+                &_window_occlusion.visible_regions[i];
+
+              const uint64_t window_area = unagi_region_box_area(&entry->box);
+
+              const uint64_t visible_area = unagi_region_area(visible_region);
+
+              culled_pixels += window_area - visible_area;
+
+              if(!visible_area)
+                {
+                  unagi_debug("Not painting window %jx (ptr=%p), fully covered",
+                              (uintmax_t) window->id, window);
+
+                  culled_composites++;
+                }
+              else
+                {
+                  unagi_debug("Painting window %jx (ptr=%p), damaged_ratio=%.2f",
+                              (uintmax_t) window->id, window,
+                              window->damaged_ratio);
+
+                  (*globalconf.rendering->paint_window)
+                    (window, visible_area == window_area ? NULL : visible_region);
+                }
+            }
+          else
+            (*globalconf.rendering->paint_window)(window, NULL);
+
+          window_reset_damage(window);
         }
     }
 
+  unagi_debug("Occlusion culling: %u composites and %ju pixels culled",
+              culled_composites, (uintmax_t) culled_pixels);
+
   xcb_flush(globalconf.connection);
   display_vsync_drm_wait();
   (*globalconf.rendering->paint_all)();
 
   globalconf.background_reset = false;
-  xcb_aux_sync(globalconf.connection);
 }